@@ -0,0 +1,10 @@
+@echo off
+if not exist build (
+	mkdir build
+)
+
+pushd build
+
+clang -g -fuse-ld=lld -o ooga_bench.exe ../build_bench.c -O2 -DNDEBUG -std=c11 -D_CRT_SECURE_NO_WARNINGS -Wextra -Wno-incompatible-library-redeclaration -Wno-sign-compare -Wno-unused-parameter -Wno-builtin-requires-header -Wno-deprecated-declarations -lkernel32 -lgdi32 -luser32 -lruntimeobject -lwinmm -ld3d11 -ldxguid -ld3dcompiler -lshlwapi -lole32 -lshcore -lavrt -lksuser -lsynchronization -ldbghelp
+
+popd
@@ -0,0 +1,21 @@
+///
+// Build config for ooga_bench, see oogabooga/bench.c
+
+#define OOGABOOGA_HEADLESS 1
+
+// Benchmarks measure the engine, not the profiler
+#define ENABLE_PROFILING 0
+
+#define INITIAL_PROGRAM_MEMORY_SIZE MB(5)
+#define TEMPORARY_STORAGE_SIZE MB(2)
+
+#define ENTRY_PROC bench_entry
+
+// Also compiles oogabooga/benchmarks.c
+#define RUN_BENCHMARKS 1
+
+#include "oogabooga/oogabooga.c"
+
+int bench_entry(int argc, char **argv) {
+	return bench_main(argc, argv);
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+
+CC=x86_64-w64-mingw32-gcc
+CFLAGS="-g -O2 -DNDEBUG -std=c11 --static -D_CRT_SECURE_NO_WARNINGS
+        -Wextra -Wno-sign-compare -Wno-unused-parameter
+        -lkernel32 -lgdi32 -luser32 -lruntimeobject
+        -lwinmm -ld3d11 -ldxguid -ld3dcompiler 
+        -lshlwapi -lole32 -lavrt -lksuser -ldbghelp -lsynchronization
+        -lshcore"
+SRC=../build_bench.c
+EXENAME=ooga_bench.exe
+
+mkdir -p build
+cd build
+$CC $SRC -o $EXENAME $CFLAGS
+cd ..
\ No newline at end of file
@@ -438,22 +438,42 @@ int entry(int argc, char **argv)
             int player_tile_x = world_pos_to_tile_pos(player_entity->position.x);
             int player_tile_y = world_pos_to_tile_pos(player_entity->position.y);
 
-            const int tile_radius_x = 13;
-            const int tile_radius_y = 10;
-            for (int x = player_tile_x - tile_radius_x; x < player_tile_x + tile_radius_x; ++x)
+            // The checkerboard only changes when the player moves to another tile
+            local_persist Static_Batch tile_batch = {0};
+            local_persist int batch_tile_x = 0;
+            local_persist int batch_tile_y = 0;
+            if (player_tile_x != batch_tile_x || player_tile_y != batch_tile_y)
             {
-                for (int y = player_tile_y - tile_radius_y; y < player_tile_y + tile_radius_y; ++y)
-                {
+                static_batch_mark_dirty(&tile_batch);
+            }
 
-                    if ((x + (y % 2 == 0)) % 2 == 0)
+            if (static_batch_needs_recording(&tile_batch))
+            {
+                batch_tile_x = player_tile_x;
+                batch_tile_y = player_tile_y;
+                static_batch_begin(&tile_batch);
+
+                const int tile_radius_x = 13;
+                const int tile_radius_y = 10;
+                for (int x = player_tile_x - tile_radius_x; x < player_tile_x + tile_radius_x; ++x)
+                {
+                    for (int y = player_tile_y - tile_radius_y; y < player_tile_y + tile_radius_y; ++y)
                     {
-                        float x_position = x * tile_width;
-                        float y_position = y * tile_width;
-                        Vector4 color = v4(0.1, 0.1, 0.1, 0.1);
-                        draw_rect(v2(x_position + (float)tile_width * -0.5f, y_position + (float)tile_width * -0.5f), v2(tile_width, tile_width), color);
+
+                        if ((x + (y % 2 == 0)) % 2 == 0)
+                        {
+                            float x_position = x * tile_width;
+                            float y_position = y * tile_width;
+                            Vector4 color = v4(0.1, 0.1, 0.1, 0.1);
+                            draw_rect(v2(x_position + (float)tile_width * -0.5f, y_position + (float)tile_width * -0.5f), v2(tile_width, tile_width), color);
+                        }
                     }
                 }
+
+                static_batch_end(&tile_batch);
             }
+
+            draw_static_batch(&tile_batch, m4_scalar(1.0));
         }
 
         // :hover world pos
@@ -641,8 +661,9 @@ int entry(int argc, char **argv)
                     xform = m4_translate(xform, v3(x_start_pos + slot_index_offset, y_pos, 0.0));
 
                     float is_selected_alpha = 0.0;
-                    Draw_Quad *quad = draw_rect_xform(xform, v2(8, 8), v4(1, 1, 1, 0.2));
-                    Range2f icon_box = quad_to_range(*quad);
+                    // Copy, the returned pointer is only valid until the next draw call
+                    Draw_Quad quad = *draw_rect_xform(xform, v2(8, 8), v4(1, 1, 1, 0.2));
+                    Range2f icon_box = quad_to_range(quad);
                     if (range2f_contains(icon_box, get_mouse_pos_in_ndc()))
                     {
                         is_selected_alpha = 1.0;
@@ -665,7 +686,7 @@ int entry(int argc, char **argv)
                     // :tooltip
                     if (is_selected_alpha)
                     {
-                        Draw_Quad screen_quad = ndc_quad_to_screen_quad(*quad);
+                        Draw_Quad screen_quad = ndc_quad_to_screen_quad(quad);
                         Range2f screen_range = quad_to_range(screen_quad);
                         Vector2 icon_center = range2f_get_center(screen_range);
 
@@ -38,6 +38,11 @@
 	player->config.volume                = ...; // (1.0 by default)
 	player->config.playback_speed        = ...; // (1.0 by default)
 	
+		Or, to make sure the audio thread never sees a half-written config:
+		
+	void                  audio_player_set_config(Audio_Player *p, Audio_Playback_Config config);
+	Audio_Playback_Config audio_player_get_config(Audio_Player *p);
+	
 */
 
 
@@ -1168,6 +1173,10 @@ typedef struct Audio_Player {
 	// I think we only need to sync when audio thread samples the source, which should be
 	// fairly quick and low contention, hence a spinlock.
 	Spinlock sample_lock; 
+	// Lets getters read frame_index & source without waiting for the audio thread to finish
+	// sampling. Written while holding sample_lock.
+	Seqlock position_seqlock;
+	Seqlock config_seqlock;
 	
 	// #Cleanup
 	DEPRECATED(Vector3 position, "Use player->config.position_ndc instead"); // ndc space -1 to 1
@@ -1229,7 +1238,7 @@ audio_player_get_one() {
 
 	new_block->players[0].allocated = true;
 	new_block->players[0].config.volume = 1.0;
-	block->players[0].config.playback_speed = 1.0;
+	new_block->players[0].config.playback_speed = 1.0;
 	return &new_block->players[0];
 }
 
@@ -1270,21 +1279,33 @@ audio_player_set_time_stamp(Audio_Player *p, float64 time_in_seconds) {
 	time_in_seconds = clamp(time_in_seconds, 0, full_duration);
 	float64 progression = time_in_seconds/full_duration;
 	
+	seqlock_write_begin(&p->position_seqlock);
 	p->frame_index = (u64)round((float64)p->source.number_of_frames*progression);
+	seqlock_write_end(&p->position_seqlock);
 	
 	spinlock_release(&p->sample_lock);
 }
 
+void
+_audio_player_read_position(Audio_Player *p, u64 *frame_index, u64 *number_of_frames, int *sample_rate) {
+	u32 sequence;
+	do {
+		sequence = seqlock_read_begin(&p->position_seqlock);
+		*frame_index      = p->frame_index;
+		*number_of_frames = p->source.number_of_frames;
+		*sample_rate      = p->source.format.sample_rate;
+	} while (seqlock_read_retry(&p->position_seqlock, sequence));
+	
+	assert(*frame_index <= *number_of_frames);
+}
+
 bool 
 audio_player_at_source_end(Audio_Player *p) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
-    bool finished = p->frame_index == p->source.number_of_frames;
+	u64 frame_index, number_of_frames;
+	int sample_rate;
+	_audio_player_read_position(p, &frame_index, &number_of_frames, &sample_rate);
 	
-	spinlock_release(&p->sample_lock);
-
-    return finished;
+    return frame_index == number_of_frames;
 }
 
 void // 0 - 1
@@ -1292,34 +1313,32 @@ audio_player_set_progression_factor(Audio_Player *p, float64 factor) {
 	spinlock_acquire_or_wait(&p->sample_lock);
 	assert(p->frame_index <= p->source.number_of_frames);
 	
+	seqlock_write_begin(&p->position_seqlock);
 	p->frame_index = (u64)round((float64)p->source.number_of_frames*factor);
+	seqlock_write_end(&p->position_seqlock);
 	
 	spinlock_release(&p->sample_lock);
 }
 float64 // seconds
 audio_player_get_time_stamp(Audio_Player *p) {
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
+	u64 frame_index, number_of_frames;
+	int sample_rate;
+	_audio_player_read_position(p, &frame_index, &number_of_frames, &sample_rate);
 	
 	float64 full_duration 
-		= (float64)p->source.number_of_frames/(float64)p->source.format.sample_rate;
-	float64 progression = (float64)p->frame_index / (float64)p->source.number_of_frames;
-	
-	spinlock_release(&p->sample_lock);
+		= (float64)number_of_frames/(float64)sample_rate;
+	float64 progression = (float64)frame_index / (float64)number_of_frames;
 	
 	return progression*full_duration;
 }
 float64
 audio_player_get_current_progression_factor(Audio_Player *p) {
 	if (!p->has_source) return 0;
-	spinlock_acquire_or_wait(&p->sample_lock);
-	assert(p->frame_index <= p->source.number_of_frames);
-	
-	float64 progression = (float64)p->frame_index / (float64)p->source.number_of_frames;
-	
-	spinlock_release(&p->sample_lock);
+	u64 frame_index, number_of_frames;
+	int sample_rate;
+	_audio_player_read_position(p, &frame_index, &number_of_frames, &sample_rate);
 	
-	return progression;
+	return (float64)frame_index / (float64)number_of_frames;
 }
 void 
 audio_player_set_source(Audio_Player *p, Audio_Source src) {
@@ -1327,12 +1346,14 @@ audio_player_set_source(Audio_Player *p, Audio_Source src) {
 	float64 last_progression = audio_player_get_current_progression_factor(p);
 	
 	spinlock_acquire_or_wait(&p->sample_lock);
+	seqlock_write_begin(&p->position_seqlock);
 
 	p->source = src;
 	p->has_source = true;
 	
 	p->frame_index = 0;
 	
+	seqlock_write_end(&p->position_seqlock);
 	spinlock_release(&p->sample_lock);
 }
 void 
@@ -1340,9 +1361,11 @@ audio_player_clear_source(Audio_Player *p) {
 	spinlock_acquire_or_wait(&p->sample_lock);
 	assert(p->frame_index <= p->source.number_of_frames);
 	
+	seqlock_write_begin(&p->position_seqlock);
 	p->has_source = false;
 	p->state = AUDIO_PLAYER_STATE_PAUSED;
 	p->source = ZERO(Audio_Source);
+	seqlock_write_end(&p->position_seqlock);
 	
 	spinlock_release(&p->sample_lock);
 }
@@ -1351,7 +1374,9 @@ audio_player_set_looping(Audio_Player *p, bool looping) {
 	spinlock_acquire_or_wait(&p->sample_lock);
 	
 	if (p->has_source && looping && !p->looping && p->frame_index == p->source.number_of_frames) {
+		seqlock_write_begin(&p->position_seqlock);
 		p->frame_index = 0;
+		seqlock_write_end(&p->position_seqlock);
 	}
 	
 	p->looping = looping;
@@ -1359,6 +1384,17 @@ audio_player_set_looping(Audio_Player *p, bool looping) {
 	spinlock_release(&p->sample_lock);
 }
 
+void
+audio_player_set_config(Audio_Player *p, Audio_Playback_Config config) {
+	seqlock_write_copy(&p->config_seqlock, &p->config, &config, sizeof(Audio_Playback_Config));
+}
+Audio_Playback_Config
+audio_player_get_config(Audio_Player *p) {
+	Audio_Playback_Config config;
+	seqlock_read_copy(&p->config_seqlock, &config, &p->config, sizeof(Audio_Playback_Config));
+	return config;
+}
+
 // #Global
 ogb_instance Hash_Table just_audio_clips;
 ogb_instance bool just_audio_clips_initted;
@@ -1382,8 +1418,8 @@ void
 play_one_audio_clip_source_with_config(Audio_Source source, Audio_Playback_Config config) {
 	Audio_Player *p = audio_player_get_one();
 	audio_player_set_source(p, source);
+	audio_player_set_config(p, config);
 	audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
-	p->config = config;
 	p->release_when_done = true;
 }
 
@@ -1681,6 +1717,8 @@ do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format,
 	u64 *started_this_frame;
 	growing_array_init((void**)&started_this_frame, sizeof(u64), get_temporary_allocator());
 	
+	u64 active_player_count = 0;
+	
 	while (block) {
 		
 		for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
@@ -1703,8 +1741,11 @@ do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format,
 				if (p->fade_frames == 0) continue;
 			}
 			
+			// Snapshot, so a config being written from another thread can't tear mid-sample
+			Audio_Playback_Config config = audio_player_get_config(p);
+			
 			// #Incomplete Reverse playback ?
-			if (p->config.playback_speed <= 0.0) continue;
+			if (config.playback_speed <= 0.0) continue;
 			
 			if (p->frame_index >= p->source.number_of_frames && !p->looping) continue;
 			
@@ -1715,7 +1756,7 @@ do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format,
 			mutex_acquire_or_wait(&src.mutex_for_destroy);
 
 			Audio_Format sample_format = src.format;
-			sample_format.sample_rate = sample_format.sample_rate*p->config.playback_speed;
+			sample_format.sample_rate = sample_format.sample_rate*config.playback_speed;
 			
 			bool need_convert = !bytes_match(
 				&out_format, 
@@ -1787,20 +1828,27 @@ do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format,
 					// playing at the exact same time. I'm not sure how else to deal with phase cancellation
 					// in looping players.
 					// #Incomplete player->is_muted_for_phase_cancellation ? 
+					seqlock_write_begin(&p->position_seqlock);
 					p->frame_index = src.number_of_frames;
+					seqlock_write_end(&p->position_seqlock);
+					spinlock_release(&p->sample_lock);
+					mutex_release(&src.mutex_for_destroy);
 					continue;
 				}
 				growing_array_add((void**)&started_this_frame, &src.uid);
 			}
 	
 			u64 last_frame_index = p->frame_index;
-			p->frame_index = audio_source_sample_next_frames(
+			u64 next_frame_index = audio_source_sample_next_frames(
 				&src,
 				p->frame_index, 
 				number_of_sample_frames,
 				target_buffer,
 				p->looping
 			);
+			seqlock_write_begin(&p->position_seqlock);
+			p->frame_index = next_frame_index;
+			seqlock_write_end(&p->position_seqlock);
 			if (p->frame_index > last_frame_index && (p->looping || p->frame_index != src.number_of_frames)) {
 				assert(p->frame_index - last_frame_index == number_of_sample_frames);
 			}
@@ -1872,18 +1920,21 @@ do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format,
 				assert(converted == number_of_output_frames);
 			}
 
-			if (p->config.enable_spacialization) {
-				apply_audio_spacialization(mix_buffer, out_format, number_of_output_frames, p->config.position_ndc);
+			if (config.enable_spacialization) {
+				apply_audio_spacialization(mix_buffer, out_format, number_of_output_frames, config.position_ndc);
 			}
-			if (p->config.volume != 0.0) {
-				apply_audio_volume(mix_buffer, out_format, number_of_output_frames, p->config.volume);
+			if (config.volume != 0.0) {
+				apply_audio_volume(mix_buffer, out_format, number_of_output_frames, config.volume);
 			}
 			
 			mix_frames(output, mix_buffer, number_of_output_frames, out_format);
+			active_player_count += 1;
 			
 			mutex_release(&src.mutex_for_destroy);
 		}
 		
 		block = block->next;
 	}
+	
+	tm_gauge("Audio players active", active_player_count);
 }
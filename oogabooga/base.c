@@ -173,6 +173,41 @@ Context get_context() {
 
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
+///
+// Crash hooks
+// Procedures which are called by crash(), for example to flush buffered logs or output
+// so we don't lose the most interesting part when something goes wrong.
+#define MAX_CRASH_HOOKS 16
+typedef void(*Crash_Hook_Proc)();
+
+ogb_instance void
+add_crash_hook(Crash_Hook_Proc proc);
+
+// run_crash_hooks() is declared in cpu.c since crash() calls it
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Crash_Hook_Proc crash_hooks[MAX_CRASH_HOOKS];
+u64 crash_hook_count = 0;
+volatile bool is_running_crash_hooks = false;
+
+void 
+add_crash_hook(Crash_Hook_Proc proc) {
+	assert(crash_hook_count < MAX_CRASH_HOOKS, "Too many crash hooks");
+	crash_hooks[crash_hook_count] = proc;
+	crash_hook_count += 1;
+}
+void 
+run_crash_hooks() {
+	// If a hook crashes we just go down
+	if (is_running_crash_hooks) return;
+	is_running_crash_hooks = true;
+	
+	for (u64 i = 0; i < crash_hook_count; i++) {
+		crash_hooks[i]();
+	}
+}
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
 u64 
 get_next_power_of_two(u64 x) {
     if (x == 0) {
@@ -0,0 +1,446 @@
+///
+///
+// Benchmarking
+///
+// A benchmark is registered with BENCH and runs its code b->iterations times:
+//
+//	BENCH(heap_alloc_64) {
+//		for (u64 i = 0; i < b->iterations; i++) {
+//			void *p = alloc(get_heap_allocator(), 64);
+//			dealloc(get_heap_allocator(), p);
+//		}
+//	}
+//
+// The runner warms each benchmark up and grows b->iterations until one sample takes at least
+// BENCH_MIN_SAMPLE_SECONDS, then takes up to BENCH_MAX_SAMPLES samples (within
+// BENCH_MAX_SECONDS) and reports the median, median absolute deviation (MAD), p99 and min
+// time per iteration. Medians and MAD aren't thrown off by the odd context switch the way
+// an average and standard deviation are.
+//
+// Call bench_reset_timer(b) after setup that shouldn't be measured, and pass results
+// that would otherwise be optimized away to bench_keep().
+//
+// This is only compiled with RUN_BENCHMARKS or RUN_PERF_TESTS, see oogabooga.c.
+//
+// See build_bench.c and oogabooga/benchmarks.c for the ooga_bench program, which is run like:
+//
+//	ooga_bench.exe [--filter <substring>] [--json <path>] [--baseline <path>] [--tolerance <percent>]
+//
+// --json writes the results so they can be passed as --baseline to a later run. With a
+// baseline, every benchmark is compared against it and the program exits with 1 if any of
+// them got slower by more than the tolerance (default 5%) and by more than 3 MADs.
+
+#ifndef BENCH_MIN_SAMPLE_SECONDS
+	#define BENCH_MIN_SAMPLE_SECONDS 0.002
+#endif
+#ifndef BENCH_MAX_SECONDS
+	#define BENCH_MAX_SECONDS 0.5
+#endif
+#define BENCH_WARMUP_SECONDS 0.05
+#define BENCH_MIN_SAMPLES 5
+#define BENCH_MAX_SAMPLES 64
+#define BENCH_MAX_BENCHMARKS 512
+#define BENCH_DEFAULT_TOLERANCE 0.05
+#define BENCH_NOISE_MADS 3.0 // A change smaller than this many MADs is just noise
+
+typedef struct Bench {
+	u64 iterations; // Run the measured code this many times
+
+	// Set by the runner, reset by bench_reset_timer
+	float64 start_seconds;
+	u64 start_cycles;
+} Bench;
+
+typedef void(*Bench_Proc)(Bench *b);
+
+typedef struct Bench_Entry {
+	string name;
+	Bench_Proc proc;
+} Bench_Entry;
+
+// All times are per iteration
+typedef struct Bench_Result {
+	string name;
+	u64 iterations;   // Per sample
+	u64 sample_count;
+	float64 median_ns;
+	float64 mad_ns;
+	float64 p99_ns;
+	float64 min_ns;
+	float64 median_cycles;
+} Bench_Result;
+
+// Registration happens before main (so before oogabooga is initialized), which is why this
+// is a plain array and not a growing array.
+#if COMPILER_MSVC
+	#pragma section(".CRT$XCU", read)
+	#define BENCH(name) \
+		void bench_##name(Bench *b); \
+		void _bench_register_##name() { bench_register(STR(#name), bench_##name); } \
+		__declspec(allocate(".CRT$XCU")) void (*_bench_register_ptr_##name)() = _bench_register_##name; \
+		void bench_##name(Bench *b)
+#else
+	#define BENCH(name) \
+		void bench_##name(Bench *b); \
+		__attribute__((constructor)) void _bench_register_##name() { bench_register(STR(#name), bench_##name); } \
+		void bench_##name(Bench *b)
+#endif
+
+#define bench_keep(x) (bench_sink += (u64)(x))
+
+// #Global
+ogb_instance Bench_Entry bench_registry[BENCH_MAX_BENCHMARKS];
+ogb_instance u64 bench_registry_count;
+ogb_instance volatile u64 bench_sink;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Bench_Entry bench_registry[BENCH_MAX_BENCHMARKS];
+u64 bench_registry_count = 0;
+volatile u64 bench_sink = 0;
+#endif
+
+ogb_instance void
+bench_register(string name, Bench_Proc proc);
+
+ogb_instance void
+bench_reset_timer(Bench *b);
+
+ogb_instance Bench_Result
+bench_run(string name, Bench_Proc proc);
+
+// Slower than the baseline by more than the tolerance and by more than BENCH_NOISE_MADS MADs
+ogb_instance bool
+bench_is_regression(Bench_Result result, Bench_Result *baseline, float64 tolerance);
+
+// Prints one line for the result, and the change from the baseline if there is one.
+// Returns false if the result is a regression.
+ogb_instance bool
+bench_report(Bench_Result result, Bench_Result *baseline, float64 tolerance);
+
+ogb_instance bool
+bench_write_json(Bench_Result *results, u64 count, string path);
+
+// Results are put in a growing array, which the caller deinits
+ogb_instance bool
+bench_read_json(string path, Bench_Result **results, Allocator allocator);
+
+ogb_instance Bench_Result*
+bench_find_result(Bench_Result *results, u64 count, string name);
+
+// Runs the registered benchmarks with the arguments described at the top of this file
+ogb_instance int
+bench_main(int argc, char **argv);
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+void bench_register(string name, Bench_Proc proc) {
+	// Can't assert, this runs before main
+	if (bench_registry_count >= BENCH_MAX_BENCHMARKS) return;
+	bench_registry[bench_registry_count].name = name;
+	bench_registry[bench_registry_count].proc = proc;
+	bench_registry_count += 1;
+}
+
+void bench_reset_timer(Bench *b) {
+	b->start_seconds = os_get_elapsed_seconds();
+	b->start_cycles = rdtsc();
+}
+
+int _bench_compare_f64(const void *a, const void *b) {
+	float64 x = *(const float64*)a;
+	float64 y = *(const float64*)b;
+	return (x > y) - (x < y);
+}
+float64 _bench_median(float64 *sorted, u64 count) {
+	if (count % 2) return sorted[count/2];
+	return (sorted[count/2-1] + sorted[count/2])*0.5;
+}
+
+float64 _bench_sample(Bench *b, Bench_Proc proc, u64 *cycles) {
+	bench_reset_timer(b);
+	proc(b);
+	u64 end_cycles = rdtsc();
+	float64 end_seconds = os_get_elapsed_seconds();
+
+	if (cycles) *cycles = end_cycles - b->start_cycles;
+	return end_seconds - b->start_seconds;
+}
+
+Bench_Result bench_run(string name, Bench_Proc proc) {
+	Bench b = ZERO(Bench);
+	b.iterations = 1;
+
+	// Warm up caches & branch predictors while finding how many iterations we need for one
+	// sample to be long enough to measure
+	float64 warmup_start = os_get_elapsed_seconds();
+	while (true) {
+		float64 seconds = _bench_sample(&b, proc, 0);
+
+		if (seconds >= BENCH_MIN_SAMPLE_SECONDS) {
+			if (os_get_elapsed_seconds()-warmup_start >= BENCH_WARMUP_SECONDS) break;
+			continue;
+		}
+
+		u64 next = b.iterations*10;
+		if (seconds > 0) {
+			next = (u64)((float64)b.iterations*(BENCH_MIN_SAMPLE_SECONDS*1.2/seconds)) + 1;
+			next = min(next, b.iterations*10);
+		}
+		b.iterations = max(next, b.iterations+1);
+	}
+
+	float64 ns[BENCH_MAX_SAMPLES];
+	float64 cycles[BENCH_MAX_SAMPLES];
+	u64 sample_count = 0;
+
+	float64 start = os_get_elapsed_seconds();
+	while (sample_count < BENCH_MAX_SAMPLES) {
+		if (sample_count >= BENCH_MIN_SAMPLES && os_get_elapsed_seconds()-start >= BENCH_MAX_SECONDS) break;
+
+		u64 sample_cycles;
+		float64 seconds = _bench_sample(&b, proc, &sample_cycles);
+
+		ns[sample_count] = seconds*1000000000.0/(float64)b.iterations;
+		cycles[sample_count] = (float64)sample_cycles/(float64)b.iterations;
+		sample_count += 1;
+	}
+
+	sort(ns, sample_count, sizeof(float64), _bench_compare_f64);
+	sort(cycles, sample_count, sizeof(float64), _bench_compare_f64);
+
+	Bench_Result result = ZERO(Bench_Result);
+	result.name = name;
+	result.iterations = b.iterations;
+	result.sample_count = sample_count;
+	result.median_ns = _bench_median(ns, sample_count);
+	result.min_ns = ns[0];
+	result.p99_ns = ns[min((u64)((float64)(sample_count-1)*0.99 + 0.5), sample_count-1)];
+	result.median_cycles = _bench_median(cycles, sample_count);
+
+	float64 deviations[BENCH_MAX_SAMPLES];
+	for (u64 i = 0; i < sample_count; i++) {
+		deviations[i] = ns[i] > result.median_ns ? ns[i]-result.median_ns : result.median_ns-ns[i];
+	}
+	sort(deviations, sample_count, sizeof(float64), _bench_compare_f64);
+	result.mad_ns = _bench_median(deviations, sample_count);
+
+	return result;
+}
+
+string _bench_format_time(float64 ns) {
+	if (ns >= 1000000.0) return tprint("%.2f ms", ns/1000000.0);
+	if (ns >= 1000.0)    return tprint("%.2f us", ns/1000.0);
+	return tprint("%.2f ns", ns);
+}
+string _bench_pad(string s, u64 width) {
+	if (s.count >= width) return s;
+	string result = talloc_string(width);
+	memcpy(result.data, s.data, s.count);
+	memset(result.data+s.count, ' ', width-s.count);
+	return result;
+}
+
+bool bench_is_regression(Bench_Result result, Bench_Result *baseline, float64 tolerance) {
+	if (!baseline || baseline->median_ns <= 0) return false;
+	float64 delta = result.median_ns - baseline->median_ns;
+	float64 noise = BENCH_NOISE_MADS*max(result.mad_ns, baseline->mad_ns);
+	return delta/baseline->median_ns > tolerance && delta > noise;
+}
+bool bench_report(Bench_Result result, Bench_Result *baseline, float64 tolerance) {
+	string line = tprint("%s%s%s%s%s",
+		_bench_pad(result.name, 40),
+		_bench_pad(_bench_format_time(result.median_ns), 14),
+		_bench_pad(tprint("+-%s", _bench_format_time(result.mad_ns)), 16),
+		_bench_pad(tprint("p99 %s", _bench_format_time(result.p99_ns)), 18),
+		_bench_pad(tprint("%.1f cycles", result.median_cycles), 18)
+	);
+
+	bool regressed = false;
+	if (baseline && baseline->median_ns > 0) {
+		float64 delta = result.median_ns - baseline->median_ns;
+		float64 relative = delta/baseline->median_ns;
+		float64 noise = BENCH_NOISE_MADS*max(result.mad_ns, baseline->mad_ns);
+
+		regressed = bench_is_regression(result, baseline, tolerance);
+		bool improved = -relative > tolerance && -delta > noise;
+
+		line = tprint("%s%+.1f%% %cs", line, relative*100.0, regressed ? "REGRESSION" : (improved ? "improved" : ""));
+	}
+
+	print("%s\n", line);
+	return !regressed;
+}
+
+bool bench_write_json(Bench_Result *results, u64 count, string path) {
+	String_Builder b;
+	string_builder_init_reserve(&b, KB(4), get_heap_allocator());
+
+	string_builder_append(&b, STR("[\n"));
+	for (u64 i = 0; i < count; i++) {
+		Bench_Result r = results[i];
+		string_builder_print(&b, STR("{\"name\":\"%s\",\"iterations\":%llu,\"samples\":%llu,\"median_ns\":%.4f,\"mad_ns\":%.4f,\"p99_ns\":%.4f,\"min_ns\":%.4f,\"median_cycles\":%.4f}%cs\n"),
+			r.name, r.iterations, r.sample_count, r.median_ns, r.mad_ns, r.p99_ns, r.min_ns, r.median_cycles, i+1 < count ? "," : "");
+	}
+	string_builder_append(&b, STR("]\n"));
+
+	bool ok = os_write_entire_file_s(path, string_builder_get_string(b));
+	string_builder_deinit(&b);
+	return ok;
+}
+
+float64 _bench_parse_number(string s) {
+	u64 i = 0;
+	float64 sign = 1;
+	if (i < s.count && s.data[i] == '-') { sign = -1; i += 1; }
+
+	float64 value = 0;
+	while (i < s.count && s.data[i] >= '0' && s.data[i] <= '9') {
+		value = value*10.0 + (float64)(s.data[i]-'0');
+		i += 1;
+	}
+	if (i < s.count && s.data[i] == '.') {
+		i += 1;
+		float64 scale = 0.1;
+		while (i < s.count && s.data[i] >= '0' && s.data[i] <= '9') {
+			value += (float64)(s.data[i]-'0')*scale;
+			scale *= 0.1;
+			i += 1;
+		}
+	}
+	if (i < s.count && (s.data[i] == 'e' || s.data[i] == 'E')) {
+		i += 1;
+		s64 exponent_sign = 1;
+		if (i < s.count && (s.data[i] == '-' || s.data[i] == '+')) { exponent_sign = s.data[i] == '-' ? -1 : 1; i += 1; }
+		s64 exponent = 0;
+		while (i < s.count && s.data[i] >= '0' && s.data[i] <= '9') {
+			exponent = exponent*10 + (s.data[i]-'0');
+			i += 1;
+		}
+		value *= pow(10.0, (float64)(exponent*exponent_sign));
+	}
+	return value*sign;
+}
+// Finds "key": in the object and returns what comes after it
+string _bench_json_value(string object, string key) {
+	string pattern = tprint("\"%s\":", key);
+	s64 index = object.count >= pattern.count ? string_find_from_left(object, pattern) : -1;
+	if (index < 0) return ZERO(string);
+
+	string value = object;
+	value.data += index+pattern.count;
+	value.count -= index+pattern.count;
+	return string_trim_left(value);
+}
+
+// Only reads what bench_write_json writes, one object per line
+bool bench_read_json(string path, Bench_Result **results, Allocator allocator) {
+	string data;
+	if (!os_read_entire_file_s(path, &data, allocator)) return false;
+
+	growing_array_init((void**)results, sizeof(Bench_Result), allocator);
+
+	while (data.count > 0) {
+		u64 line_end = 0;
+		while (line_end < data.count && data.data[line_end] != '\n') line_end += 1;
+		string line = (string){line_end, data.data};
+		data.data += min(line_end+1, data.count);
+		data.count -= min(line_end+1, data.count);
+
+		string name = _bench_json_value(line, STR("name"));
+		if (name.count < 2 || name.data[0] != '"') continue;
+		name.data += 1;
+		name.count -= 1;
+		u64 name_end = 0;
+		while (name_end < name.count && name.data[name_end] != '"') name_end += 1;
+		name.count = name_end;
+
+		Bench_Result r = ZERO(Bench_Result);
+		// Points into the file data, which we never free
+		r.name = name;
+		r.iterations    = (u64)_bench_parse_number(_bench_json_value(line, STR("iterations")));
+		r.sample_count  = (u64)_bench_parse_number(_bench_json_value(line, STR("samples")));
+		r.median_ns     = _bench_parse_number(_bench_json_value(line, STR("median_ns")));
+		r.mad_ns        = _bench_parse_number(_bench_json_value(line, STR("mad_ns")));
+		r.p99_ns        = _bench_parse_number(_bench_json_value(line, STR("p99_ns")));
+		r.min_ns        = _bench_parse_number(_bench_json_value(line, STR("min_ns")));
+		r.median_cycles = _bench_parse_number(_bench_json_value(line, STR("median_cycles")));
+		growing_array_add((void**)results, &r);
+	}
+
+	return true;
+}
+
+Bench_Result *bench_find_result(Bench_Result *results, u64 count, string name) {
+	for (u64 i = 0; i < count; i++) {
+		if (strings_match(results[i].name, name)) return &results[i];
+	}
+	return 0;
+}
+
+int bench_main(int argc, char **argv) {
+	string filter = ZERO(string);
+	string json_path = ZERO(string);
+	string baseline_path = ZERO(string);
+	float64 tolerance = BENCH_DEFAULT_TOLERANCE;
+
+	for (int i = 1; i < argc; i++) {
+		string arg = STR(argv[i]);
+		bool has_value = i+1 < argc;
+		if (strings_match(arg, STR("--filter")) && has_value) {
+			filter = STR(argv[++i]);
+		} else if (strings_match(arg, STR("--json")) && has_value) {
+			json_path = STR(argv[++i]);
+		} else if (strings_match(arg, STR("--baseline")) && has_value) {
+			baseline_path = STR(argv[++i]);
+		} else if (strings_match(arg, STR("--tolerance")) && has_value) {
+			tolerance = _bench_parse_number(STR(argv[++i]))/100.0;
+		} else {
+			log_error("Unknown argument '%s'. Usage: [--filter <substring>] [--json <path>] [--baseline <path>] [--tolerance <percent>]", arg);
+			return 1;
+		}
+	}
+
+	Bench_Result *baseline = 0;
+	u64 baseline_count = 0;
+	if (baseline_path.count) {
+		if (!bench_read_json(baseline_path, &baseline, get_heap_allocator())) {
+			log_error("Could not read baseline '%s'", baseline_path);
+			return 1;
+		}
+		baseline_count = growing_array_get_valid_count(baseline);
+	}
+
+	Bench_Result *results;
+	growing_array_init((void**)&results, sizeof(Bench_Result), get_heap_allocator());
+
+	u64 regression_count = 0;
+	for (u64 i = 0; i < bench_registry_count; i++) {
+		Bench_Entry entry = bench_registry[i];
+		if (filter.count && (entry.name.count < filter.count || string_find_from_left(entry.name, filter) < 0)) continue;
+
+		Bench_Result result = bench_run(entry.name, entry.proc);
+		growing_array_add((void**)&results, &result);
+
+		Bench_Result *base = baseline ? bench_find_result(baseline, baseline_count, entry.name) : 0;
+		if (!bench_report(result, base, tolerance)) regression_count += 1;
+
+		reset_temporary_storage();
+	}
+
+	u64 result_count = growing_array_get_valid_count(results);
+	if (json_path.count) {
+		if (bench_write_json(results, result_count, json_path)) print("Wrote results to %s\n", json_path);
+		else log_error("Could not write results to '%s'", json_path);
+	}
+
+	growing_array_deinit((void**)&results);
+	if (baseline) growing_array_deinit((void**)&baseline);
+
+	if (regression_count) {
+		print("%llu benchmark(s) regressed by more than %.1f%%\n", regression_count, tolerance*100.0);
+		return 1;
+	}
+	return 0;
+}
+
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
@@ -0,0 +1,316 @@
+
+///
+// Benchmarks for the ooga_bench program (build_bench.c), see bench.c.
+// Included by oogabooga.c with RUN_BENCHMARKS or RUN_PERF_TESTS.
+// Some of these are also run as perf tests with RUN_PERF_TESTS, see oogabooga_run_perf_tests in tests.c
+
+#define BENCH_SORT_COUNT 10000
+
+// Benchmarks that talloc reset temporary storage in chunks of this many iterations, so they
+// measure the bump allocation and not talloc wrapping around (which also warns every sample).
+// bytes_per_iteration is the most one iteration tallocs.
+u64 bench_iterations_per_temporary_reset(u64 bytes_per_iteration) {
+	return max(temporary_storage_size/bytes_per_iteration, 2) - 1;
+}
+
+///
+// Heap & temporary storage
+
+BENCH(heap_alloc_dealloc_64) {
+	for (u64 i = 0; i < b->iterations; i++) {
+		void *p = alloc(get_heap_allocator(), 64);
+		bench_keep(p);
+		dealloc(get_heap_allocator(), p);
+	}
+}
+BENCH(heap_alloc_dealloc_mixed_sizes) {
+	void *pointers[64];
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u64 j = 0; j < 64; j++) pointers[j] = alloc(get_heap_allocator(), 16 + (j*j*37)%4096);
+		// Free in a different order than allocated so the free list gets some fragmentation
+		for (u64 j = 0; j < 64; j += 2) dealloc(get_heap_allocator(), pointers[j]);
+		for (u64 j = 1; j < 64; j += 2) dealloc(get_heap_allocator(), pointers[j]);
+	}
+}
+BENCH(temp_alloc_64) {
+	u64 chunk = bench_iterations_per_temporary_reset(64);
+	for (u64 i = 0; i < b->iterations; i += chunk) {
+		u64 end = min(i+chunk, b->iterations);
+		for (u64 j = i; j < end; j++) {
+			bench_keep(talloc(64));
+		}
+		reset_temporary_storage();
+	}
+}
+BENCH(arena_push_64) {
+	Arena arena = make_arena(MB(1));
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		if ((u8*)arena.next + 64 > (u8*)arena.start + arena.size) arena.next = arena.start;
+		bench_keep(arena_push(&arena, 64));
+	}
+	dealloc(get_heap_allocator(), arena.start);
+}
+
+///
+// Hash table & growing array
+
+BENCH(hash_table_set_1000_u64) {
+	Hash_Table table = make_hash_table_reserve(u64, u64, 1000, get_heap_allocator());
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		hash_table_reset(&table);
+		for (u64 j = 0; j < 1000; j++) {
+			u64 key = j*0x9E3779B97F4A7C15ULL;
+			hash_table_set(&table, key, j);
+		}
+	}
+	hash_table_destroy(&table);
+}
+BENCH(hash_table_find_u64) {
+	Hash_Table table = make_hash_table_reserve(u64, u64, 1000, get_heap_allocator());
+	for (u64 j = 0; j < 1000; j++) {
+		u64 key = j*0x9E3779B97F4A7C15ULL;
+		hash_table_set(&table, key, j);
+	}
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		u64 key = (i%1000)*0x9E3779B97F4A7C15ULL;
+		bench_keep(hash_table_find(&table, key));
+	}
+	hash_table_destroy(&table);
+}
+BENCH(hash_table_find_string) {
+	Hash_Table table = make_hash_table_reserve(string, u64, 256, get_heap_allocator());
+	string keys[256];
+	for (u64 j = 0; j < 256; j++) {
+		keys[j] = sprint(get_heap_allocator(), STR("some_fairly_typical_key_%llu"), j);
+		hash_table_set(&table, keys[j], j);
+	}
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		bench_keep(hash_table_find(&table, keys[i%256]));
+	}
+	for (u64 j = 0; j < 256; j++) dealloc_string(get_heap_allocator(), keys[j]);
+	hash_table_destroy(&table);
+}
+BENCH(growing_array_add_1000_u64) {
+	u64 *array;
+	growing_array_init((void**)&array, sizeof(u64), get_heap_allocator());
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		growing_array_clear((void**)&array);
+		for (u64 j = 0; j < 1000; j++) growing_array_add((void**)&array, &j);
+	}
+	growing_array_deinit((void**)&array);
+}
+
+///
+// Strings & formatting
+
+BENCH(tprint_ints_and_strings) {
+	// Null terminated copy of the format and the result
+	u64 chunk = bench_iterations_per_temporary_reset(128);
+	for (u64 i = 0; i < b->iterations; i += chunk) {
+		u64 end = min(i+chunk, b->iterations);
+		for (u64 j = i; j < end; j++) {
+			string s = tprint("%s number %d of %llu", STR("Benchmark"), (int)j, b->iterations);
+			bench_keep(s.count);
+		}
+		reset_temporary_storage();
+	}
+}
+BENCH(tprint_floats) {
+	u64 chunk = bench_iterations_per_temporary_reset(128);
+	for (u64 i = 0; i < b->iterations; i += chunk) {
+		u64 end = min(i+chunk, b->iterations);
+		for (u64 j = i; j < end; j++) {
+			string s = tprint("%.3f, %.3f", (float64)j*0.5, (float64)j*0.25);
+			bench_keep(s.count);
+		}
+		reset_temporary_storage();
+	}
+}
+BENCH(string_builder_append_1000) {
+	String_Builder builder;
+	string_builder_init_reserve(&builder, KB(16), get_heap_allocator());
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		builder.count = 0;
+		for (u64 j = 0; j < 1000; j++) string_builder_append(&builder, STR("ooga booga "));
+	}
+	string_builder_deinit(&builder);
+}
+BENCH(strings_match_64) {
+	string a = STR("This is a string that is exactly sixty four bytes long, padded..");
+	string c = string_copy(a, get_heap_allocator());
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		bench_keep(strings_match(a, c));
+	}
+	dealloc_string(get_heap_allocator(), c);
+}
+
+///
+// Sorts. Each iteration copies the unsorted input and sorts it, so the copy is included.
+
+typedef struct Bench_Sort_Item {
+	s32 key;
+	u32 payload[3];
+} Bench_Sort_Item;
+
+BENCH(sort_u32_10000) {
+	u32 *input = (u32*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*sizeof(u32));
+	u32 *work  = (u32*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*sizeof(u32));
+	seed_for_random = 69;
+	for (u64 j = 0; j < BENCH_SORT_COUNT; j++) input[j] = (u32)get_random();
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		memcpy(work, input, BENCH_SORT_COUNT*sizeof(u32));
+		sort_u32(work, BENCH_SORT_COUNT);
+	}
+	dealloc(get_heap_allocator(), input);
+	dealloc(get_heap_allocator(), work);
+}
+BENCH(sort_by_key_offset_10000) {
+	Bench_Sort_Item *input = (Bench_Sort_Item*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*sizeof(Bench_Sort_Item));
+	Bench_Sort_Item *work  = (Bench_Sort_Item*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*sizeof(Bench_Sort_Item));
+	seed_for_random = 69;
+	for (u64 j = 0; j < BENCH_SORT_COUNT; j++) input[j].key = (s32)get_random_int_in_range(-100000, 100000);
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		memcpy(work, input, BENCH_SORT_COUNT*sizeof(Bench_Sort_Item));
+		sort_by_key_offset(work, BENCH_SORT_COUNT, sizeof(Bench_Sort_Item), offsetof(Bench_Sort_Item, key));
+	}
+	dealloc(get_heap_allocator(), input);
+	dealloc(get_heap_allocator(), work);
+}
+BENCH(radix_sort_10000) {
+	Bench_Sort_Item *input = (Bench_Sort_Item*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*sizeof(Bench_Sort_Item));
+	Bench_Sort_Item *work  = (Bench_Sort_Item*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*sizeof(Bench_Sort_Item));
+	Bench_Sort_Item *help  = (Bench_Sort_Item*)alloc(get_heap_allocator(), BENCH_SORT_COUNT*sizeof(Bench_Sort_Item));
+	seed_for_random = 69;
+	// radix_sort reads a u64 at the key offset, so a negative s32 isn't sign extended. Keys
+	// in 0..100000 fit the 18 bits as they are and don't depend on the bias wrapping around.
+	for (u64 j = 0; j < BENCH_SORT_COUNT; j++) input[j].key = (s32)get_random_int_in_range(0, 100000);
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		memcpy(work, input, BENCH_SORT_COUNT*sizeof(Bench_Sort_Item));
+		radix_sort(work, help, BENCH_SORT_COUNT, sizeof(Bench_Sort_Item), offsetof(Bench_Sort_Item, key), 18);
+	}
+	dealloc(get_heap_allocator(), input);
+	dealloc(get_heap_allocator(), work);
+	dealloc(get_heap_allocator(), help);
+}
+
+///
+// SIMD & linmath
+
+BENCH(simd_mul_float32_128_x1024) {
+	float32 a[1024], c[1024], result[1024];
+	for (u64 j = 0; j < 1024; j++) {
+		a[j] = (float32)j;
+		c[j] = 1.0f/(float32)(j+1);
+	}
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u64 j = 0; j < 1024; j += 4) simd_mul_float32_128(a+j, c+j, result+j);
+		bench_keep(result[i%1024]);
+	}
+}
+BENCH(m4_mul) {
+	Matrix4 m = m4_make_rotation_z(0.1);
+	Matrix4 result = m4_identity();
+	for (u64 i = 0; i < b->iterations; i++) {
+		result = m4_mul(result, m);
+	}
+	bench_keep(result.m[0][0]);
+}
+BENCH(m4_inverse) {
+	Matrix4 m = m4_translate(m4_make_rotation_z(0.3), v3(1, 2, 3));
+	for (u64 i = 0; i < b->iterations; i++) {
+		m = m4_inverse(m);
+	}
+	bench_keep(m.m[0][0]);
+}
+BENCH(m4_transform_v4) {
+	Matrix4 m = m4_translate(m4_make_rotation_z(0.3), v3(1, 2, 3));
+	Vector4 v = v4(1, 2, 3, 1);
+	for (u64 i = 0; i < b->iterations; i++) {
+		v = m4_transform(m, v);
+	}
+	bench_keep(v.x);
+}
+
+///
+// Audio
+
+#ifndef OOGABOOGA_HEADLESS
+BENCH(mix_frames_f32_stereo_1024) {
+	Audio_Format format = ZERO(Audio_Format);
+	format.bit_width = AUDIO_BITS_32;
+	format.channels = 2;
+	format.sample_rate = 48000;
+
+	float32 *dst = (float32*)alloc(get_heap_allocator(), 1024*2*sizeof(float32));
+	float32 *src = (float32*)alloc(get_heap_allocator(), 1024*2*sizeof(float32));
+	for (u64 j = 0; j < 1024*2; j++) src[j] = sinf((float32)j*0.01f)*0.1f;
+	memset(dst, 0, 1024*2*sizeof(float32));
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		mix_frames(dst, src, 1024, format);
+	}
+	bench_keep(dst[0]);
+	dealloc(get_heap_allocator(), dst);
+	dealloc(get_heap_allocator(), src);
+}
+BENCH(mix_frames_s16_stereo_1024) {
+	Audio_Format format = ZERO(Audio_Format);
+	format.bit_width = AUDIO_BITS_16;
+	format.channels = 2;
+	format.sample_rate = 48000;
+
+	s16 *dst = (s16*)alloc(get_heap_allocator(), 1024*2*sizeof(s16));
+	s16 *src = (s16*)alloc(get_heap_allocator(), 1024*2*sizeof(s16));
+	for (u64 j = 0; j < 1024*2; j++) src[j] = (s16)(sinf((float32)j*0.01f)*1000.0f);
+	memset(dst, 0, 1024*2*sizeof(s16));
+	bench_reset_timer(b);
+	for (u64 i = 0; i < b->iterations; i++) {
+		mix_frames(dst, src, 1024, format);
+	}
+	bench_keep(dst[0]);
+	dealloc(get_heap_allocator(), dst);
+	dealloc(get_heap_allocator(), src);
+}
+#endif // NOT OOGABOOGA_HEADLESS
+
+///
+// Particles
+
+#if OOGABOOGA_EXTENSION_PARTICLES
+BENCH(particle_evaluate_properties) {
+	Emission_Property random_v2 = ZERO(Emission_Property);
+	random_v2.mode = EMISSION_PROPERTY_MODE_RANDOM;
+	random_v2.min_v2 = v2(-1, -1);
+	random_v2.max_v2 = v2(1, 1);
+
+	Emission_Property interp_v4 = ZERO(Emission_Property);
+	interp_v4.mode = EMISSION_PROPERTY_MODE_INTERPOLATE;
+	interp_v4.interp_kind = EMISSION_INTERPOLATION_SMOOTH;
+	interp_v4.min_v4 = v4(1, 1, 1, 1);
+	interp_v4.max_v4 = v4(0, 0, 0, 0);
+
+	// Roughly what particles_draw computes for one particle
+	for (u64 i = 0; i < b->iterations; i++) {
+		float32 t = (float32)(i%100)/100.0f;
+		Vector2 velocity = sample_emission_property_v2(random_v2, 69, t);
+		Vector2 size     = sample_emission_property_v2(random_v2, 69, t);
+		Vector4 color    = sample_emission_property_v4(interp_v4, 69, t);
+
+		Matrix3 xform = m3_identity();
+		xform = m3_translate(xform, v2_mulf(velocity, t));
+		xform = m3_rotate(xform, t);
+		bench_keep(xform.m[0][0] + size.x + color.x);
+	}
+}
+#endif // OOGABOOGA_EXTENSION_PARTICLES
@@ -1,7 +1,11 @@
 
 typedef struct Spinlock Spinlock;
+typedef struct Ticket_Lock Ticket_Lock;
 typedef struct Mutex Mutex;
 typedef struct Binary_Semaphore Binary_Semaphore;
+typedef struct Semaphore Semaphore;
+typedef struct RW_Lock RW_Lock;
+typedef struct Seqlock Seqlock;
 
 // These are probably your best friend for sync-free multi-processing.
 inline bool compare_and_swap_8(volatile uint8_t *a, uint8_t b, uint8_t old);
@@ -9,13 +13,42 @@ inline bool compare_and_swap_16(volatile uint16_t *a, uint16_t b, uint16_t old);
 inline bool compare_and_swap_32(volatile uint32_t *a, uint32_t b, uint32_t old);
 inline bool compare_and_swap_64(volatile uint64_t *a, uint64_t b, uint64_t old);
 inline bool compare_and_swap_bool(volatile bool *a, bool b, bool old);
+inline u32 atomic_fetch_add_32(volatile u32 *a, u32 value);
+inline u64 atomic_fetch_add_64(volatile u64 *a, u64 value);
+inline u32 atomic_exchange_32(volatile u32 *a, u32 value);
+inline u64 atomic_exchange_64(volatile u64 *a, u64 value);
+inline u32 atomic_load_acquire_32(volatile u32 *a);
+inline u64 atomic_load_acquire_64(volatile u64 *a);
+inline void atomic_store_release_32(volatile u32 *a, u32 value);
+inline void atomic_store_release_64(volatile u64 *a, u64 value);
+
+///
+// Lock contention stats
+// With ENABLE_LOCK_CONTENTION_STATS, Spinlock and Ticket_Lock count how often they had to
+// wait and for how long. With ENABLE_PROFILING too, every contended acquire also shows up in
+// the profiler as a "Lock contention" event.
+typedef struct Lock_Stats {
+	volatile u64 acquire_count;
+	volatile u64 contended_count;
+	volatile u64 wait_cycles;
+} Lock_Stats;
+
+// Defined in profiling.c
+void _profiler_report_lock_contention(u64 start_cycles, u64 wait_cycles);
 
 ///
 // Spinlock "primitive"
 // Like a mutex but it eats up the entire core while waiting.
 // Beneficial if contention is low or sync speed is important
+// Waiters back off exponentially with _mm_pause so they don't hammer the cache line or starve
+// a hyperthread sibling, and start yielding the thread if the wait gets long.
+#define SPINLOCK_MAX_BACKOFF 64
+#define SPINLOCK_SPINS_BEFORE_YIELD 4096
 typedef struct Spinlock {
 	volatile bool locked;
+#if ENABLE_LOCK_CONTENTION_STATS
+	Lock_Stats stats;
+#endif
 } Spinlock;
 
 void ogb_instance
@@ -31,17 +64,49 @@ spinlock_acquire_or_wait_timeout(Spinlock* l, f64 timeout_seconds);
 void ogb_instance
 spinlock_release(Spinlock* l);
 
+///
+// Ticket lock
+// A fair spinlock: threads get the lock in the order they started waiting for it.
+// Slightly slower than Spinlock without contention, but nobody starves under contention.
+// Waiters can't jump the line, so when the next in line isn't running everyone is stuck.
+// That's why this yields a lot sooner than Spinlock.
+#define TICKET_LOCK_SPINS_BEFORE_YIELD 64
+typedef struct Ticket_Lock {
+	volatile u32 next_ticket;
+	volatile u32 now_serving;
+#if ENABLE_LOCK_CONTENTION_STATS
+	Lock_Stats stats;
+#endif
+} Ticket_Lock;
+
+void ogb_instance
+ticket_lock_init(Ticket_Lock *l);
+
+void ogb_instance
+ticket_lock_acquire_or_wait(Ticket_Lock *l);
+
+bool ogb_instance
+ticket_lock_try_acquire(Ticket_Lock *l);
+
+void ogb_instance
+ticket_lock_release(Ticket_Lock *l);
+
 
 ///
-// High-level mutex primitive (short spinlock then OS mutex lock)
-// Just spins for a few (configurable) microseconds with a spinlock,
-// and if acquiring fails it falls back to a OS mutex.
-#define MUTEX_DEFAULT_SPIN_TIME_MICROSECONDS 100
+// High-level mutex primitive (spin a little, then sleep on the address)
+// Spins with _mm_pause for a while in case the owner is about to release, and if that fails
+// the thread sleeps with os_wait_on_address until it's woken by mutex_release.
+// The spin count adapts to how long the mutex is usually held.
+#define MUTEX_DEFAULT_SPIN_COUNT 100
+#define MUTEX_MAX_SPIN_COUNT 4000
+typedef enum Mutex_State {
+	MUTEX_UNLOCKED = 0,
+	MUTEX_LOCKED = 1,
+	MUTEX_LOCKED_WITH_WAITERS = 2,
+} Mutex_State;
 typedef struct Mutex {
-	Spinlock spinlock;
-	f64 spin_time_microseconds;
-	Mutex_Handle os_handle;
-	volatile bool spinlock_acquired;
+	volatile u32 state; // Mutex_State
+	u32 spin_count;
 	volatile u64 acquiring_thread;
 } Mutex;
 
@@ -54,6 +119,9 @@ mutex_destroy(Mutex *m);
 void ogb_instance
 mutex_acquire_or_wait(Mutex *m);
 
+bool ogb_instance
+mutex_try_acquire(Mutex *m);
+
 void ogb_instance
 mutex_release(Mutex *m);
 
@@ -61,8 +129,7 @@ mutex_release(Mutex *m);
 ///
 // Binary semaphore
 typedef struct Binary_Semaphore {
-    volatile bool signaled;
-    Mutex mutex;
+    volatile u32 signaled;
 } Binary_Semaphore;
 
 void ogb_instance
@@ -77,35 +144,272 @@ binary_semaphore_wait(Binary_Semaphore *sem);
 void ogb_instance
 binary_semaphore_signal(Binary_Semaphore *sem);
 
+///
+// Counting semaphore
+// wait blocks until count is above zero and then decrements it, signal increments it.
+#define SEMAPHORE_SPIN_COUNT 100
+typedef struct Semaphore {
+	volatile u32 count;
+	volatile u32 waiter_count;
+} Semaphore;
+
+void ogb_instance
+semaphore_init(Semaphore *sem, u32 initial_count);
+
+void ogb_instance
+semaphore_destroy(Semaphore *sem);
+
+void ogb_instance
+semaphore_wait(Semaphore *sem);
+
+// Returns false if count is zero
+bool ogb_instance
+semaphore_try_wait(Semaphore *sem);
+
+// Returns false if timeout_ms passed before the semaphore was signaled
+bool ogb_instance
+semaphore_wait_timeout(Semaphore *sem, s64 timeout_ms);
+
+void ogb_instance
+semaphore_signal(Semaphore *sem, u32 count);
+
+///
+// Reader-writer lock
+// Any number of readers at a time, or one writer. Writers are preferred: once a writer is
+// waiting, new readers wait too, so a steady stream of readers can't starve writers.
+// Spins briefly and then sleeps on the state like Mutex.
+#define RW_LOCK_WRITER         0x80000000
+#define RW_LOCK_WRITER_WAITING 0x40000000
+#define RW_LOCK_READER_MASK    0x3FFFFFFF
+typedef struct RW_Lock {
+	// Reader count or RW_LOCK_WRITER, plus RW_LOCK_WRITER_WAITING. Everyone sleeps on this
+	// word, so anything that should wake a sleeper has to change it.
+	volatile u32 state;
+	volatile u32 waiting_writer_count;
+} RW_Lock;
+
+void ogb_instance
+rw_lock_init(RW_Lock *l);
+
+void ogb_instance
+rw_lock_acquire_read(RW_Lock *l);
+
+void ogb_instance
+rw_lock_release_read(RW_Lock *l);
+
+void ogb_instance
+rw_lock_acquire_write(RW_Lock *l);
+
+void ogb_instance
+rw_lock_release_write(RW_Lock *l);
+
+///
+// Seqlock
+// For small structs that are read a lot more than they are written. Readers never block or
+// write to shared memory; they copy the data and retry if a writer was active meanwhile.
+// Writers never wait for readers, only for other writers.
+//
+//	Thing copy;
+//	seqlock_read_copy(&lock, &copy, &shared_thing, sizeof(Thing));
+//
+//	seqlock_write_begin(&lock);
+//	shared_thing.x = 5;
+//	seqlock_write_end(&lock);
+//
+// Only use it for plain data, a reader may see a half written copy before it retries.
+typedef struct Seqlock {
+	volatile u32 sequence; // Odd while a writer is active
+} Seqlock;
+
+void ogb_instance
+seqlock_init(Seqlock *l);
+
+// Returns the sequence to pass to seqlock_read_retry
+u32 ogb_instance
+seqlock_read_begin(Seqlock *l);
+
+// True if a write happened since seqlock_read_begin, and the read must be redone
+bool ogb_instance
+seqlock_read_retry(Seqlock *l, u32 sequence);
+
+void ogb_instance
+seqlock_write_begin(Seqlock *l);
+
+void ogb_instance
+seqlock_write_end(Seqlock *l);
+
+void ogb_instance
+seqlock_read_copy(Seqlock *l, void *dst, const volatile void *src, u64 size);
+
+void ogb_instance
+seqlock_write_copy(Seqlock *l, volatile void *dst, const void *src, u64 size);
+
+///
+// Lock-free bounded queues
+// Items are copied in and out by value. Capacity is rounded up to a power of two.
+// Push returns false when the queue is full, pop returns false when it's empty.
+// The batch versions push/pop as many as they can (up to count) and return how many.
+
+#define QUEUE_CACHE_LINE_SIZE 64
+
+///
+// Single producer, single consumer.
+// Only one thread may push and only one thread may pop.
+typedef struct Spsc_Queue {
+	volatile u64 write_pos;
+	u64 cached_read_pos; // Producer's last look at read_pos
+	u8 _pad0[QUEUE_CACHE_LINE_SIZE-sizeof(u64)*2];
+	volatile u64 read_pos;
+	u64 cached_write_pos; // Consumer's last look at write_pos
+	u8 _pad1[QUEUE_CACHE_LINE_SIZE-sizeof(u64)*2];
+	
+	u8 *items;
+	u64 item_size;
+	u64 capacity;
+	Allocator allocator;
+} Spsc_Queue;
+
+void ogb_instance
+spsc_queue_init(Spsc_Queue *q, u64 item_size, u64 capacity, Allocator allocator);
+
+void ogb_instance
+spsc_queue_destroy(Spsc_Queue *q);
+
+bool ogb_instance
+spsc_queue_push(Spsc_Queue *q, void *item);
+
+bool ogb_instance
+spsc_queue_pop(Spsc_Queue *q, void *item);
+
+u64 ogb_instance
+spsc_queue_push_batch(Spsc_Queue *q, void *items, u64 count);
+
+u64 ogb_instance
+spsc_queue_pop_batch(Spsc_Queue *q, void *items, u64 count);
+
+///
+// Multi producer, multi consumer (Dmitry Vyukov's bounded queue).
+// Each slot has a sequence number which tells whether it's ready to be written or read
+// for a given position, so producers and consumers only contend on their own index.
+typedef struct Mpmc_Queue {
+	volatile u64 write_pos;
+	u8 _pad0[QUEUE_CACHE_LINE_SIZE-sizeof(u64)];
+	volatile u64 read_pos;
+	u8 _pad1[QUEUE_CACHE_LINE_SIZE-sizeof(u64)];
+	
+	u8 *slots; // u64 sequence followed by the item
+	u64 slot_size;
+	u64 item_size;
+	u64 capacity;
+	Allocator allocator;
+} Mpmc_Queue;
+
+void ogb_instance
+mpmc_queue_init(Mpmc_Queue *q, u64 item_size, u64 capacity, Allocator allocator);
+
+void ogb_instance
+mpmc_queue_destroy(Mpmc_Queue *q);
+
+bool ogb_instance
+mpmc_queue_push(Mpmc_Queue *q, void *item);
+
+bool ogb_instance
+mpmc_queue_pop(Mpmc_Queue *q, void *item);
+
+u64 ogb_instance
+mpmc_queue_push_batch(Mpmc_Queue *q, void *items, u64 count);
+
+u64 ogb_instance
+mpmc_queue_pop_batch(Mpmc_Queue *q, void *items, u64 count);
+
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
+// Returns the new backoff
+inline u32 _spin_backoff(u32 backoff, u64 *spins) {
+	if (*spins >= SPINLOCK_SPINS_BEFORE_YIELD) {
+		os_yield_thread();
+		return backoff;
+	}
+	for (u32 i = 0; i < backoff; i++) _mm_pause();
+	*spins += backoff;
+	return min(backoff*2, SPINLOCK_MAX_BACKOFF);
+}
+
+#if ENABLE_LOCK_CONTENTION_STATS
+void _lock_stats_report(Lock_Stats *stats, u64 start, bool contended) {
+	atomic_fetch_add_64(&stats->acquire_count, 1);
+	if (!contended) return;
+	
+	u64 wait_cycles = rdtsc()-start;
+	atomic_fetch_add_64(&stats->contended_count, 1);
+	atomic_fetch_add_64(&stats->wait_cycles, wait_cycles);
+	_profiler_report_lock_contention(start, wait_cycles);
+}
+#endif
+
 void spinlock_init(Spinlock *l) {
 	memset(l, 0, sizeof(*l));
 }
 void spinlock_acquire_or_wait(Spinlock* l) {
+	if (compare_and_swap_bool(&l->locked, true, false)) {
+#if ENABLE_LOCK_CONTENTION_STATS
+		_lock_stats_report(&l->stats, 0, false);
+#endif
+		return;
+	}
+	
+#if ENABLE_LOCK_CONTENTION_STATS
+	u64 start = rdtsc();
+#endif
+	
+	u32 backoff = 1;
+	u64 spins = 0;
 	while (true) {
-        bool expected = false;
-        if (compare_and_swap_bool(&l->locked, true, expected)) {
-            return;
-        }
+		// Only try the CAS when it looks free so we don't keep stealing the cache line
         while (l->locked) {
-            // spinny boi
+            backoff = _spin_backoff(backoff, &spins);
+        }
+        if (compare_and_swap_bool(&l->locked, true, false)) {
+#if ENABLE_LOCK_CONTENTION_STATS
+            _lock_stats_report(&l->stats, start, true);
+#endif
+            return;
         }
     }
 }
 // Returns true on aquired, false if timeout seconds reached
 bool spinlock_acquire_or_wait_timeout(Spinlock* l, f64 timeout_seconds) {
-    f64 start = os_get_elapsed_seconds();
+	if (compare_and_swap_bool(&l->locked, true, false)) {
+#if ENABLE_LOCK_CONTENTION_STATS
+		_lock_stats_report(&l->stats, 0, false);
+#endif
+		return true;
+	}
+	
+#if ENABLE_LOCK_CONTENTION_STATS
+	u64 start = rdtsc();
+#endif
+    f64 start_seconds = os_get_elapsed_seconds();
+    
+	u32 backoff = 1;
+	u64 spins = 0;
 	while (true) {
-        bool expected = false;
-        if (compare_and_swap_bool(&l->locked, true, expected)) {
-            return true;
-        }
         while (l->locked) {
-            // spinny boi
-            if ((os_get_elapsed_seconds()-start) >= timeout_seconds) return false;
+            backoff = _spin_backoff(backoff, &spins);
+            
+            // Checking the time is much more expensive than a pause, so only do it now and then
+            if (backoff == SPINLOCK_MAX_BACKOFF && (os_get_elapsed_seconds()-start_seconds) >= timeout_seconds) {
+            	return false;
+            }
         }
+        if (compare_and_swap_bool(&l->locked, true, false)) {
+#if ENABLE_LOCK_CONTENTION_STATS
+            _lock_stats_report(&l->stats, start, true);
+#endif
+            return true;
+        }
+        if ((os_get_elapsed_seconds()-start_seconds) >= timeout_seconds) return false;
     }
     return true;
 }
@@ -115,68 +419,472 @@ void spinlock_release(Spinlock* l) {
     assert(success, "This thread should have acquired the spinlock but compare_and_swap failed");
 }
 
+///
+// Ticket lock
+
+void ticket_lock_init(Ticket_Lock *l) {
+	memset(l, 0, sizeof(*l));
+}
+void ticket_lock_acquire_or_wait(Ticket_Lock *l) {
+	u32 ticket = atomic_fetch_add_32(&l->next_ticket, 1);
+	u32 serving = atomic_load_acquire_32(&l->now_serving);
+	
+	if (serving == ticket) {
+#if ENABLE_LOCK_CONTENTION_STATS
+		_lock_stats_report(&l->stats, 0, false);
+#endif
+		return;
+	}
+	
+#if ENABLE_LOCK_CONTENTION_STATS
+	u64 start = rdtsc();
+#endif
+	u64 spins = 0;
+	while (serving != ticket) {
+		// Back off in proportion to how many are ahead of us in line. If there's a long line,
+		// give the core to someone else, otherwise the threads ahead of us might not get to
+		// run when there are more threads than cores.
+		u32 ahead = ticket - serving;
+		if (spins >= TICKET_LOCK_SPINS_BEFORE_YIELD || ahead > 2) {
+			os_yield_thread();
+		} else {
+			u32 pauses = min(ahead*16, SPINLOCK_MAX_BACKOFF);
+			for (u32 i = 0; i < pauses; i++) _mm_pause();
+			spins += pauses;
+		}
+		serving = atomic_load_acquire_32(&l->now_serving);
+	}
+#if ENABLE_LOCK_CONTENTION_STATS
+	_lock_stats_report(&l->stats, start, true);
+#endif
+}
+bool ticket_lock_try_acquire(Ticket_Lock *l) {
+	u32 serving = atomic_load_acquire_32(&l->now_serving);
+	// Only take a ticket if it would be served right away
+	bool acquired = compare_and_swap_32(&l->next_ticket, serving+1, serving);
+#if ENABLE_LOCK_CONTENTION_STATS
+	if (acquired) _lock_stats_report(&l->stats, 0, false);
+#endif
+	return acquired;
+}
+void ticket_lock_release(Ticket_Lock *l) {
+	assert(l->now_serving != l->next_ticket, "Tried to release a ticket lock which is not acquired");
+	// Only the owner writes now_serving
+	atomic_store_release_32(&l->now_serving, l->now_serving+1);
+}
+
 
 ///
-// High-level mutex primitive (short spinlock then OS mutex lock)
+// High-level mutex primitive
 
 void mutex_init(Mutex *m) {
-	spinlock_init(&m->spinlock);
-	m->spin_time_microseconds = MUTEX_DEFAULT_SPIN_TIME_MICROSECONDS;
-	m->os_handle = os_make_mutex();
-	m->spinlock_acquired = false;
+	m->state = MUTEX_UNLOCKED;
+	m->spin_count = MUTEX_DEFAULT_SPIN_COUNT;
 	m->acquiring_thread = 0;
 }
 void mutex_destroy(Mutex *m) {
-	os_destroy_mutex(m->os_handle);
+	assert(m->state == MUTEX_UNLOCKED, "Destroying a mutex which is still acquired");
+}
+bool mutex_try_acquire(Mutex *m) {
+	if (!compare_and_swap_32(&m->state, MUTEX_LOCKED, MUTEX_UNLOCKED)) return false;
+	
+	assert(!m->acquiring_thread, "Internal sync error in Mutex: Multiple threads acquired");
+	m->acquiring_thread = context.thread_id;
+	return true;
 }
 void mutex_acquire_or_wait(Mutex *m) {
-	if (spinlock_acquire_or_wait_timeout(&m->spinlock, m->spin_time_microseconds / 1000000.0)) {
-        assert(!m->spinlock_acquired, "Internal sync error in Mutex");
-    	m->spinlock_acquired = true;
-    }
-    os_lock_mutex(m->os_handle);
-    
-    assert(!m->acquiring_thread, "Internal sync error in Mutex: Multiple threads acquired");
-    m->acquiring_thread = context.thread_id;
+	if (mutex_try_acquire(m)) return;
+	
+	// Spin with exponential backoff, in case the owner releases soon
+	u32 spin_count = m->spin_count;
+	u32 spins = 0;
+	u32 backoff = 1;
+	while (spins < spin_count) {
+		if (m->state == MUTEX_UNLOCKED && mutex_try_acquire(m)) {
+			// Worth spinning for, spin a bit longer next time
+			m->spin_count = min(spin_count + spin_count/8 + 1, MUTEX_MAX_SPIN_COUNT);
+			return;
+		}
+		for (u32 i = 0; i < backoff; i++) _mm_pause();
+		spins += backoff;
+		backoff = min(backoff*2, 64);
+	}
+	m->spin_count = max(spin_count - spin_count/8, 1);
+	
+	// Mark that there are waiters, so release knows to wake someone. If the mutex was
+	// unlocked when we did that, we got it.
+	u32 expected = MUTEX_LOCKED_WITH_WAITERS;
+	while (atomic_exchange_32(&m->state, MUTEX_LOCKED_WITH_WAITERS) != MUTEX_UNLOCKED) {
+		os_wait_on_address(&m->state, &expected, sizeof(u32), OS_WAIT_INFINITE);
+	}
+	
+	assert(!m->acquiring_thread, "Internal sync error in Mutex: Multiple threads acquired");
+	m->acquiring_thread = context.thread_id;
 }
 void mutex_release(Mutex *m) {
 	assert(m->acquiring_thread != 0, "Tried to release a mutex which is not acquired");
 	assert(m->acquiring_thread == context.thread_id, "Non-owning thread tried to release mutex");
 	m->acquiring_thread = 0;
-	bool was_spinlock_acquired = m->spinlock_acquired;
-	m->spinlock_acquired = false;
-	os_unlock_mutex(m->os_handle);
-	if (was_spinlock_acquired) {
-		spinlock_release(&m->spinlock);
+	
+	if (atomic_exchange_32(&m->state, MUTEX_UNLOCKED) == MUTEX_LOCKED_WITH_WAITERS) {
+		os_wake_one_waiting_on_address(&m->state);
 	}
 }
 
-
+///
+// Binary semaphore
 
 void binary_semaphore_init(Binary_Semaphore *sem, bool initial_state) {
-    sem->signaled = initial_state;
-    mutex_init(&sem->mutex);
+    sem->signaled = initial_state ? 1 : 0;
 }
 
 void binary_semaphore_destroy(Binary_Semaphore *sem) {
-    mutex_destroy(&sem->mutex);
 }
 
 void binary_semaphore_wait(Binary_Semaphore *sem) {
-    mutex_acquire_or_wait(&sem->mutex);
-    while (!sem->signaled) {
-        mutex_release(&sem->mutex);
-        os_yield_thread();
-        mutex_acquire_or_wait(&sem->mutex);
-    }
-    sem->signaled = false;
-    mutex_release(&sem->mutex);
+	for (u32 i = 0; i < SEMAPHORE_SPIN_COUNT; i++) {
+		if (sem->signaled && compare_and_swap_32(&sem->signaled, 0, 1)) return;
+		_mm_pause();
+	}
+	
+	u32 unsignaled = 0;
+	while (!compare_and_swap_32(&sem->signaled, 0, 1)) {
+		os_wait_on_address(&sem->signaled, &unsignaled, sizeof(u32), OS_WAIT_INFINITE);
+	}
 }
 
 void binary_semaphore_signal(Binary_Semaphore *sem) {
-    mutex_acquire_or_wait(&sem->mutex);
-    sem->signaled = true;
-    mutex_release(&sem->mutex);
+    if (atomic_exchange_32(&sem->signaled, 1) == 0) {
+    	os_wake_one_waiting_on_address(&sem->signaled);
+    }
+}
+
+///
+// Counting semaphore
+
+void semaphore_init(Semaphore *sem, u32 initial_count) {
+	sem->count = initial_count;
+	sem->waiter_count = 0;
+}
+void semaphore_destroy(Semaphore *sem) {
+	assert(sem->waiter_count == 0, "Destroying a semaphore which is being waited on");
+}
+bool semaphore_try_wait(Semaphore *sem) {
+	while (true) {
+		u32 count = sem->count;
+		if (count == 0) return false;
+		if (compare_and_swap_32(&sem->count, count-1, count)) return true;
+	}
+}
+bool semaphore_wait_timeout(Semaphore *sem, s64 timeout_ms) {
+	for (u32 i = 0; i < SEMAPHORE_SPIN_COUNT; i++) {
+		if (semaphore_try_wait(sem)) return true;
+		_mm_pause();
+	}
+	
+	f64 start = timeout_ms > 0 ? os_get_elapsed_seconds() : 0;
+	
+	atomic_fetch_add_32(&sem->waiter_count, 1);
+	bool acquired = true;
+	u32 zero = 0;
+	while (!semaphore_try_wait(sem)) {
+		s64 remaining_ms = timeout_ms;
+		if (timeout_ms > 0) {
+			remaining_ms = timeout_ms - (s64)((os_get_elapsed_seconds()-start)*1000.0);
+			if (remaining_ms < 0) remaining_ms = 0;
+		}
+		if (timeout_ms >= 0 && remaining_ms == 0) {
+			acquired = semaphore_try_wait(sem);
+			break;
+		}
+		os_wait_on_address(&sem->count, &zero, sizeof(u32), remaining_ms);
+	}
+	atomic_fetch_add_32(&sem->waiter_count, (u32)-1);
+	
+	return acquired;
+}
+void semaphore_wait(Semaphore *sem) {
+	semaphore_wait_timeout(sem, OS_WAIT_INFINITE);
+}
+void semaphore_signal(Semaphore *sem, u32 count) {
+	if (count == 0) return;
+	atomic_fetch_add_32(&sem->count, count);
+	
+	if (atomic_load_acquire_32(&sem->waiter_count) > 0) {
+		if (count == 1) os_wake_one_waiting_on_address(&sem->count);
+		else            os_wake_all_waiting_on_address(&sem->count);
+	}
+}
+
+///
+// Reader-writer lock
+
+void rw_lock_init(RW_Lock *l) {
+	l->state = 0;
+	l->waiting_writer_count = 0;
+}
+void rw_lock_acquire_read(RW_Lock *l) {
+	u32 spins = 0;
+	while (true) {
+		u32 state = l->state;
+		if (!(state & (RW_LOCK_WRITER | RW_LOCK_WRITER_WAITING))) {
+			if (compare_and_swap_32(&l->state, state+1, state)) return;
+			continue;
+		}
+		
+		if (spins < MUTEX_DEFAULT_SPIN_COUNT) {
+			_mm_pause();
+			spins += 1;
+		} else {
+			// The writer waiting bit is part of state, so a writer coming and going changes
+			// the value and we can't sleep through it.
+			os_wait_on_address(&l->state, &state, sizeof(u32), OS_WAIT_INFINITE);
+		}
+	}
+}
+void rw_lock_release_read(RW_Lock *l) {
+	assert((l->state & RW_LOCK_READER_MASK) != 0 && !(l->state & RW_LOCK_WRITER), "Tried to release a read lock which is not acquired");
+	
+	u32 previous = atomic_fetch_add_32(&l->state, (u32)-1);
+	
+	// Last reader out lets the writers in. Readers might be sleeping on the same address, so
+	// wake everyone or a reader might eat the wakeup.
+	if ((previous & RW_LOCK_READER_MASK) == 1 && (previous & RW_LOCK_WRITER_WAITING)) {
+		os_wake_all_waiting_on_address(&l->state);
+	}
+}
+void rw_lock_acquire_write(RW_Lock *l) {
+	if (compare_and_swap_32(&l->state, RW_LOCK_WRITER, 0)) return;
+	
+	atomic_fetch_add_32(&l->waiting_writer_count, 1);
+	u32 spins = 0;
+	while (true) {
+		u32 state = l->state;
+		if ((state & ~RW_LOCK_WRITER_WAITING) == 0) {
+			// Keep the waiting bit if other writers are still queued behind us
+			u32 new_state = RW_LOCK_WRITER;
+			if (atomic_load_acquire_32(&l->waiting_writer_count) > 1) new_state |= RW_LOCK_WRITER_WAITING;
+			if (compare_and_swap_32(&l->state, new_state, state)) break;
+			continue;
+		}
+		if (!(state & RW_LOCK_WRITER_WAITING)) {
+			// Stop new readers from coming in
+			compare_and_swap_32(&l->state, state | RW_LOCK_WRITER_WAITING, state);
+			continue;
+		}
+		
+		if (spins < MUTEX_DEFAULT_SPIN_COUNT) {
+			_mm_pause();
+			spins += 1;
+		} else {
+			os_wait_on_address(&l->state, &state, sizeof(u32), OS_WAIT_INFINITE);
+		}
+	}
+	atomic_fetch_add_32(&l->waiting_writer_count, (u32)-1);
+}
+void rw_lock_release_write(RW_Lock *l) {
+	assert(l->state & RW_LOCK_WRITER, "Tried to release a write lock which is not acquired");
+	
+	// A queued writer can set the waiting bit at any time, so keep it
+	while (true) {
+		u32 state = l->state;
+		if (compare_and_swap_32(&l->state, state & RW_LOCK_WRITER_WAITING, state)) break;
+	}
+	os_wake_all_waiting_on_address(&l->state);
+}
+
+///
+// Seqlock
+
+void seqlock_init(Seqlock *l) {
+	l->sequence = 0;
+}
+u32 seqlock_read_begin(Seqlock *l) {
+	while (true) {
+		u32 sequence = atomic_load_acquire_32(&l->sequence);
+		if (!(sequence & 1)) return sequence;
+		_mm_pause();
+	}
+}
+bool seqlock_read_retry(Seqlock *l, u32 sequence) {
+	// The data reads must happen before we read the sequence again
+	MEMORY_BARRIER;
+	return atomic_load_acquire_32(&l->sequence) != sequence;
+}
+void seqlock_write_begin(Seqlock *l) {
+	// Taking the sequence from even to odd also locks out other writers
+	while (true) {
+		u32 sequence = l->sequence;
+		if (!(sequence & 1) && compare_and_swap_32(&l->sequence, sequence+1, sequence)) break;
+		_mm_pause();
+	}
+}
+void seqlock_write_end(Seqlock *l) {
+	atomic_store_release_32(&l->sequence, l->sequence+1);
+}
+void seqlock_read_copy(Seqlock *l, void *dst, const volatile void *src, u64 size) {
+	u32 sequence;
+	do {
+		sequence = seqlock_read_begin(l);
+		memcpy(dst, (const void*)src, size);
+	} while (seqlock_read_retry(l, sequence));
+}
+void seqlock_write_copy(Seqlock *l, volatile void *dst, const void *src, u64 size) {
+	seqlock_write_begin(l);
+	memcpy((void*)dst, src, size);
+	seqlock_write_end(l);
+}
+
+///
+// Single producer, single consumer queue
+
+u64 _queue_capacity_for(u64 capacity) {
+	u64 n = 2;
+	while (n < capacity) n *= 2;
+	return n;
+}
+
+void spsc_queue_init(Spsc_Queue *q, u64 item_size, u64 capacity, Allocator allocator) {
+	memset(q, 0, sizeof(*q));
+	q->item_size = item_size;
+	q->capacity = _queue_capacity_for(capacity);
+	q->allocator = allocator;
+	q->items = (u8*)alloc(allocator, q->capacity*item_size);
+}
+void spsc_queue_destroy(Spsc_Queue *q) {
+	dealloc(q->allocator, q->items);
+	q->items = 0;
+}
+
+u64 spsc_queue_push_batch(Spsc_Queue *q, void *items, u64 count) {
+	u64 write_pos = q->write_pos;
+	
+	// Only look at the consumer's cache line when we think we're full
+	if (write_pos + count - q->cached_read_pos > q->capacity) {
+		q->cached_read_pos = atomic_load_acquire_64(&q->read_pos);
+	}
+	u64 free_count = q->capacity - (write_pos - q->cached_read_pos);
+	count = min(count, free_count);
+	if (count == 0) return 0;
+	
+	u64 offset = write_pos & (q->capacity-1);
+	u64 first = min(count, q->capacity-offset);
+	memcpy(q->items + offset*q->item_size, items, first*q->item_size);
+	memcpy(q->items, (u8*)items + first*q->item_size, (count-first)*q->item_size);
+	
+	atomic_store_release_64(&q->write_pos, write_pos + count);
+	return count;
+}
+u64 spsc_queue_pop_batch(Spsc_Queue *q, void *items, u64 count) {
+	u64 read_pos = q->read_pos;
+	
+	if (q->cached_write_pos - read_pos < count) {
+		q->cached_write_pos = atomic_load_acquire_64(&q->write_pos);
+	}
+	count = min(count, q->cached_write_pos - read_pos);
+	if (count == 0) return 0;
+	
+	u64 offset = read_pos & (q->capacity-1);
+	u64 first = min(count, q->capacity-offset);
+	memcpy(items, q->items + offset*q->item_size, first*q->item_size);
+	memcpy((u8*)items + first*q->item_size, q->items, (count-first)*q->item_size);
+	
+	atomic_store_release_64(&q->read_pos, read_pos + count);
+	return count;
+}
+bool spsc_queue_push(Spsc_Queue *q, void *item) {
+	return spsc_queue_push_batch(q, item, 1) == 1;
+}
+bool spsc_queue_pop(Spsc_Queue *q, void *item) {
+	return spsc_queue_pop_batch(q, item, 1) == 1;
+}
+
+///
+// Multi producer, multi consumer queue
+//
+// Slot i starts with sequence i. A producer at position pos may write the slot when its
+// sequence is pos, and then sets it to pos+1. A consumer at position pos may read the
+// slot when its sequence is pos+1, and then sets it to pos+capacity for the next lap.
+
+#define _mpmc_slot(q, pos) ((volatile u64*)((q)->slots + ((pos) & ((q)->capacity-1))*(q)->slot_size))
+
+void mpmc_queue_init(Mpmc_Queue *q, u64 item_size, u64 capacity, Allocator allocator) {
+	memset(q, 0, sizeof(*q));
+	q->item_size = item_size;
+	q->slot_size = align_next(sizeof(u64) + item_size, 8);
+	q->capacity = _queue_capacity_for(capacity);
+	q->allocator = allocator;
+	q->slots = (u8*)alloc(allocator, q->capacity*q->slot_size);
+	
+	for (u64 i = 0; i < q->capacity; i++) {
+		*_mpmc_slot(q, i) = i;
+	}
+}
+void mpmc_queue_destroy(Mpmc_Queue *q) {
+	dealloc(q->allocator, q->slots);
+	q->slots = 0;
+}
+
+u64 mpmc_queue_push_batch(Mpmc_Queue *q, void *items, u64 count) {
+	if (count == 0) return 0;
+	
+	u64 pos = atomic_load_acquire_64(&q->write_pos);
+	u64 n;
+	while (true) {
+		// How many slots in a row are ready for this lap
+		n = 0;
+		while (n < count && atomic_load_acquire_64(_mpmc_slot(q, pos+n)) == pos+n) n += 1;
+		
+		if (n == 0) {
+			s64 diff = (s64)(atomic_load_acquire_64(_mpmc_slot(q, pos)) - pos);
+			if (diff < 0) return 0; // Full
+			pos = atomic_load_acquire_64(&q->write_pos); // Someone else got here first
+			continue;
+		}
+		
+		if (compare_and_swap_64(&q->write_pos, pos+n, pos)) break;
+		pos = atomic_load_acquire_64(&q->write_pos);
+	}
+	
+	for (u64 i = 0; i < n; i++) {
+		volatile u64 *seq = _mpmc_slot(q, pos+i);
+		memcpy((u8*)seq + sizeof(u64), (u8*)items + i*q->item_size, q->item_size);
+		atomic_store_release_64(seq, pos+i+1);
+	}
+	return n;
+}
+u64 mpmc_queue_pop_batch(Mpmc_Queue *q, void *items, u64 count) {
+	if (count == 0) return 0;
+	
+	u64 pos = atomic_load_acquire_64(&q->read_pos);
+	u64 n;
+	while (true) {
+		n = 0;
+		while (n < count && atomic_load_acquire_64(_mpmc_slot(q, pos+n)) == pos+n+1) n += 1;
+		
+		if (n == 0) {
+			s64 diff = (s64)(atomic_load_acquire_64(_mpmc_slot(q, pos)) - (pos+1));
+			if (diff < 0) return 0; // Empty
+			pos = atomic_load_acquire_64(&q->read_pos);
+			continue;
+		}
+		
+		if (compare_and_swap_64(&q->read_pos, pos+n, pos)) break;
+		pos = atomic_load_acquire_64(&q->read_pos);
+	}
+	
+	for (u64 i = 0; i < n; i++) {
+		volatile u64 *seq = _mpmc_slot(q, pos+i);
+		memcpy((u8*)items + i*q->item_size, (u8*)seq + sizeof(u64), q->item_size);
+		atomic_store_release_64(seq, pos+i+q->capacity);
+	}
+	return n;
+}
+bool mpmc_queue_push(Mpmc_Queue *q, void *item) {
+	return mpmc_queue_push_batch(q, item, 1) == 1;
+}
+bool mpmc_queue_pop(Mpmc_Queue *q, void *item) {
+	return mpmc_queue_pop_batch(q, item, 1) == 1;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -18,6 +18,9 @@ typedef struct Cpu_Capabilities {
 	bool avx2;
 	bool avx512;
 	
+	// rdtsc ticks at a constant rate regardless of power states & frequency scaling
+	bool invariant_tsc;
+	
 } Cpu_Capabilities;
 
 // I think this is the standard? (sse1)
@@ -29,15 +32,8 @@ typedef struct Cpu_Capabilities {
 	#define inline __forceinline
 	#define alignat(x) __declspec(align(x))
 	#define noreturn __declspec(noreturn)
+	#define noinline __declspec(noinline)
     #define COMPILER_HAS_MEMCPY_INTRINSICS 1
-    inline void 
-    crash() noreturn {
-		__debugbreak();
-		volatile int *a = 0;
-		*a = 5;
-		a = (volatile int*)0xDEADBEEF;
-    	*a = 5;
-	}
     #include <intrin.h>
     #pragma intrinsic(__rdtsc)
     inline u64 
@@ -107,6 +103,60 @@ typedef struct Cpu_Capabilities {
 	
 	#define MEMORY_BARRIER _ReadWriteBarrier()
 	
+	// Returns the value before the add
+	inline u32 
+	atomic_fetch_add_32(volatile u32 *a, u32 value) {
+		return (u32)_InterlockedExchangeAdd((volatile long*)a, (long)value);
+	}
+	inline u64 
+	atomic_fetch_add_64(volatile u64 *a, u64 value) {
+		return (u64)_InterlockedExchangeAdd64((volatile long long*)a, (long long)value);
+	}
+	// Returns the previous value
+	inline u32 
+	atomic_exchange_32(volatile u32 *a, u32 value) {
+		return (u32)_InterlockedExchange((volatile long*)a, (long)value);
+	}
+	inline u64 
+	atomic_exchange_64(volatile u64 *a, u64 value) {
+		return (u64)_InterlockedExchange64((volatile long long*)a, (long long)value);
+	}
+	// x86 loads are acquire and stores are release, we just need to keep the compiler in line
+	inline u32 
+	atomic_load_acquire_32(volatile u32 *a) {
+		u32 value = *a;
+		_ReadWriteBarrier();
+		return value;
+	}
+	inline u64 
+	atomic_load_acquire_64(volatile u64 *a) {
+		u64 value = *a;
+		_ReadWriteBarrier();
+		return value;
+	}
+	inline void 
+	atomic_store_release_32(volatile u32 *a, u32 value) {
+		_ReadWriteBarrier();
+		*a = value;
+	}
+	inline void 
+	atomic_store_release_64(volatile u64 *a, u64 value) {
+		_ReadWriteBarrier();
+		*a = value;
+	}
+	
+	// Undefined for x == 0
+	inline u32 
+	count_trailing_zeros_32(u32 x) {
+		unsigned long index;
+		_BitScanForward(&index, x);
+		return (u32)index;
+	}
+	inline u32 
+	count_set_bits_32(u32 x) {
+		return (u32)__popcnt(x);
+	}
+	
 	#define thread_local __declspec(thread)
 	
 	#define SHARED_EXPORT __declspec(dllexport)
@@ -116,16 +166,9 @@ typedef struct Cpu_Capabilities {
 	#define inline __attribute__((always_inline)) inline
 	#define alignat(x) __attribute__((aligned(x)))	
     #define noreturn __attribute__((noreturn))
+    #define noinline __attribute__((noinline))
     #define COMPILER_HAS_MEMCPY_INTRINSICS 1
     
-    inline void noreturn
-    crash() {
-		__builtin_trap();
-		volatile int *a = 0;
-		*a = 5;
-		a = (int*)0xDEADBEEF;
-    	*a = 5;
-	}
 	
     inline u64 
     rdtsc() {
@@ -227,6 +270,51 @@ typedef struct Cpu_Capabilities {
 	
 	#define MEMORY_BARRIER {__asm__ __volatile__("" ::: "memory");__sync_synchronize();}
 	
+	// Returns the value before the add
+	inline u32 
+	atomic_fetch_add_32(volatile u32 *a, u32 value) {
+		return __atomic_fetch_add(a, value, __ATOMIC_SEQ_CST);
+	}
+	inline u64 
+	atomic_fetch_add_64(volatile u64 *a, u64 value) {
+		return __atomic_fetch_add(a, value, __ATOMIC_SEQ_CST);
+	}
+	// Returns the previous value
+	inline u32 
+	atomic_exchange_32(volatile u32 *a, u32 value) {
+		return __atomic_exchange_n(a, value, __ATOMIC_SEQ_CST);
+	}
+	inline u64 
+	atomic_exchange_64(volatile u64 *a, u64 value) {
+		return __atomic_exchange_n(a, value, __ATOMIC_SEQ_CST);
+	}
+	inline u32 
+	atomic_load_acquire_32(volatile u32 *a) {
+		return __atomic_load_n(a, __ATOMIC_ACQUIRE);
+	}
+	inline u64 
+	atomic_load_acquire_64(volatile u64 *a) {
+		return __atomic_load_n(a, __ATOMIC_ACQUIRE);
+	}
+	inline void 
+	atomic_store_release_32(volatile u32 *a, u32 value) {
+		__atomic_store_n(a, value, __ATOMIC_RELEASE);
+	}
+	inline void 
+	atomic_store_release_64(volatile u64 *a, u64 value) {
+		__atomic_store_n(a, value, __ATOMIC_RELEASE);
+	}
+	
+	// Undefined for x == 0
+	inline u32 
+	count_trailing_zeros_32(u32 x) {
+		return (u32)__builtin_ctz(x);
+	}
+	inline u32 
+	count_set_bits_32(u32 x) {
+		return (u32)__builtin_popcount(x);
+	}
+	
 	#define thread_local __thread
 	
 #if TARGET_OS == WINDOWS
@@ -239,6 +327,7 @@ typedef struct Cpu_Capabilities {
 	
 #else
 	#define inline inline
+	#define noinline
     #define COMPILER_HAS_MEMCPY_INTRINSICS 0
     
     inline u64 
@@ -253,9 +342,55 @@ typedef struct Cpu_Capabilities {
     
     #define MEMORY_BARRIER
     
+    inline u32 atomic_fetch_add_32(volatile u32 *a, u32 value) {u32 old = *a; *a += value; return old;}
+    inline u64 atomic_fetch_add_64(volatile u64 *a, u64 value) {u64 old = *a; *a += value; return old;}
+    inline u32 atomic_exchange_32(volatile u32 *a, u32 value) {u32 old = *a; *a = value; return old;}
+    inline u64 atomic_exchange_64(volatile u64 *a, u64 value) {u64 old = *a; *a = value; return old;}
+    inline u32 atomic_load_acquire_32(volatile u32 *a) {return *a;}
+    inline u64 atomic_load_acquire_64(volatile u64 *a) {return *a;}
+    inline void atomic_store_release_32(volatile u32 *a, u32 value) {*a = value;}
+    inline void atomic_store_release_64(volatile u64 *a, u64 value) {*a = value;}
+    
+    inline u32 count_trailing_zeros_32(u32 x) {u32 n = 0; while (!(x & 1)) { x >>= 1; n += 1; } return n;}
+    inline u32 count_set_bits_32(u32 x) {u32 n = 0; while (x) { x &= x-1; n += 1; } return n;}
+    
     #warning "Compiler is not explicitly supported, some things will probably not work as expected"
 #endif
 
+#if OOGABOOGA_LINK_EXTERNAL_INSTANCE
+    #define ogb_instance SHARED_IMPORT extern
+#elif OOGABOOGA_BUILD_SHARED_LIBRARY
+    #define ogb_instance SHARED_EXPORT
+#else
+    #define ogb_instance
+#endif
+
+// Defined in base.c. Called by crash() so buffered output can be flushed before we go down.
+ogb_instance void
+run_crash_hooks();
+
+#if COMPILER_MVSC
+    inline void 
+    crash() noreturn {
+		run_crash_hooks();
+		__debugbreak();
+		volatile int *a = 0;
+		*a = 5;
+		a = (volatile int*)0xDEADBEEF;
+    	*a = 5;
+	}
+#elif COMPILER_GCC || COMPILER_CLANG
+    inline void noreturn
+    crash() {
+		run_crash_hooks();
+		__builtin_trap();
+		volatile int *a = 0;
+		*a = 5;
+		a = (int*)0xDEADBEEF;
+    	*a = 5;
+	}
+#endif
+
 
 
 Cpu_Capabilities 
@@ -278,6 +413,12 @@ query_cpu_capabilities() {
     result.avx2 = (ext_info.ebx & (1 << 5)) != 0;
     
     result.avx512 = (ext_info.ebx & (1 << 16)) != 0;
+    
+    Cpu_Info_X86 max_ext_info = cpuid(0x80000000);
+    if (max_ext_info.eax >= 0x80000007) {
+    	Cpu_Info_X86 power_info = cpuid(0x80000007);
+    	result.invariant_tsc = (power_info.edx & (1 << 8)) != 0;
+    }
 
     return result;
 }
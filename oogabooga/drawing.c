@@ -14,10 +14,30 @@
 	Draw_Quad *draw_quad_projected(Draw_Quad quad, Matrix4 world_to_clip);
 	Draw_Quad *draw_quad(Draw_Quad quad);
 	Draw_Quad *draw_quad_xform(Draw_Quad quad, Matrix4 xform);
+	u64 draw_rects_batch(Vector2 *positions, Vector2 *sizes, Vector4 *colors, u64 count);
+	u64 draw_circles_batch(Vector2 *positions, Vector2 *sizes, Vector4 *colors, u64 count);
+	u64 draw_images_batch(Gfx_Image *image, Vector2 *positions, Vector2 *sizes, Vector4 *colors, u64 count);
+	u64 draw_rects_batch_strided(Draw_Quad base, Vector2 *positions, Vector2 *sizes, Vector4 *colors, u64 stride, u64 count);
+	u64 draw_quads_batch(Draw_Quad *quads, Matrix4 *xforms, u64 count);
+	Matrix4 get_world_to_clip();
+	Matrix4 get_clip_to_world();
+	void draw_frame_flush_pending_quad();
+	Draw_Quad unpack_draw_quad(Draw_Quad_Packed *p);
+	void sort_draw_quads_for_batching(Draw_Quad_Packed *quads, Draw_Quad_Packed *out, u64 count);
+	u64 generate_quad_vertices(Draw_Quad_Packed *quads, u64 count, Vertex_2D *vertices, Vertex_2D_Batch **batches);
+	bool static_batch_needs_recording(Static_Batch *batch);
+	void static_batch_mark_dirty(Static_Batch *batch);
+	void static_batch_begin(Static_Batch *batch);
+	void static_batch_end(Static_Batch *batch);
+	void static_batch_destroy(Static_Batch *batch);
+	u64 draw_static_batch(Static_Batch *batch, Matrix4 xform);
 	void draw_text_xform(Gfx_Font *font, string text, u32 raster_height, Matrix4 xform, Vector2 scale, Vector4 color);
 	void draw_text(Gfx_Font *font, string text, u32 raster_height, Vector2 position, Vector2 scale, Vector4 color);
 	Gfx_Text_Metrics draw_text_and_measure(Gfx_Font *font, string text, u32 raster_height, Vector2 position, Vector2 scale, Vector4 color);
 	void draw_line(Vector2 p0, Vector2 p1, float line_width, Vector4 color);
+	
+	The Draw_Quad pointer returned by draw_xxx functions is only valid until the next draw call,
+	so modify it right away (uv, image, userdata, ...) and copy it if you need it for later.
 */
 
 // We use radix sort so the exact bit count is of importance
@@ -26,6 +46,12 @@
 #define Z_STACK_MAX 4096
 #define SCISSOR_STACK_MAX 4096
 
+// Open addressing tables used to deduplicate images & uvs within a frame. If a lookup
+// probes too far we just add a duplicate, so these only need to fit the common case.
+#define DRAW_IMAGE_LOOKUP_COUNT 1024 // Must be a power of two
+#define DRAW_UV_LOOKUP_COUNT 4096 // Must be a power of two
+#define DRAW_LOOKUP_MAX_PROBES 16
+
 typedef struct Draw_Quad {
 	// BEWARE !! These are in ndc
 	Vector2 bottom_left, top_left, top_right, bottom_right;
@@ -45,7 +71,23 @@ typedef struct Draw_Quad {
 	
 } Draw_Quad;
 
+// What the draw frame actually stores per quad, about half the size of a Draw_Quad.
+// Images, uvs, scissors and userdata are mostly shared between many quads so they live in
+// side tables in Draw_Frame and are referenced by index. See unpack_draw_quad().
+typedef struct Draw_Quad_Packed {
+	// ndc, same order as in Draw_Quad
+	Vector2 bottom_left, top_left, top_right, bottom_right;
+	u32 color; // 8 bits per channel, r in the lowest byte. Clamped to 0-1.
+	s32 z;
+	u32 uv; // Index into draw_frame.uvs, only meaningful if texture != 0
+	u32 userdata; // 0 if all zero, otherwise index+1 into draw_frame.userdata
+	u16 texture; // 0 if no image, otherwise index+1 into draw_frame.images
+	u16 scissor; // 0 if no scissor, otherwise index+1 into draw_frame.scissors
+	u8 type;
+	u8 sampler; // image_min_filter | (image_mag_filter << 1)
+} Draw_Quad_Packed;
 
+typedef struct Static_Batch Static_Batch;
 
 typedef struct Draw_Frame {
 	Matrix4 projection;
@@ -54,16 +96,45 @@ typedef struct Draw_Frame {
 		Matrix4 camera_xform;
 	};
 	
+	// projection * inverse(camera_xform) and its inverse, see get_world_to_clip().
+	// Recomputed when projection or camera_xform differ from the copies they were made from.
+	Matrix4 world_to_clip;
+	Matrix4 clip_to_world;
+	Matrix4 world_to_clip_projection;
+	Matrix4 world_to_clip_camera_xform;
+	bool world_to_clip_valid;
+	
 	void *cbuffer;
 	
 	u64 scissor_count;
 	Vector4 scissor_stack[SCISSOR_STACK_MAX];
 	
-	Draw_Quad *quad_buffer;
+	Draw_Quad_Packed *quad_buffer;
+	
+	// Side tables for quad_buffer, growing arrays which are cleared every frame
+	Gfx_Image **images;
+	Vector4 *uvs;
+	Vector4 *scissors;
+	Vector4 *userdata; // VERTEX_2D_USER_DATA_COUNT per entry
+	u16 image_lookup[DRAW_IMAGE_LOOKUP_COUNT]; // index+1 into images
+	u32 uv_lookup[DRAW_UV_LOOKUP_COUNT]; // index+1 into uvs
+	
+	// The last quad returned from a draw_xxx call. It's packed into quad_buffer on the next
+	// draw call, so the pointer you get from draw_xxx is only valid until then.
+	Draw_Quad pending_quad;
+	bool has_pending_quad;
+	
+	// Set between static_batch_begin() and static_batch_end()
+	Static_Batch *recording_batch;
 	
 	u64 z_count;
 	s32 z_stack[Z_STACK_MAX];
 	bool enable_z_sorting;
+	// Also sort by texture, type & sampler within each z layer so fewer draw calls are needed.
+	// Quads that overlap are still drawn in the order they were submitted, so blending looks
+	// the same, only quads that don't overlap are batched together. See
+	// sort_draw_quads_for_batching(). Implies enable_z_sorting.
+	bool enable_batch_sorting;
 	
 } Draw_Frame;
 
@@ -81,14 +152,30 @@ void reset_draw_frame(Draw_Frame *frame) {
 	// I would like to try to have the quad buffer to be allocated in a growing arena
 	// which is reset every frames, like temp allocator but large enough to fit the
 	// highest number of quads the program submits in a frame.
-	// For now, we just reset the count in the heap allocated buffer
-
-	Draw_Quad *quad_buffer = frame->quad_buffer;
-	if (quad_buffer) growing_array_clear((void**)&quad_buffer);
+	// For now, we just reset the count in the heap allocated buffers
+	
+	assert(!frame->recording_batch, "Frame was reset while recording a static batch, call static_batch_end() first");
+	
+	Draw_Quad_Packed *quad_buffer = frame->quad_buffer;
+	Gfx_Image **images = frame->images;
+	Vector4 *uvs = frame->uvs;
+	Vector4 *scissors = frame->scissors;
+	Vector4 *userdata = frame->userdata;
+	if (quad_buffer) {
+		growing_array_clear((void**)&quad_buffer);
+		growing_array_clear((void**)&images);
+		growing_array_clear((void**)&uvs);
+		growing_array_clear((void**)&scissors);
+		growing_array_clear((void**)&userdata);
+	}
 
 	*frame = (Draw_Frame){0};
 	
 	frame->quad_buffer = quad_buffer;
+	frame->images = images;
+	frame->uvs = uvs;
+	frame->scissors = scissors;
+	frame->userdata = userdata;
 	
 	float32 aspect = (float32)window.width/(float32)window.height;
 	
@@ -118,12 +205,543 @@ void pop_window_scissor() {
 	draw_frame.scissor_count -= 1;
 }
 
+void _draw_frame_init_buffers() {
+	if (draw_frame.quad_buffer) return;
+	
+	// #Memory
+	// Use an arena
+	growing_array_init((void**)&draw_frame.quad_buffer, sizeof(Draw_Quad_Packed), get_heap_allocator());
+	growing_array_init((void**)&draw_frame.images, sizeof(Gfx_Image*), get_heap_allocator());
+	growing_array_init((void**)&draw_frame.uvs, sizeof(Vector4), get_heap_allocator());
+	growing_array_init((void**)&draw_frame.scissors, sizeof(Vector4), get_heap_allocator());
+	growing_array_init((void**)&draw_frame.userdata, sizeof(Vector4)*VERTEX_2D_USER_DATA_COUNT, get_heap_allocator());
+}
+
+inline u32 _draw_pack_color(Vector4 c) {
+	u32 r = (u32)(clamp(c.r, 0.0f, 1.0f)*255.0f + 0.5f);
+	u32 g = (u32)(clamp(c.g, 0.0f, 1.0f)*255.0f + 0.5f);
+	u32 b = (u32)(clamp(c.b, 0.0f, 1.0f)*255.0f + 0.5f);
+	u32 a = (u32)(clamp(c.a, 0.0f, 1.0f)*255.0f + 0.5f);
+	return r | (g << 8) | (b << 16) | (a << 24);
+}
+inline Vector4 _draw_unpack_color(u32 c) {
+	const float32 s = 1.0f/255.0f;
+	return v4((float32)(c & 0xFF)*s, (float32)((c >> 8) & 0xFF)*s, (float32)((c >> 16) & 0xFF)*s, (float32)(c >> 24)*s);
+}
+
+u16 _draw_intern_image(Gfx_Image *image) {
+	u64 mask = DRAW_IMAGE_LOOKUP_COUNT-1;
+	u64 slot = pointer_get_hash(image) & mask;
+	for (u64 probe = 0; probe < DRAW_LOOKUP_MAX_PROBES; probe++) {
+		u16 index = draw_frame.image_lookup[slot];
+		if (index == 0) break;
+		if (draw_frame.images[index-1] == image) return index;
+		slot = (slot+1) & mask;
+	}
+	
+	u64 count = growing_array_get_valid_count(draw_frame.images);
+	assert(count < 0xFFFF, "Too many different images drawn in one frame, max is %d", 0xFFFF-1);
+	growing_array_add((void**)&draw_frame.images, &image);
+	
+	// Slot is either free or the one after the last probe, which we just evict
+	draw_frame.image_lookup[slot] = (u16)(count+1);
+	return (u16)(count+1);
+}
+u32 _draw_intern_uv(Vector4 uv) {
+	u64 mask = DRAW_UV_LOOKUP_COUNT-1;
+	u64 slot = (xx_hash(*(u64*)&uv.x1) ^ (xx_hash(*(u64*)&uv.x2) * 31)) & mask;
+	for (u64 probe = 0; probe < DRAW_LOOKUP_MAX_PROBES; probe++) {
+		u32 index = draw_frame.uv_lookup[slot];
+		if (index == 0) break;
+		if (memcmp(&draw_frame.uvs[index-1], &uv, sizeof(Vector4)) == 0) return index-1;
+		slot = (slot+1) & mask;
+	}
+	
+	u64 count = growing_array_get_valid_count(draw_frame.uvs);
+	growing_array_add((void**)&draw_frame.uvs, &uv);
+	
+	draw_frame.uv_lookup[slot] = (u32)(count+1);
+	return (u32)count;
+}
+u16 _draw_intern_scissor(Vector4 scissor) {
+	// Quads with a scissor almost always come in runs of the same one from the stack
+	u64 count = growing_array_get_valid_count(draw_frame.scissors);
+	if (count > 0 && memcmp(&draw_frame.scissors[count-1], &scissor, sizeof(Vector4)) == 0) {
+		return (u16)count;
+	}
+	
+	assert(count < 0xFFFF, "Too many different scissors in one frame, max is %d", 0xFFFF-1);
+	growing_array_add((void**)&draw_frame.scissors, &scissor);
+	return (u16)(count+1);
+}
+u32 _draw_intern_userdata(Vector4 *userdata) {
+	// Most quads don't use userdata so we don't even store it unless it's set
+	u64 *words = (u64*)userdata;
+	u64 any = 0;
+	for (u64 i = 0; i < sizeof(Vector4)*VERTEX_2D_USER_DATA_COUNT/sizeof(u64); i++) any |= words[i];
+	if (any == 0) return 0;
+	
+	growing_array_add((void**)&draw_frame.userdata, userdata);
+	return growing_array_get_valid_count(draw_frame.userdata);
+}
+
+// Everything except corners, z & scissor
+void _draw_pack_quad_attributes(Draw_Quad *q, Draw_Quad_Packed *p) {
+	p->color = _draw_pack_color(q->color);
+	p->type = q->type;
+	p->sampler = (u8)(q->image_min_filter | (q->image_mag_filter << 1));
+	p->texture = 0;
+	p->uv = 0;
+	if (q->image) {
+		p->texture = _draw_intern_image(q->image);
+		p->uv = _draw_intern_uv(q->uv);
+	}
+	p->userdata = _draw_intern_userdata(q->userdata);
+}
+
+// Packs the quad returned by the last draw call into quad_buffer. This needs to happen
+// before anything reads quad_buffer, draw calls and gfx_update take care of that.
+void draw_frame_flush_pending_quad() {
+	if (!draw_frame.has_pending_quad) return;
+	draw_frame.has_pending_quad = false;
+	
+	_draw_frame_init_buffers();
+	
+	Draw_Quad *q = &draw_frame.pending_quad;
+	Draw_Quad_Packed *p = (Draw_Quad_Packed*)growing_array_add_empty((void**)&draw_frame.quad_buffer);
+	
+	p->bottom_left  = q->bottom_left;
+	p->top_left     = q->top_left;
+	p->top_right    = q->top_right;
+	p->bottom_right = q->bottom_right;
+	p->z = q->z;
+	p->scissor = q->has_scissor ? _draw_intern_scissor(q->scissor) : 0;
+	_draw_pack_quad_attributes(q, p);
+}
+
+// For reading quads back out of draw_frame.quad_buffer. Colors come back quantized to 8 bits.
+Draw_Quad unpack_draw_quad(Draw_Quad_Packed *p) {
+	Draw_Quad q = ZERO(Draw_Quad);
+	q.bottom_left  = p->bottom_left;
+	q.top_left     = p->top_left;
+	q.top_right    = p->top_right;
+	q.bottom_right = p->bottom_right;
+	q.color = _draw_unpack_color(p->color);
+	q.z = p->z;
+	q.type = p->type;
+	q.image_min_filter = (Gfx_Filter_Mode)(p->sampler & 1);
+	q.image_mag_filter = (Gfx_Filter_Mode)((p->sampler >> 1) & 1);
+	if (p->texture) {
+		q.image = draw_frame.images[p->texture-1];
+		q.uv = draw_frame.uvs[p->uv];
+	}
+	if (p->scissor) {
+		q.has_scissor = true;
+		q.scissor = draw_frame.scissors[p->scissor-1];
+	}
+	if (p->userdata) {
+		memcpy(q.userdata, &draw_frame.userdata[(p->userdata-1)*VERTEX_2D_USER_DATA_COUNT], sizeof(q.userdata));
+	}
+	return q;
+}
+
+// Texture (the only thing that can force a new draw call), then type & sampler. Quads with
+// the same batch key can go in the same draw call.
+#define DRAW_BATCH_KEY_BITS 24
+inline u32 get_draw_quad_batch_key(Draw_Quad_Packed *q) {
+	return ((u32)q->texture << 8) | ((u32)(q->type & 0x3F) << 2) | (u32)(q->sampler & 3);
+}
+
+// Reordering quads only changes the picture where they overlap (blending isn't commutative),
+// so each quad gets a level: at least the level of every earlier quad it overlaps on the same
+// z layer, and one more if that quad has another batch key. Sorting by (z, level, batch key)
+// then keeps quads that overlap in submission order, while the rest are free to batch up.
+// Overlaps are looked up in a grid over ndc. Cells only remember the last few quads exactly,
+// so in crowded spots quads may be kept in order even if they don't quite overlap. This pass
+// is serial and costs a few times as much as the sort when lots of quads overlap.
+#define DRAW_BATCH_GRID_SIZE 32
+#define DRAW_BATCH_CELL_CAPACITY 8
+#define DRAW_BATCH_KEY_MIXED 0xFFFFFFFF
+
+typedef struct Draw_Batch_Cell_Entry {
+	float32 min_x, min_y, max_x, max_y;
+	s32 z;
+	u32 level;
+	u32 key;
+} Draw_Batch_Cell_Entry;
+
+typedef struct Draw_Batch_Cell {
+	u32 count;
+	// Entries that didn't fit are folded into this, as if they overlapped everything in the
+	// cell. key is DRAW_BATCH_KEY_MIXED if quads with different keys have the top level.
+	bool has_folded;
+	u32 folded_level;
+	u32 folded_key;
+} Draw_Batch_Cell;
+
+// #Global
+Radix_Sort_Pair *_draw_sort_pairs = 0;
+u64 _draw_sort_pairs_capacity = 0;
+Draw_Batch_Cell *_draw_batch_cells = 0;
+Draw_Batch_Cell_Entry *_draw_batch_cell_entries = 0;
+
+void _draw_batch_cell_fold(Draw_Batch_Cell *cell, u32 level, u32 key) {
+	if (!cell->has_folded || level > cell->folded_level) {
+		cell->has_folded = true;
+		cell->folded_level = level;
+		cell->folded_key = key;
+	} else if (level == cell->folded_level && key != cell->folded_key) {
+		cell->folded_key = DRAW_BATCH_KEY_MIXED;
+	}
+}
+
+inline s64 _draw_batch_grid_coordinate(float32 ndc) {
+	float32 x = (clamp(ndc, -1.0f, 1.0f)+1.0f)*0.5f*(float32)DRAW_BATCH_GRID_SIZE;
+	return min((s64)x, DRAW_BATCH_GRID_SIZE-1);
+}
+
+// Writes the level of each quad to levels and returns the highest one
+u32 _draw_assign_batch_levels(Draw_Quad_Packed *quads, u64 count, u32 *levels) {
+	if (!_draw_batch_cells) {
+		// #Memory #Heapalloc
+		_draw_batch_cells = (Draw_Batch_Cell*)alloc(get_heap_allocator(), DRAW_BATCH_GRID_SIZE*DRAW_BATCH_GRID_SIZE*sizeof(Draw_Batch_Cell));
+		_draw_batch_cell_entries = (Draw_Batch_Cell_Entry*)alloc(get_heap_allocator(), DRAW_BATCH_GRID_SIZE*DRAW_BATCH_GRID_SIZE*DRAW_BATCH_CELL_CAPACITY*sizeof(Draw_Batch_Cell_Entry));
+	}
+	memset(_draw_batch_cells, 0, DRAW_BATCH_GRID_SIZE*DRAW_BATCH_GRID_SIZE*sizeof(Draw_Batch_Cell));
+	
+	u32 max_level = 0;
+	for (u64 i = 0; i < count; i++) {
+		Draw_Quad_Packed *q = &quads[i];
+		Draw_Batch_Cell_Entry e;
+		e.min_x = min(min(q->bottom_left.x, q->top_left.x), min(q->top_right.x, q->bottom_right.x));
+		e.min_y = min(min(q->bottom_left.y, q->top_left.y), min(q->top_right.y, q->bottom_right.y));
+		e.max_x = max(max(q->bottom_left.x, q->top_left.x), max(q->top_right.x, q->bottom_right.x));
+		e.max_y = max(max(q->bottom_left.y, q->top_left.y), max(q->top_right.y, q->bottom_right.y));
+		e.z = q->z;
+		e.key = get_draw_quad_batch_key(q);
+		e.level = 0;
+		
+		s64 x0 = _draw_batch_grid_coordinate(e.min_x);
+		s64 x1 = _draw_batch_grid_coordinate(e.max_x);
+		s64 y0 = _draw_batch_grid_coordinate(e.min_y);
+		s64 y1 = _draw_batch_grid_coordinate(e.max_y);
+		
+		for (s64 y = y0; y <= y1; y++) {
+			for (s64 x = x0; x <= x1; x++) {
+				u64 cell_index = (u64)(y*DRAW_BATCH_GRID_SIZE + x);
+				Draw_Batch_Cell *cell = &_draw_batch_cells[cell_index];
+				if (cell->has_folded) {
+					e.level = max(e.level, cell->folded_level + (cell->folded_key != e.key ? 1 : 0));
+				}
+				Draw_Batch_Cell_Entry *entries = &_draw_batch_cell_entries[cell_index*DRAW_BATCH_CELL_CAPACITY];
+				for (u32 j = 0; j < cell->count; j++) {
+					Draw_Batch_Cell_Entry *other = &entries[j];
+					// Quads that only share an edge don't overlap. Branchless since whether
+					// quads overlap is about as predictable as a coin flip.
+					bool overlap = (other->z == e.z)
+						& (other->min_x < e.max_x) & (e.min_x < other->max_x)
+						& (other->min_y < e.max_y) & (e.min_y < other->max_y);
+					u32 level = overlap ? other->level + (other->key != e.key) : 0;
+					e.level = max(e.level, level);
+				}
+			}
+		}
+		
+		for (s64 y = y0; y <= y1; y++) {
+			for (s64 x = x0; x <= x1; x++) {
+				u64 cell_index = (u64)(y*DRAW_BATCH_GRID_SIZE + x);
+				Draw_Batch_Cell *cell = &_draw_batch_cells[cell_index];
+				Draw_Batch_Cell_Entry *entries = &_draw_batch_cell_entries[cell_index*DRAW_BATCH_CELL_CAPACITY];
+				if (cell->count == DRAW_BATCH_CELL_CAPACITY) {
+					for (u32 j = 0; j < cell->count; j++) {
+						_draw_batch_cell_fold(cell, entries[j].level, entries[j].key);
+					}
+					cell->count = 0;
+				}
+				entries[cell->count] = e;
+				cell->count += 1;
+			}
+		}
+		
+		levels[i] = e.level;
+		max_level = max(max_level, e.level);
+	}
+	return max_level;
+}
+
+// Writes quads to out sorted by z, then level and batch key (see _draw_assign_batch_levels()).
+// Only the (key, index) pairs move around in the radix sort, each quad is copied once at the end.
+void sort_draw_quads_for_batching(Draw_Quad_Packed *quads, Draw_Quad_Packed *out, u64 count) {
+	if (count > _draw_sort_pairs_capacity) {
+		// #Memory #Heapalloc
+		if (_draw_sort_pairs) dealloc(get_heap_allocator(), _draw_sort_pairs);
+		_draw_sort_pairs_capacity = get_next_power_of_two(count);
+		_draw_sort_pairs = (Radix_Sort_Pair*)alloc(get_heap_allocator(), _draw_sort_pairs_capacity*2*sizeof(Radix_Sort_Pair));
+	}
+	Radix_Sort_Pair *pairs = _draw_sort_pairs;
+	Radix_Sort_Pair *help_buffer = _draw_sort_pairs + _draw_sort_pairs_capacity;
+	
+	// The levels go in the help buffer until the keys are made
+	u32 *levels = (u32*)help_buffer;
+	u32 max_level = _draw_assign_batch_levels(quads, count, levels);
+	u64 level_bits = 0;
+	while (level_bits < 32 && ((u64)1 << level_bits) <= max_level) level_bits += 1;
+	
+	// The sort is stable, so if there are too many levels to fit in the key we can still
+	// sort by z alone and keep the submission order.
+	bool reorder = MAX_Z_BITS + level_bits + DRAW_BATCH_KEY_BITS <= 64;
+	u64 number_of_bits = reorder ? MAX_Z_BITS + level_bits + DRAW_BATCH_KEY_BITS : MAX_Z_BITS;
+	
+	for (u64 i = 0; i < count; i++) {
+		u64 z = (u64)(quads[i].z + MAX_Z - 1); // 0 to (1 << MAX_Z_BITS)-1
+		if (reorder) {
+			pairs[i].key = (z << (level_bits + DRAW_BATCH_KEY_BITS)) | ((u64)levels[i] << DRAW_BATCH_KEY_BITS) | get_draw_quad_batch_key(&quads[i]);
+		} else {
+			pairs[i].key = z;
+		}
+		pairs[i].index = i;
+	}
+	
+	radix_sort_pairs_parallel(pairs, help_buffer, count, number_of_bits);
+	
+	for (u64 i = 0; i < count; i++) {
+		out[i] = quads[pairs[i].index];
+	}
+}
+
+// Quads per parallel_for batch in generate_quad_vertices(). Each quad is 6 vertices, so this
+// is about 3mb of vertices per job.
+#define DRAW_VERTEX_GENERATION_BATCH_SIZE 4096
+
+// #Global
+s8 *_draw_texture_indices = 0;
+u64 _draw_texture_indices_capacity = 0;
+
+typedef struct Draw_Vertex_Generation {
+	Draw_Quad_Packed *quads;
+	s8 *texture_indices;
+	Vertex_2D *vertices;
+	
+	float32 pixel_width;
+	float32 pixel_height;
+	bool odd_width;
+	bool odd_height;
+	float32 scissor_flip_height;
+} Draw_Vertex_Generation;
+
+// Gives each quad a texture slot. When all VERTEX_2D_MAX_TEXTURES slots are taken a new batch
+// is started, which means another draw call. This part depends on the quads before it so
+// it's done on the calling thread, but it only looks at texture handles.
+void _draw_assign_texture_slots(Draw_Quad_Packed *quads, u64 count, s8 *texture_indices, Vertex_2D_Batch **batches) {
+	Vertex_2D_Batch *batch = (Vertex_2D_Batch*)growing_array_add_empty((void**)batches);
+	*batch = ZERO(Vertex_2D_Batch);
+	
+	Gfx_Handle last_texture = GFX_INVALID_HANDLE;
+	s8 last_texture_index = -1;
+	
+	for (u64 i = 0; i < count; i++) {
+		Draw_Quad_Packed *q = &quads[i];
+		
+		assert(q->z <= MAX_Z, "Z is too high. Z is %d, Max is %d.", q->z, MAX_Z);
+		assert(q->z >= (-MAX_Z+1), "Z is too low. Z is %d, Min is %d.", q->z, -MAX_Z+1);
+		
+		s8 texture_index = -1;
+		if (q->texture) {
+			Gfx_Handle texture = draw_frame.images[q->texture-1]->gfx_handle;
+			
+			if (last_texture_index >= 0 && last_texture == texture) {
+				texture_index = last_texture_index;
+			} else {
+				// First look if texture is already bound
+				for (u64 j = 0; j < batch->texture_count; j++) {
+					if (batch->textures[j] == texture) {
+						texture_index = (s8)j;
+						break;
+					}
+				}
+				// Otherwise use a new slot
+				if (texture_index <= -1) {
+					if (batch->texture_count >= VERTEX_2D_MAX_TEXTURES) {
+						// Max textures reached, the rest goes in a new draw call
+						batch->quad_count = i - batch->first_quad;
+						batch = (Vertex_2D_Batch*)growing_array_add_empty((void**)batches);
+						*batch = ZERO(Vertex_2D_Batch);
+						batch->first_quad = i;
+					}
+					texture_index = (s8)batch->texture_count;
+					batch->textures[texture_index] = texture;
+					batch->texture_count += 1;
+				}
+			}
+			last_texture = texture;
+			last_texture_index = texture_index;
+		}
+		texture_indices[i] = texture_index;
+	}
+	
+	batch->quad_count = count - batch->first_quad;
+}
+
+void _draw_generate_vertices_proc(u64 first, u64 end, void *userdata) {
+	Draw_Vertex_Generation *gen = (Draw_Vertex_Generation*)userdata;
+	
+	// q->sampler is min | mag << 1, the samplers are bound as
+	// 0: nearest/nearest, 1: linear/linear, 2: linear/nearest, 3: nearest/linear
+	const u8 samplers[4] = { 0, 2, 3, 1 };
+	
+	for (u64 i = first; i < end; i++) {
+		Draw_Quad_Packed *q = &gen->quads[i];
+		
+		// Everything that is the same for all corners
+		Vertex_2D v = ZERO(Vertex_2D);
+		v.color = _draw_unpack_color(q->color);
+		v.texture_index = gen->texture_indices[i];
+		v.type = q->type;
+		if (q->userdata) {
+			memcpy(v.userdata, &draw_frame.userdata[(q->userdata-1)*VERTEX_2D_USER_DATA_COUNT], sizeof(v.userdata));
+		}
+		if (q->scissor) {
+			// Flip to top-down pixels
+			Vector4 s = draw_frame.scissors[q->scissor-1];
+			v.scissor = v4(s.x1, gen->scissor_flip_height - s.y2, s.x2, gen->scissor_flip_height - s.y1);
+			v.has_scissor = 1;
+		}
+		
+		Vector4 uv = ZERO(Vector4);
+		if (q->texture) {
+			Gfx_Image *image = draw_frame.images[q->texture-1];
+			uv = draw_frame.uvs[q->uv];
+			// #Hack #Bug #Cleanup
+			// When a window dimension is uneven it slightly under/oversamples on an axis by a
+			// seemingly arbitrary amount. The 0.25 is a magic value I got from trial and error.
+			// (It undersamples by a fourth of the atlas texture?)
+			// Anything > 0.25 < will slightly over/undersample on my machine.
+			// I have no idea about #Portability here.
+			// - Charlie M 26th July 2024
+			if (gen->odd_width) {
+				uv.x1 += (2.0/(float)image->width)*0.25;
+				uv.x2 += (2.0/(float)image->width)*0.25;
+			}
+			if (gen->odd_height) {
+				uv.y1 -= (2.0/(float)image->height)*0.25;
+				uv.y2 -= (2.0/(float)image->height)*0.25;
+			}
+			v.sampler = samplers[q->sampler & 3];
+		}
+		
+		// This is meant to fix the annoying artifacts that shows up when sampling from a large atlas
+		// presumably for floating point precision issues or something.
+		
+		// #Incomplete
+		// If we want to animate text with small movements then it will look wonky.
+		// This should be optional probably.
+		float pw = gen->pixel_width;
+		float ph = gen->pixel_height;
+		
+		// We will write to 6 vertices for the one quad (two tris)
+		Vertex_2D *BL  = &gen->vertices[i*6 + 0];
+		Vertex_2D *TL  = &gen->vertices[i*6 + 1];
+		Vertex_2D *TR  = &gen->vertices[i*6 + 2];
+		Vertex_2D *BL2 = &gen->vertices[i*6 + 3];
+		Vertex_2D *TR2 = &gen->vertices[i*6 + 4];
+		Vertex_2D *BR  = &gen->vertices[i*6 + 5];
+		
+		*BL = *TL = *TR = *BR = v;
+		
+		BL->position = v4(round(q->bottom_left.x  / pw) * pw, round(q->bottom_left.y  / ph) * ph, 0, 1);
+		TL->position = v4(round(q->top_left.x     / pw) * pw, round(q->top_left.y     / ph) * ph, 0, 1);
+		TR->position = v4(round(q->top_right.x    / pw) * pw, round(q->top_right.y    / ph) * ph, 0, 1);
+		BR->position = v4(round(q->bottom_right.x / pw) * pw, round(q->bottom_right.y / ph) * ph, 0, 1);
+		
+		BL->uv = v2(uv.x1, uv.y1);
+		TL->uv = v2(uv.x1, uv.y2);
+		TR->uv = v2(uv.x2, uv.y2);
+		BR->uv = v2(uv.x2, uv.y1);
+		
+		BL->self_uv = v2(0, 0);
+		TL->self_uv = v2(0, 1);
+		TR->self_uv = v2(1, 1);
+		BR->self_uv = v2(1, 0);
+		
+		*BL2 = *BL;
+		*TR2 = *TR;
+	}
+}
+
+// Turns quads into triangles for the renderer, which then only needs to upload vertices
+// and make one draw call per batch. vertices needs room for count*6. batches is a growing
+// array which is cleared first (and initialized if 0). Returns the number of batches.
+// The vertex expansion is split over the job workers with parallel_for.
+u64 generate_quad_vertices(Draw_Quad_Packed *quads, u64 count, Vertex_2D *vertices, Vertex_2D_Batch **batches) {
+	if (*batches) growing_array_clear((void**)batches);
+	else growing_array_init((void**)batches, sizeof(Vertex_2D_Batch), get_heap_allocator());
+	
+	if (count == 0) return 0;
+	
+	if (count > _draw_texture_indices_capacity) {
+		// #Memory #Heapalloc
+		if (_draw_texture_indices) dealloc(get_heap_allocator(), _draw_texture_indices);
+		_draw_texture_indices_capacity = get_next_power_of_two(count);
+		_draw_texture_indices = (s8*)alloc(get_heap_allocator(), _draw_texture_indices_capacity);
+	}
+	
+	_draw_assign_texture_slots(quads, count, _draw_texture_indices, batches);
+	
+	Draw_Vertex_Generation gen = ZERO(Draw_Vertex_Generation);
+	gen.quads = quads;
+	gen.texture_indices = _draw_texture_indices;
+	gen.vertices = vertices;
+	gen.pixel_width = 2.0/(float)window.width;
+	gen.pixel_height = 2.0/(float)window.height;
+	gen.odd_width = window.width % 2 != 0;
+	gen.odd_height = window.height % 2 != 0;
+	gen.scissor_flip_height = (float32)window.pixel_height;
+	
+	parallel_for(count, DRAW_VERTEX_GENERATION_BATCH_SIZE, _draw_generate_vertices_proc, &gen);
+	
+	return growing_array_get_valid_count(*batches);
+}
+
+// Projection and camera are set by assigning the fields directly, so instead of setters we
+// compare against the matrices the cache was made from. That's two 64 byte compares per
+// quad instead of a 4x4 inverse and multiply.
+void _update_world_to_clip() {
+	if (draw_frame.world_to_clip_valid
+	 && memcmp(&draw_frame.projection, &draw_frame.world_to_clip_projection, sizeof(Matrix4)) == 0
+	 && memcmp(&draw_frame.camera_xform, &draw_frame.world_to_clip_camera_xform, sizeof(Matrix4)) == 0) {
+		return;
+	}
+	
+	draw_frame.world_to_clip_projection = draw_frame.projection;
+	draw_frame.world_to_clip_camera_xform = draw_frame.camera_xform;
+	draw_frame.world_to_clip = m4_mul(draw_frame.projection, m4_inverse(draw_frame.camera_xform));
+	draw_frame.clip_to_world = m4_inverse(draw_frame.world_to_clip);
+	draw_frame.world_to_clip_valid = true;
+}
+Matrix4 get_world_to_clip() {
+	_update_world_to_clip();
+	return draw_frame.world_to_clip;
+}
+// For f.ex. mouse picking: ndc -> world
+Matrix4 get_clip_to_world() {
+	_update_world_to_clip();
+	return draw_frame.clip_to_world;
+}
+
+// Same as m4_transform(m, v4(p.x, p.y, 0, 1)).xy, without computing z & w we don't use
+inline Vector2 _draw_transform_point(Matrix4 m, Vector2 p) {
+	return v2(
+		m.m[0][0]*p.x + m.m[0][1]*p.y + m.m[0][3],
+		m.m[1][0]*p.x + m.m[1][1]*p.y + m.m[1][3]
+	);
+}
+
 Draw_Quad _nil_quad = {0};
 Draw_Quad *draw_quad_projected(Draw_Quad quad, Matrix4 world_to_clip) {
-	quad.bottom_left  = m4_transform(world_to_clip, v4(v2_expand(quad.bottom_left), 0, 1)).xy;
-	quad.top_left     = m4_transform(world_to_clip, v4(v2_expand(quad.top_left), 0, 1)).xy;
-	quad.top_right    = m4_transform(world_to_clip, v4(v2_expand(quad.top_right), 0, 1)).xy;
-	quad.bottom_right = m4_transform(world_to_clip, v4(v2_expand(quad.bottom_right), 0, 1)).xy;
+	quad.bottom_left  = _draw_transform_point(world_to_clip, quad.bottom_left);
+	quad.top_left     = _draw_transform_point(world_to_clip, quad.top_left);
+	quad.top_right    = _draw_transform_point(world_to_clip, quad.top_right);
+	quad.bottom_right = _draw_transform_point(world_to_clip, quad.bottom_right);
 	
 	bool should_cull = 
 	    (quad.bottom_left.x < -1 && quad.top_left.x < -1 && quad.top_right.x < -1 && quad.bottom_right.x < -1) ||
@@ -131,7 +749,8 @@ Draw_Quad *draw_quad_projected(Draw_Quad quad, Matrix4 world_to_clip) {
 	    (quad.bottom_left.y < -1 && quad.top_left.y < -1 && quad.top_right.y < -1 && quad.bottom_right.y < -1) ||
 	    (quad.bottom_left.y > 1 && quad.top_left.y > 1 && quad.top_right.y > 1 && quad.bottom_right.y > 1);
 
-	if (should_cull) {
+	// Static batches are culled when they're drawn
+	if (should_cull && !draw_frame.recording_batch) {
 		return &_nil_quad;
 	}
 	
@@ -150,28 +769,21 @@ Draw_Quad *draw_quad_projected(Draw_Quad quad, Matrix4 world_to_clip) {
 	
 	memset(quad.userdata, 0, sizeof(quad.userdata));
 	
-	if (!draw_frame.quad_buffer) {
-		// #Memory
-		// Use an arena
-		growing_array_init((void**)&draw_frame.quad_buffer, sizeof(Draw_Quad), get_heap_allocator());
-	}
-	
-	Draw_Quad **target_buffer = &draw_frame.quad_buffer;
+	// The caller may still modify the returned quad, so it's kept as is until the next draw
+	// call and packed into quad_buffer then.
+	draw_frame_flush_pending_quad();
 	
-	growing_array_add((void**)target_buffer, &quad);
+	draw_frame.pending_quad = quad;
+	draw_frame.has_pending_quad = true;
 	
-	return &(*target_buffer)[growing_array_get_valid_count(*target_buffer)-1];
+	return &draw_frame.pending_quad;
 }
 Draw_Quad *draw_quad(Draw_Quad quad) {
-	return draw_quad_projected(quad, m4_mul(draw_frame.projection, m4_inverse(draw_frame.camera_xform)));
+	return draw_quad_projected(quad, get_world_to_clip());
 }
 
 Draw_Quad *draw_quad_xform(Draw_Quad quad, Matrix4 xform) {
-	Matrix4 world_to_clip = m4_scalar(1.0);
-	world_to_clip         = m4_mul(world_to_clip, draw_frame.projection);
-	world_to_clip         = m4_mul(world_to_clip, m4_inverse(draw_frame.camera_xform));
-	world_to_clip         = m4_mul(world_to_clip, xform);
-	return draw_quad_projected(quad, world_to_clip);
+	return draw_quad_projected(quad, m4_mul(get_world_to_clip(), xform));
 }
 
 Draw_Quad *draw_rect(Vector2 position, Vector2 size, Vector4 color) {
@@ -253,6 +865,416 @@ Draw_Quad *draw_image_xform(Gfx_Image *image, Matrix4 xform, Vector2 size, Vecto
 	return q;
 }
 
+// Batched versions of the functions above for when you submit thousands of quads per frame,
+// f.ex. tilemaps and particles. World to clip is fetched once, the quad buffer grows once and
+// the corners are transformed & culled 4 rects at a time.
+// The quads that survive culling are the last N quads in draw_frame.quad_buffer, where N is
+// the returned count.
+//
+// The _strided version is for arrays of structs: pass pointers to the fields of the first
+// element and sizeof(element) as the stride.
+// base is copied to every quad and should be zero except for what you want every quad to
+// share (image, uv, type, filters, userdata). z & scissor come from the stacks like draw_quad.
+
+// Only the rows & columns _draw_transform_point reads, 24 multiplies instead of 64 for m4_mul
+inline Matrix4 _draw_mul_xy(Matrix4 a, Matrix4 b) {
+	Matrix4 result = ZERO(Matrix4);
+	for (int i = 0; i < 2; i++) {
+		result.m[i][0] = a.m[i][0]*b.m[0][0] + a.m[i][1]*b.m[1][0] + a.m[i][2]*b.m[2][0] + a.m[i][3]*b.m[3][0];
+		result.m[i][1] = a.m[i][0]*b.m[0][1] + a.m[i][1]*b.m[1][1] + a.m[i][2]*b.m[2][1] + a.m[i][3]*b.m[3][1];
+		result.m[i][3] = a.m[i][0]*b.m[0][3] + a.m[i][1]*b.m[1][3] + a.m[i][2]*b.m[2][3] + a.m[i][3]*b.m[3][3];
+	}
+	return result;
+}
+
+// Packs base with z & scissor from the stacks and grows the quad buffer by count.
+// Returns the first new quad, resize down to what was actually written when done.
+Draw_Quad_Packed *_draw_batch_begin(Draw_Quad *base, Draw_Quad_Packed *packed_base, u64 count) {
+	draw_frame_flush_pending_quad();
+	_draw_frame_init_buffers();
+	
+	*packed_base = ZERO(Draw_Quad_Packed);
+	if (draw_frame.z_count > 0)  packed_base->z = draw_frame.z_stack[draw_frame.z_count-1];
+	if (draw_frame.scissor_count > 0) {
+		packed_base->scissor = _draw_intern_scissor(draw_frame.scissor_stack[draw_frame.scissor_count-1]);
+	}
+	_draw_pack_quad_attributes(base, packed_base);
+	
+	return (Draw_Quad_Packed*)growing_array_add_multiple_empty((void**)&draw_frame.quad_buffer, count);
+}
+void _draw_batch_end(Draw_Quad_Packed *first, Draw_Quad_Packed *end, u64 reserved_count) {
+	u64 valid_count = growing_array_get_valid_count(draw_frame.quad_buffer);
+	growing_array_resize((void**)&draw_frame.quad_buffer, valid_count - reserved_count + (u64)(end-first));
+}
+
+// Transforms bottom_left, top_left, top_right, bottom_right in place, returns false if cull
+// is set and the quad is off screen.
+inline bool _draw_batch_project_corners(Vector2 *corners, Matrix4 m, bool cull) {
+#if ENABLE_SIMD
+	__m128 lo = _mm_loadu_ps(&corners[0].x);
+	__m128 hi = _mm_loadu_ps(&corners[2].x);
+	__m128 xs = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+	__m128 ys = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+	
+	__m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xs, _mm_set1_ps(m.m[0][0])), _mm_mul_ps(ys, _mm_set1_ps(m.m[0][1]))), _mm_set1_ps(m.m[0][3]));
+	__m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xs, _mm_set1_ps(m.m[1][0])), _mm_mul_ps(ys, _mm_set1_ps(m.m[1][1]))), _mm_set1_ps(m.m[1][3]));
+	
+	__m128 one = _mm_set1_ps(1);
+	__m128 neg_one = _mm_set1_ps(-1);
+	if (cull && (_mm_movemask_ps(_mm_cmplt_ps(x, neg_one)) == 0xF || _mm_movemask_ps(_mm_cmpgt_ps(x, one)) == 0xF
+	 || _mm_movemask_ps(_mm_cmplt_ps(y, neg_one)) == 0xF || _mm_movemask_ps(_mm_cmpgt_ps(y, one)) == 0xF)) {
+		return false;
+	}
+	
+	_mm_storeu_ps(&corners[0].x, _mm_unpacklo_ps(x, y));
+	_mm_storeu_ps(&corners[2].x, _mm_unpackhi_ps(x, y));
+#else
+	for (int c = 0; c < 4; c++) corners[c] = _draw_transform_point(m, corners[c]);
+	
+	float32 min_x = min(min(corners[0].x, corners[1].x), min(corners[2].x, corners[3].x));
+	float32 max_x = max(max(corners[0].x, corners[1].x), max(corners[2].x, corners[3].x));
+	float32 min_y = min(min(corners[0].y, corners[1].y), min(corners[2].y, corners[3].y));
+	float32 max_y = max(max(corners[0].y, corners[1].y), max(corners[2].y, corners[3].y));
+	if (cull && (max_x < -1 || min_x > 1 || max_y < -1 || min_y > 1)) return false;
+#endif
+	return true;
+}
+
+u64 _draw_rects_batch(Draw_Quad base, Vector2 *positions, u64 position_stride, Vector2 *sizes, u64 size_stride, Vector4 *colors, u64 color_stride, u64 count) {
+	if (count == 0) return 0;
+	
+	Matrix4 m = get_world_to_clip();
+	bool cull = !draw_frame.recording_batch;
+	
+	Draw_Quad_Packed packed_base;
+	Draw_Quad_Packed *first = _draw_batch_begin(&base, &packed_base, count);
+	Draw_Quad_Packed *q = first;
+	
+	u8 *position_bytes = (u8*)positions;
+	u8 *size_bytes     = (u8*)sizes;
+	u8 *color_bytes    = (u8*)colors;
+	
+	u64 i = 0;
+	
+#if ENABLE_SIMD
+	// Rects are axis aligned before the transform so we only need the transformed left, right,
+	// bottom & top terms and add them together per corner, for 4 rects at a time.
+	__m128 xx = _mm_set1_ps(m.m[0][0]), xy = _mm_set1_ps(m.m[0][1]), xw = _mm_set1_ps(m.m[0][3]);
+	__m128 yx = _mm_set1_ps(m.m[1][0]), yy = _mm_set1_ps(m.m[1][1]), yw = _mm_set1_ps(m.m[1][3]);
+	__m128 one = _mm_set1_ps(1);
+	__m128 neg_one = _mm_set1_ps(-1);
+	
+	for (; i + 4 <= count; i += 4) {
+		Vector2 *p0 = (Vector2*)(position_bytes + (i+0)*position_stride);
+		Vector2 *p1 = (Vector2*)(position_bytes + (i+1)*position_stride);
+		Vector2 *p2 = (Vector2*)(position_bytes + (i+2)*position_stride);
+		Vector2 *p3 = (Vector2*)(position_bytes + (i+3)*position_stride);
+		Vector2 *s0 = (Vector2*)(size_bytes + (i+0)*size_stride);
+		Vector2 *s1 = (Vector2*)(size_bytes + (i+1)*size_stride);
+		Vector2 *s2 = (Vector2*)(size_bytes + (i+2)*size_stride);
+		Vector2 *s3 = (Vector2*)(size_bytes + (i+3)*size_stride);
+		
+		__m128 left   = _mm_set_ps(p3->x, p2->x, p1->x, p0->x);
+		__m128 bottom = _mm_set_ps(p3->y, p2->y, p1->y, p0->y);
+		__m128 right  = _mm_add_ps(left,   _mm_set_ps(s3->x, s2->x, s1->x, s0->x));
+		__m128 top    = _mm_add_ps(bottom, _mm_set_ps(s3->y, s2->y, s1->y, s0->y));
+		
+		__m128 x_left   = _mm_mul_ps(left, xx);
+		__m128 x_right  = _mm_mul_ps(right, xx);
+		__m128 x_bottom = _mm_add_ps(_mm_mul_ps(bottom, xy), xw);
+		__m128 x_top    = _mm_add_ps(_mm_mul_ps(top, xy), xw);
+		__m128 y_left   = _mm_mul_ps(left, yx);
+		__m128 y_right  = _mm_mul_ps(right, yx);
+		__m128 y_bottom = _mm_add_ps(_mm_mul_ps(bottom, yy), yw);
+		__m128 y_top    = _mm_add_ps(_mm_mul_ps(top, yy), yw);
+		
+		// bottom_left, top_left, top_right, bottom_right
+		__m128 cx[4] = {
+			_mm_add_ps(x_left, x_bottom),  _mm_add_ps(x_left, x_top),
+			_mm_add_ps(x_right, x_top),    _mm_add_ps(x_right, x_bottom),
+		};
+		__m128 cy[4] = {
+			_mm_add_ps(y_left, y_bottom),  _mm_add_ps(y_left, y_top),
+			_mm_add_ps(y_right, y_top),    _mm_add_ps(y_right, y_bottom),
+		};
+		
+		__m128 min_x = _mm_min_ps(_mm_min_ps(cx[0], cx[1]), _mm_min_ps(cx[2], cx[3]));
+		__m128 max_x = _mm_max_ps(_mm_max_ps(cx[0], cx[1]), _mm_max_ps(cx[2], cx[3]));
+		__m128 min_y = _mm_min_ps(_mm_min_ps(cy[0], cy[1]), _mm_min_ps(cy[2], cy[3]));
+		__m128 max_y = _mm_max_ps(_mm_max_ps(cy[0], cy[1]), _mm_max_ps(cy[2], cy[3]));
+		__m128 culled = _mm_or_ps(
+			_mm_or_ps(_mm_cmplt_ps(max_x, neg_one), _mm_cmpgt_ps(min_x, one)),
+			_mm_or_ps(_mm_cmplt_ps(max_y, neg_one), _mm_cmpgt_ps(min_y, one))
+		);
+		int cull_mask = cull ? _mm_movemask_ps(culled) : 0;
+		if (cull_mask == 0xF) continue;
+		
+		float32 corners_x[4][4];
+		float32 corners_y[4][4];
+		for (int c = 0; c < 4; c++) {
+			_mm_storeu_ps(corners_x[c], cx[c]);
+			_mm_storeu_ps(corners_y[c], cy[c]);
+		}
+		
+		for (int k = 0; k < 4; k++) {
+			if (cull_mask & (1 << k)) continue;
+			
+			*q = packed_base;
+			q->bottom_left  = v2(corners_x[0][k], corners_y[0][k]);
+			q->top_left     = v2(corners_x[1][k], corners_y[1][k]);
+			q->top_right    = v2(corners_x[2][k], corners_y[2][k]);
+			q->bottom_right = v2(corners_x[3][k], corners_y[3][k]);
+			q->color = _draw_pack_color(*(Vector4*)(color_bytes + (i+k)*color_stride));
+			q += 1;
+		}
+	}
+#endif
+	
+	for (; i < count; i++) {
+		Vector2 position = *(Vector2*)(position_bytes + i*position_stride);
+		Vector2 size     = *(Vector2*)(size_bytes + i*size_stride);
+		
+		*q = packed_base;
+		q->bottom_left  = v2(position.x,        position.y);
+		q->top_left     = v2(position.x,        position.y+size.y);
+		q->top_right    = v2(position.x+size.x, position.y+size.y);
+		q->bottom_right = v2(position.x+size.x, position.y);
+		
+		if (!_draw_batch_project_corners(&q->bottom_left, m, cull)) continue;
+		
+		q->color = _draw_pack_color(*(Vector4*)(color_bytes + i*color_stride));
+		q += 1;
+	}
+	
+	_draw_batch_end(first, q, count);
+	
+	return (u64)(q-first);
+}
+
+u64 draw_rects_batch(Vector2 *positions, Vector2 *sizes, Vector4 *colors, u64 count) {
+	Draw_Quad base = ZERO(Draw_Quad);
+	base.type = QUAD_TYPE_REGULAR;
+	return _draw_rects_batch(base, positions, sizeof(Vector2), sizes, sizeof(Vector2), colors, sizeof(Vector4), count);
+}
+u64 draw_circles_batch(Vector2 *positions, Vector2 *sizes, Vector4 *colors, u64 count) {
+	Draw_Quad base = ZERO(Draw_Quad);
+	base.type = QUAD_TYPE_CIRCLE;
+	return _draw_rects_batch(base, positions, sizeof(Vector2), sizes, sizeof(Vector2), colors, sizeof(Vector4), count);
+}
+u64 draw_images_batch(Gfx_Image *image, Vector2 *positions, Vector2 *sizes, Vector4 *colors, u64 count) {
+	Draw_Quad base = ZERO(Draw_Quad);
+	base.type = QUAD_TYPE_REGULAR;
+	base.image = image;
+	base.uv = v4(0, 0, 1, 1);
+	return _draw_rects_batch(base, positions, sizeof(Vector2), sizes, sizeof(Vector2), colors, sizeof(Vector4), count);
+}
+u64 draw_rects_batch_strided(Draw_Quad base, Vector2 *positions, Vector2 *sizes, Vector4 *colors, u64 stride, u64 count) {
+	return _draw_rects_batch(base, positions, stride, sizes, stride, colors, stride, count);
+}
+
+// Quads keep everything but their corners, z & scissor, which are projected and taken from the
+// stacks like in draw_quad. xforms can be 0 if the corners are already in world space.
+u64 draw_quads_batch(Draw_Quad *quads, Matrix4 *xforms, u64 count) {
+	if (count == 0) return 0;
+	
+	Matrix4 world_to_clip = get_world_to_clip();
+	bool cull = !draw_frame.recording_batch;
+	
+	Draw_Quad base = ZERO(Draw_Quad);
+	Draw_Quad_Packed packed_base;
+	Draw_Quad_Packed *first = _draw_batch_begin(&base, &packed_base, count);
+	Draw_Quad_Packed *q = first;
+	
+	for (u64 i = 0; i < count; i++) {
+		Matrix4 m = xforms ? _draw_mul_xy(world_to_clip, xforms[i]) : world_to_clip;
+		
+		q->bottom_left  = quads[i].bottom_left;
+		q->top_left     = quads[i].top_left;
+		q->top_right    = quads[i].top_right;
+		q->bottom_right = quads[i].bottom_right;
+		if (!_draw_batch_project_corners(&q->bottom_left, m, cull)) continue;
+		
+		q->z = packed_base.z;
+		q->scissor = packed_base.scissor;
+		_draw_pack_quad_attributes(&quads[i], q);
+		q += 1;
+	}
+	
+	_draw_batch_end(first, q, count);
+	
+	return (u64)(q-first);
+}
+
+// Static batches keep quads that don't change between frames, f.ex. a tilemap or scenery,
+// so they don't need to go through draw_xxx every frame:
+//
+//	local_persist Static_Batch tiles = {0};
+//	if (static_batch_needs_recording(&tiles)) {
+//		static_batch_begin(&tiles);
+//		... draw_rect(), draw_image(), draw_text() etc, in world space ...
+//		static_batch_end(&tiles);
+//	}
+//	draw_static_batch(&tiles, m4_scalar(1.0));
+//
+// Quads keep the z layer and scissor they were recorded with. Drawing a batch is a copy,
+// a transform & cull per quad, no matrix math or image/uv lookups.
+// Call static_batch_mark_dirty() when what it draws changes and it will be recorded again.
+// Don't call gfx_update() while recording.
+typedef struct Static_Batch {
+	// Same as the draw frame buffers, but the corners are in the space they were drawn in
+	Draw_Quad_Packed *quads;
+	Gfx_Image **images;
+	Vector4 *uvs;
+	Vector4 *scissors;
+	Vector4 *userdata;
+	
+	bool recorded;
+	bool dirty;
+	
+	// The draw frame's buffers & camera while recording
+	Draw_Quad_Packed *frame_quads;
+	Gfx_Image **frame_images;
+	Vector4 *frame_uvs;
+	Vector4 *frame_scissors;
+	Vector4 *frame_userdata;
+	Matrix4 frame_projection;
+	Matrix4 frame_camera_xform;
+} Static_Batch;
+
+bool static_batch_needs_recording(Static_Batch *batch) {
+	return !batch->recorded || batch->dirty;
+}
+void static_batch_mark_dirty(Static_Batch *batch) {
+	batch->dirty = true;
+}
+
+void _static_batch_swap_buffers(Static_Batch *batch) {
+	swap(draw_frame.quad_buffer, batch->quads,     Draw_Quad_Packed*);
+	swap(draw_frame.images,      batch->images,    Gfx_Image**);
+	swap(draw_frame.uvs,         batch->uvs,       Vector4*);
+	swap(draw_frame.scissors,    batch->scissors,  Vector4*);
+	swap(draw_frame.userdata,    batch->userdata,  Vector4*);
+	
+	// The lookups only speed up deduplication so we can just forget them
+	memset(draw_frame.image_lookup, 0, sizeof(draw_frame.image_lookup));
+	memset(draw_frame.uv_lookup, 0, sizeof(draw_frame.uv_lookup));
+}
+
+void static_batch_begin(Static_Batch *batch) {
+	assert(!draw_frame.recording_batch, "Already recording a static batch, call static_batch_end() first");
+	
+	draw_frame_flush_pending_quad();
+	_draw_frame_init_buffers();
+	
+	batch->frame_quads    = draw_frame.quad_buffer;
+	batch->frame_images   = draw_frame.images;
+	batch->frame_uvs      = draw_frame.uvs;
+	batch->frame_scissors = draw_frame.scissors;
+	batch->frame_userdata = draw_frame.userdata;
+	
+	if (batch->quads) {
+		growing_array_clear((void**)&batch->quads);
+		growing_array_clear((void**)&batch->images);
+		growing_array_clear((void**)&batch->uvs);
+		growing_array_clear((void**)&batch->scissors);
+		growing_array_clear((void**)&batch->userdata);
+	} else {
+		growing_array_init((void**)&batch->quads, sizeof(Draw_Quad_Packed), get_heap_allocator());
+		growing_array_init((void**)&batch->images, sizeof(Gfx_Image*), get_heap_allocator());
+		growing_array_init((void**)&batch->uvs, sizeof(Vector4), get_heap_allocator());
+		growing_array_init((void**)&batch->scissors, sizeof(Vector4), get_heap_allocator());
+		growing_array_init((void**)&batch->userdata, sizeof(Vector4)*VERTEX_2D_USER_DATA_COUNT, get_heap_allocator());
+	}
+	
+	// Draw calls now pack into the batch's buffers, untransformed and without culling
+	_static_batch_swap_buffers(batch);
+	
+	batch->frame_projection = draw_frame.projection;
+	batch->frame_camera_xform = draw_frame.camera_xform;
+	draw_frame.projection = m4_scalar(1.0);
+	draw_frame.camera_xform = m4_scalar(1.0);
+	
+	draw_frame.recording_batch = batch;
+}
+void static_batch_end(Static_Batch *batch) {
+	assert(draw_frame.recording_batch == batch, "static_batch_end() without static_batch_begin() on the same batch");
+	
+	draw_frame_flush_pending_quad();
+	
+	_static_batch_swap_buffers(batch);
+	
+	draw_frame.projection = batch->frame_projection;
+	draw_frame.camera_xform = batch->frame_camera_xform;
+	
+	draw_frame.recording_batch = 0;
+	batch->recorded = true;
+	batch->dirty = false;
+}
+
+void static_batch_destroy(Static_Batch *batch) {
+	assert(draw_frame.recording_batch != batch, "Can't destroy a static batch while recording it");
+	if (batch->quads) {
+		growing_array_deinit((void**)&batch->quads);
+		growing_array_deinit((void**)&batch->images);
+		growing_array_deinit((void**)&batch->uvs);
+		growing_array_deinit((void**)&batch->scissors);
+		growing_array_deinit((void**)&batch->userdata);
+	}
+	*batch = ZERO(Static_Batch);
+}
+
+// Returns how many quads were on screen, which are the last N quads in draw_frame.quad_buffer.
+u64 draw_static_batch(Static_Batch *batch, Matrix4 xform) {
+	assert(!draw_frame.recording_batch, "Can't draw a static batch while recording one");
+	if (!batch->recorded) return 0;
+	
+	u64 count = growing_array_get_valid_count(batch->quads);
+	if (count == 0) return 0;
+	
+	Matrix4 m = _draw_mul_xy(get_world_to_clip(), xform);
+	
+	draw_frame_flush_pending_quad();
+	_draw_frame_init_buffers();
+	
+	// The batch's side tables are appended to the frame's once, then each quad just offsets
+	// its indices. Images go through the lookup since the renderer binds them by slot.
+	u64 image_count    = growing_array_get_valid_count(batch->images);
+	u64 uv_count       = growing_array_get_valid_count(batch->uvs);
+	u64 scissor_count  = growing_array_get_valid_count(batch->scissors);
+	u64 userdata_count = growing_array_get_valid_count(batch->userdata);
+	
+	u16 *image_slots = (u16*)talloc(max(image_count, 1)*sizeof(u16));
+	for (u64 i = 0; i < image_count; i++) image_slots[i] = _draw_intern_image(batch->images[i]);
+	
+	u32 uv_offset       = growing_array_get_valid_count(draw_frame.uvs);
+	u32 scissor_offset  = growing_array_get_valid_count(draw_frame.scissors);
+	u32 userdata_offset = growing_array_get_valid_count(draw_frame.userdata);
+	assert(scissor_offset + scissor_count < 0xFFFF, "Too many different scissors in one frame, max is %d", 0xFFFF-1);
+	if (uv_count)       growing_array_add_multiple((void**)&draw_frame.uvs, batch->uvs, uv_count);
+	if (scissor_count)  growing_array_add_multiple((void**)&draw_frame.scissors, batch->scissors, scissor_count);
+	if (userdata_count) growing_array_add_multiple((void**)&draw_frame.userdata, batch->userdata, userdata_count);
+	
+	Draw_Quad_Packed *first = (Draw_Quad_Packed*)growing_array_add_multiple_empty((void**)&draw_frame.quad_buffer, count);
+	Draw_Quad_Packed *q = first;
+	
+	for (u64 i = 0; i < count; i++) {
+		*q = batch->quads[i];
+		if (!_draw_batch_project_corners(&q->bottom_left, m, true)) continue;
+		
+		if (q->texture) {
+			q->texture = image_slots[q->texture-1];
+			q->uv += uv_offset;
+		}
+		if (q->scissor)  q->scissor  += (u16)scissor_offset;
+		if (q->userdata) q->userdata += userdata_offset;
+		q += 1;
+	}
+	
+	_draw_batch_end(first, q, count);
+	
+	return (u64)(q-first);
+}
+
 typedef struct {
 	Gfx_Font *font;
 	string text;
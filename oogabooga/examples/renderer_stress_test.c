@@ -99,6 +99,13 @@ int entry(int argc, char **argv) {
 		draw_frame.enable_z_sorting = do_enable_z_sorting;
 		if (is_key_just_pressed('Z')) do_enable_z_sorting = !do_enable_z_sorting;
 		
+		// Compare draw calls with E. Quads that overlap keep their order when batch sorting, so
+		// the picture doesn't change and the draw calls saved only come from quads that don't
+		// overlap (like text and shapes drawn between bushes far away from them).
+		local_persist bool do_enable_batch_sorting = false;
+		draw_frame.enable_batch_sorting = do_enable_batch_sorting;
+		if (is_key_just_pressed('B')) do_enable_batch_sorting = !do_enable_batch_sorting;
+		
 		if (do_enable_z_sorting) {
 			push_window_scissor(
 				v2(input_frame.mouse_x-256, input_frame.mouse_y-256), 
@@ -161,6 +168,7 @@ int entry(int argc, char **argv) {
 		if (is_key_just_released('E')) {
 			log("FPS: %.2f", 1.0 / delta);
 			log("ms: %.2f", delta*1000.0);
+			log("Batch sorting: %d, quads: %llu, draw calls: %llu, texture flushes: %llu", do_enable_batch_sorting, gfx_frame_stats.quads, gfx_frame_stats.draw_calls, gfx_frame_stats.texture_flushes);
 		}
 	}
 
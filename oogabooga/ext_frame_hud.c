@@ -0,0 +1,211 @@
+/*
+
+	Usage:
+
+		Toggle the hud with FRAME_HUD_TOGGLE_KEY (F3 by default) or frame_hud_set_visible(bool).
+
+		Frame times are recorded from the delta_time passed to ext_update(), so there is nothing
+		else to do for the frame graph and the p50/p99/max stats.
+
+		Text is only drawn once you give it a font:
+
+		frame_hud_set_font(font, 14);
+
+		To see what a part of your frame costs, accumulate it with tm_scope_accum and let the hud
+		track the variable. The hud reads the cycles and sets the variable back to 0 every frame.
+
+		local_persist u64 physics_cycles = 0; // Must outlive the hud
+		frame_hud_track_scope(STR("Physics"), &physics_cycles);
+
+		...
+
+		tm_scope_accum("Physics", physics_cycles) {
+			update_physics();
+		}
+
+		NOTE:
+			tm_scope_accum compiles to nothing without ENABLE_PROFILING, in which case you can
+			accumulate rdtsc() deltas into the variable yourself.
+
+		When the hud is hidden, all it does per frame is store the frame time and one u64 per
+		tracked scope.
+
+*/
+
+#ifndef FRAME_HUD_TOGGLE_KEY
+	#define FRAME_HUD_TOGGLE_KEY KEY_F3
+#endif
+
+#define FRAME_HUD_HISTORY_COUNT 256 // Must be a power of two
+#define FRAME_HUD_MAX_SCOPES 16
+
+typedef struct Frame_Hud_Scope {
+	string name;
+	u64 *cycles; // Points at the user's tm_scope_accum variable
+	float32 history[FRAME_HUD_HISTORY_COUNT]; // Milliseconds
+} Frame_Hud_Scope;
+
+typedef struct Frame_Hud {
+	bool visible;
+
+	Gfx_Font *font;
+	u32 font_height;
+
+	float32 frame_times[FRAME_HUD_HISTORY_COUNT]; // Milliseconds
+	u64 frame_count;
+
+	Frame_Hud_Scope scopes[FRAME_HUD_MAX_SCOPES];
+	u64 scope_count;
+
+	// rdtsc is measured against delta_time every frame so scopes can be shown in milliseconds
+	// without depending on the profiler's calibration.
+	u64 last_cycles;
+	float64 cycles_per_second;
+} Frame_Hud;
+
+// #Global
+#if OOGABOOGA_LINK_EXTERNAL_INSTANCE
+ogb_instance Frame_Hud frame_hud;
+#else
+Frame_Hud frame_hud;
+#endif
+
+void frame_hud_set_visible(bool visible) {
+	frame_hud.visible = visible;
+}
+void frame_hud_set_font(Gfx_Font *font, u32 font_height) {
+	frame_hud.font = font;
+	frame_hud.font_height = font_height;
+}
+void frame_hud_track_scope(string name, u64 *cycles) {
+	assert(frame_hud.scope_count < FRAME_HUD_MAX_SCOPES, "Too many scopes tracked by the frame hud, max is %d", FRAME_HUD_MAX_SCOPES);
+
+	Frame_Hud_Scope *scope = &frame_hud.scopes[frame_hud.scope_count];
+	*scope = ZERO(Frame_Hud_Scope);
+	scope->name = name;
+	scope->cycles = cycles;
+
+	frame_hud.scope_count += 1;
+}
+
+void frame_hud_init() {
+	frame_hud.last_cycles = rdtsc();
+}
+
+void frame_hud_update(float32 delta_time) {
+	if (is_key_just_pressed(FRAME_HUD_TOGGLE_KEY)) frame_hud.visible = !frame_hud.visible;
+
+	u64 now_cycles = rdtsc();
+	if (delta_time > 0) {
+		float64 cycles_per_second = (float64)(now_cycles-frame_hud.last_cycles)/(float64)delta_time;
+		// Smooth it out, delta_time is never measured at exactly the same spot as rdtsc
+		if (frame_hud.cycles_per_second == 0) frame_hud.cycles_per_second = cycles_per_second;
+		else frame_hud.cycles_per_second += (cycles_per_second-frame_hud.cycles_per_second)*0.05;
+	}
+	frame_hud.last_cycles = now_cycles;
+
+	u64 slot = frame_hud.frame_count & (FRAME_HUD_HISTORY_COUNT-1);
+	frame_hud.frame_times[slot] = delta_time*1000.0;
+
+	float64 ms_per_cycle = frame_hud.cycles_per_second > 0 ? 1000.0/frame_hud.cycles_per_second : 0;
+	for (u64 i = 0; i < frame_hud.scope_count; i++) {
+		Frame_Hud_Scope *scope = &frame_hud.scopes[i];
+		scope->history[slot] = (float32)((float64)*scope->cycles*ms_per_cycle);
+		*scope->cycles = 0;
+	}
+
+	frame_hud.frame_count += 1;
+}
+
+float32 _frame_hud_percentile(float32 *sorted, u64 count, float32 p) {
+	if (count == 0) return 0;
+	u64 index = (u64)(p*(float32)(count-1) + 0.5);
+	return sorted[min(index, count-1)];
+}
+
+void frame_hud_draw() {
+	if (!frame_hud.visible) return;
+
+	u64 count = min(frame_hud.frame_count, FRAME_HUD_HISTORY_COUNT);
+	if (count == 0) return;
+
+	float32 sorted[FRAME_HUD_HISTORY_COUNT];
+	memcpy(sorted, frame_hud.frame_times, count*sizeof(float32));
+	sort_f32(sorted, count);
+	float32 p50 = _frame_hud_percentile(sorted, count, 0.5);
+	float32 p99 = _frame_hud_percentile(sorted, count, 0.99);
+	float32 max_ms = sorted[count-1];
+
+	// Draw in window pixels, bottom left is 0, 0
+	Matrix4 projection_backup = draw_frame.projection;
+	Matrix4 camera_backup = draw_frame.camera_xform;
+	draw_frame.projection = m4_make_orthographic_projection(0, window.width, 0, window.height, -1, 10);
+	draw_frame.camera_xform = m4_scalar(1.0);
+	push_z_layer(MAX_Z-1);
+
+	const float32 padding = 8;
+	const float32 graph_width = FRAME_HUD_HISTORY_COUNT*2;
+	const float32 graph_height = 80;
+	const float32 bar_height = 12;
+	const float32 line_height = frame_hud.font ? (float32)frame_hud.font_height+4 : 0;
+
+	float32 panel_height = padding*3 + graph_height + line_height
+	                     + (float32)frame_hud.scope_count*(max(bar_height, line_height)+4);
+	float32 panel_width = graph_width + padding*2;
+	Vector2 panel_pos = v2(padding, (float32)window.height - panel_height - padding);
+
+	draw_rect(panel_pos, v2(panel_width, panel_height), v4(0, 0, 0, 0.7));
+
+	// Frame graph, scaled so 33ms (or the worst frame if it's worse) fills it
+	float32 graph_max_ms = max(max_ms, 1000.0/30.0);
+	Vector2 graph_pos = v2(panel_pos.x + padding, panel_pos.y + panel_height - padding - graph_height);
+	float32 column_width = graph_width/(float32)FRAME_HUD_HISTORY_COUNT;
+	for (u64 i = 0; i < count; i++) {
+		// Oldest to the left
+		u64 slot = (frame_hud.frame_count - count + i) & (FRAME_HUD_HISTORY_COUNT-1);
+		float32 ms = frame_hud.frame_times[slot];
+
+		Vector4 color = v4(0.3, 0.9, 0.3, 1);
+		if (ms > 1000.0/30.0) color = v4(0.9, 0.25, 0.25, 1);
+		else if (ms > 1000.0/60.0 + 1.0) color = v4(0.95, 0.8, 0.2, 1);
+
+		float32 height = max(ms/graph_max_ms*graph_height, 1);
+		float32 x = graph_pos.x + (float32)(FRAME_HUD_HISTORY_COUNT-count+i)*column_width;
+		draw_rect(v2(x, graph_pos.y), v2(column_width, height), color);
+	}
+	float32 target_y = graph_pos.y + (1000.0/60.0)/graph_max_ms*graph_height;
+	draw_rect(v2(graph_pos.x, target_y), v2(graph_width, 1), v4(1, 1, 1, 0.4));
+
+	float32 y = graph_pos.y - padding;
+	if (frame_hud.font) {
+		y -= line_height;
+		string stats = tprint("p50 %.2f ms   p99 %.2f ms   max %.2f ms   %.0f fps", p50, p99, max_ms, p50 > 0 ? 1000.0/p50 : 0.0);
+		draw_text(frame_hud.font, stats, frame_hud.font_height, v2(graph_pos.x, y), v2(1, 1), COLOR_WHITE);
+	}
+
+	// Per scope bars, average over the history, scaled to the p50 frame time
+	for (u64 i = 0; i < frame_hud.scope_count; i++) {
+		Frame_Hud_Scope *scope = &frame_hud.scopes[i];
+
+		float32 total = 0;
+		for (u64 j = 0; j < count; j++) total += scope->history[(frame_hud.frame_count-1-j) & (FRAME_HUD_HISTORY_COUNT-1)];
+		float32 average = total/(float32)count;
+
+		y -= max(bar_height, line_height) + 4;
+
+		float32 label_width = frame_hud.font ? graph_width*0.4 : 0;
+		float32 bar_max_width = graph_width - label_width;
+		float32 fraction = p50 > 0 ? clamp(average/p50, 0, 1) : 0;
+		draw_rect(v2(graph_pos.x + label_width, y), v2(bar_max_width, bar_height), v4(1, 1, 1, 0.1));
+		draw_rect(v2(graph_pos.x + label_width, y), v2(bar_max_width*fraction, bar_height), v4(0.35, 0.6, 1.0, 1));
+
+		if (frame_hud.font) {
+			string label = tprint("%s %.2f ms", scope->name, average);
+			draw_text(frame_hud.font, label, frame_hud.font_height, v2(graph_pos.x, y), v2(1, 1), COLOR_WHITE);
+		}
+	}
+
+	pop_z_layer();
+	draw_frame.projection = projection_backup;
+	draw_frame.camera_xform = camera_backup;
+}
@@ -262,6 +262,8 @@ Emission_Handle emit_particles(Emission_Config config, Vector2 pos) {
 	config.number_of_particles = max(config.number_of_particles, 1);
 	config.emissions_per_second = max(config.emissions_per_second, 1);
 	if (config.seed == 0) config.seed = get_random();
+	
+	tm_counter("Particles emitted", config.number_of_particles);
 
 	for (u64 i = 0; i < growing_array_get_valid_count(emissions); i += 1) {
 		if (!emissions[i].allocated) {
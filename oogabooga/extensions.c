@@ -1,22 +1,34 @@
-
 #if OOGABOOGA_EXTENSION_PARTICLES
 	#include "ext_particles.c"
 #endif
+#if OOGABOOGA_EXTENSION_FRAME_HUD
+	#include "ext_frame_hud.c"
+#endif
 
 void ext_init() {
 #if OOGABOOGA_EXTENSION_PARTICLES
 	particles_init();
 #endif
+#if OOGABOOGA_EXTENSION_FRAME_HUD
+	frame_hud_init();
+#endif
 }
 
 void ext_update(float32 delta_time) {
 #if OOGABOOGA_EXTENSION_PARTICLES
 	particles_update();
 #endif
+#if OOGABOOGA_EXTENSION_FRAME_HUD
+	frame_hud_update(delta_time);
+#endif
 }
 
 void ext_draw() {
 #if OOGABOOGA_EXTENSION_PARTICLES
 	particles_draw();
 #endif
-}
\ No newline at end of file
+// Last, so it's drawn over the other extensions
+#if OOGABOOGA_EXTENSION_FRAME_HUD
+	frame_hud_draw();
+#endif
+}
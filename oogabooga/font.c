@@ -491,21 +491,25 @@ string *split_text_to_lines_with_wrapping(string str, float32 width, Gfx_Font *f
 
 	string *lines;
 	growing_array_init((void**)&lines, sizeof(string), get_temporary_allocator());
+	
+	// So we don't walk from the start of the text for every line
+	Utf8_Index text_index;
+	utf8_index_init(&text_index, text, UTF8_INDEX_DEFAULT_STRIDE, get_temporary_allocator());
 
 	for (u64 i = 0; i < growing_array_get_valid_count(result.line_break_indices); i += 1) {
 		u64 utf8_index = result.line_break_indices[i];
-		u64 byte_index = utf8_index_to_byte_index(text, utf8_index);
+		u64 byte_index = utf8_index_lookup(&text_index, utf8_index);
 		u64 utf8_count = result.glyph_count_per_line[i];
-		u64 byte_count = utf8_index_to_byte_index(text, utf8_index + utf8_count) - byte_index;
+		u64 byte_count = utf8_index_lookup(&text_index, utf8_index + utf8_count) - byte_index;
 		string line_str = string_view(text, byte_index, byte_count);
 		if (do_trim_lines)  line_str = string_trim(line_str);
 		growing_array_add((void**)&lines, &line_str);
 	}
 	if (result.count > 0) {
 		u64 utf8_index = result.start_index;
-		u64 byte_index = utf8_index_to_byte_index(text, utf8_index);
+		u64 byte_index = utf8_index_lookup(&text_index, utf8_index);
 		u64 utf8_count = result.count;
-		u64 byte_count = utf8_index_to_byte_index(text, utf8_index + utf8_count) - byte_index;
+		u64 byte_count = utf8_index_lookup(&text_index, utf8_index + utf8_count) - byte_index;
 		string line_str = string_view(text, byte_index, byte_count);
 		if (do_trim_lines)  line_str = string_trim(line_str);
 		growing_array_add((void**)&lines, &line_str);
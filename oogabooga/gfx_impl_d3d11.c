@@ -4,27 +4,12 @@
 #define D3D11Release(x) x->lpVtbl->Release(x)
 
 const Gfx_Handle GFX_INVALID_HANDLE = 0;
+Gfx_Frame_Stats gfx_frame_stats = {0};
 
 string temp_win32_null_terminated_wide_to_fixed_utf8(const u16 *utf16);
 
-// We wanna pack this at some point
-// #Cleanup #Memory why am I doing alignat(16)?
-typedef struct alignat(16) D3D11_Vertex {
-	
-	Vector4 color;
-	Vector4 position;
-	Vector2 uv;
-	Vector2 self_uv;
-	s8 texture_index;
-	u8 type;
-	u8 sampler;
-	u8 has_scissor;
-	
-	Vector4 userdata[VERTEX_2D_USER_DATA_COUNT];
-	
-	Vector4 scissor;
-	
-} D3D11_Vertex;
+// Vertices are generated by generate_quad_vertices() in drawing.c
+typedef Vertex_2D D3D11_Vertex;
 
 // #Global
 
@@ -60,9 +45,11 @@ void *d3d11_staging_quad_buffer = 0;
 ID3D11Buffer *d3d11_cbuffer = 0;
 u64 d3d11_cbuffer_size = 0;
 
-Draw_Quad *sort_quad_buffer = 0;
+Draw_Quad_Packed *sort_quad_buffer = 0;
 u64 sort_quad_buffer_size = 0;
 
+Vertex_2D_Batch *d3d11_vertex_batches = 0;
+
 const char* d3d11_stringify_category(D3D11_MESSAGE_CATEGORY category) {
     switch (category) {
     case D3D11_MESSAGE_CATEGORY_APPLICATION_DEFINED: return "Application Defined";
@@ -549,7 +536,9 @@ void gfx_init() {
 	
 }
 
-void d3d11_draw_call(int number_of_rendered_quads, ID3D11ShaderResourceView **textures, u64 num_textures) {
+void d3d11_draw_call(u64 first_quad, u64 number_of_rendered_quads, ID3D11ShaderResourceView **textures, u64 num_textures) {
+	gfx_frame_stats.draw_calls += 1;
+	
 	ID3D11DeviceContext_OMSetBlendState(d3d11_context, d3d11_blend_state, 0, 0xffffffff);
 	ID3D11DeviceContext_OMSetRenderTargets(d3d11_context, 1, &d3d11_window_render_target_view, 0); 
 	ID3D11DeviceContext_RSSetState(d3d11_context, d3d11_rasterizer);
@@ -591,7 +580,7 @@ void d3d11_draw_call(int number_of_rendered_quads, ID3D11ShaderResourceView **te
     ID3D11DeviceContext_PSSetSamplers(d3d11_context, 3, 1, &d3d11_image_sampler_nl_fp);
     ID3D11DeviceContext_PSSetShaderResources(d3d11_context, 0, num_textures, textures);
 
-    ID3D11DeviceContext_Draw(d3d11_context, number_of_rendered_quads * 6, 0);
+    ID3D11DeviceContext_Draw(d3d11_context, number_of_rendered_quads * 6, first_quad * 6);
 }
 
 void d3d11_process_draw_frame() {
@@ -600,9 +589,12 @@ void d3d11_process_draw_frame() {
 	
 	ID3D11DeviceContext_ClearRenderTargetView(d3d11_context, d3d11_window_render_target_view, (float*)&window.clear_color);
 	
+	gfx_frame_stats = ZERO(Gfx_Frame_Stats);
+	
 	if (!draw_frame.quad_buffer) return;
 
 	u64 number_of_quads = growing_array_get_valid_count(draw_frame.quad_buffer);
+	gfx_frame_stats.quads = number_of_quads;
 	
 	///
 	// Maybe grow quad vbo
@@ -630,191 +622,28 @@ void d3d11_process_draw_frame() {
 	}
 
 	if (number_of_quads > 0) {
-		///
-		// Render geometry from into vbo quad list
-	    
-		
-		ID3D11ShaderResourceView *textures[32];
-		ID3D11ShaderResourceView *last_texture = 0;
-		u64 num_textures = 0;
-		s8 last_texture_index = 0;
-		
-		D3D11_Vertex* head = (D3D11_Vertex*)d3d11_staging_quad_buffer;
-		D3D11_Vertex* pointer = head;
-		u64 number_of_rendered_quads = 0;
-		
 		
+		Draw_Quad_Packed *quads = draw_frame.quad_buffer;
+		u64 batch_count = 0;
 		
 		tm_scope("Quad processing") {
-			if (draw_frame.enable_z_sorting) tm_scope("Z sorting") {
-				if (!sort_quad_buffer || (sort_quad_buffer_size < number_of_quads*sizeof(Draw_Quad))) {
+			if (draw_frame.enable_z_sorting || draw_frame.enable_batch_sorting) {
+				if (!sort_quad_buffer || (sort_quad_buffer_size < number_of_quads*sizeof(Draw_Quad_Packed))) {
 					// #Memory #Heapalloc
 					if (sort_quad_buffer) dealloc(get_heap_allocator(), sort_quad_buffer);
-					sort_quad_buffer = alloc(get_heap_allocator(), number_of_quads*sizeof(Draw_Quad));
-					sort_quad_buffer_size = number_of_quads*sizeof(Draw_Quad);
+					sort_quad_buffer = alloc(get_heap_allocator(), number_of_quads*sizeof(Draw_Quad_Packed));
+					sort_quad_buffer_size = number_of_quads*sizeof(Draw_Quad_Packed);
 				}
-				radix_sort(draw_frame.quad_buffer, sort_quad_buffer, number_of_quads, sizeof(Draw_Quad), offsetof(Draw_Quad, z), MAX_Z_BITS);
 			}
-		
-			for (u64 i = 0; i < number_of_quads; i++)  {
-				
-				Draw_Quad *q = &draw_frame.quad_buffer[i];
-				
-				assert(q->z <= MAX_Z, "Z is too high. Z is %d, Max is %d.", q->z, MAX_Z);
-				assert(q->z >= (-MAX_Z+1), "Z is too low. Z is %d, Min is %d.", q->z, -MAX_Z+1);
-				
-				s8 texture_index = -1;
-				
-				if (q->image) {
-					
-					if (last_texture == q->image->gfx_handle) {
-						texture_index = last_texture_index;
-					} else {
-						// First look if texture is already bound
-						for (u64 j = 0; j < num_textures; j++) {
-							if (textures[j] == q->image->gfx_handle) {
-								texture_index = (s8)j;
-								break;
-							}
-						}
-						// Otherwise use a new slot
-						if (texture_index <= -1) {
-							if (num_textures >= 32) {
-								// If max textures reached, make a draw call and start over
-								D3D11_MAPPED_SUBRESOURCE buffer_mapping;
-								ID3D11DeviceContext_Map(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0, D3D11_MAP_WRITE_DISCARD, 0, &buffer_mapping);
-								memcpy(buffer_mapping.pData, d3d11_staging_quad_buffer, number_of_rendered_quads*sizeof(D3D11_Vertex)*6);
-								ID3D11DeviceContext_Unmap(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0);
-								d3d11_draw_call(number_of_rendered_quads, textures, num_textures);
-								head = (D3D11_Vertex*)d3d11_staging_quad_buffer;
-								num_textures = 0;
-								texture_index = 0;
-								number_of_rendered_quads = 0;
-								pointer = head;
-							} else {
-								texture_index = (s8)num_textures;
-								num_textures += 1;
-							}
-						}
-					}
-					textures[texture_index] = q->image->gfx_handle;
-					last_texture = q->image->gfx_handle;
-					last_texture_index = texture_index;
-				}
-				
-				// This is meant to fix the annoying artifacts that shows up when sampling from a large atlas
-			    // presumably for floating point precision issues or something.
-			
-			    // #Incomplete
-			    // If we want to animate text with small movements then it will look wonky.
-			    // This should be optional probably.
+			if (draw_frame.enable_batch_sorting) tm_scope("Batch sorting") {
+				sort_draw_quads_for_batching(draw_frame.quad_buffer, sort_quad_buffer, number_of_quads);
+				quads = sort_quad_buffer;
+			} else if (draw_frame.enable_z_sorting) tm_scope("Z sorting") {
+				radix_sort_parallel(draw_frame.quad_buffer, sort_quad_buffer, number_of_quads, sizeof(Draw_Quad_Packed), offsetof(Draw_Quad_Packed, z), MAX_Z_BITS);
+			}
 			
-				float pixel_width = 2.0/(float)window.width;
-				float pixel_height = 2.0/(float)window.height;
-
-                bool xeven = window.width % 2 == 0;
-                bool yeven = window.height % 2 == 0;
-				
-				q->bottom_left.x  = round(q->bottom_left.x  / pixel_width)  * pixel_width;
-			    q->bottom_left.y  = round(q->bottom_left.y  / pixel_height) * pixel_height;
-			    q->top_left.x     = round(q->top_left.x     / pixel_width)  * pixel_width;
-			    q->top_left.y     = round(q->top_left.y     / pixel_height) * pixel_height;
-			    q->top_right.x    = round(q->top_right.x    / pixel_width)  * pixel_width;
-			    q->top_right.y    = round(q->top_right.y    / pixel_height) * pixel_height;
-			    q->bottom_right.x = round(q->bottom_right.x / pixel_width)  * pixel_width;
-			    q->bottom_right.y = round(q->bottom_right.y / pixel_height) * pixel_height;
-				
-				// We will write to 6 vertices for the one quad (two tris)
-				 {
-				
-					D3D11_Vertex* BL  = pointer + 0;
-					D3D11_Vertex* TL  = pointer + 1;
-					D3D11_Vertex* TR  = pointer + 2;
-					D3D11_Vertex* BL2 = pointer + 3;
-					D3D11_Vertex* TR2 = pointer + 4;
-					D3D11_Vertex* BR  = pointer + 5;
-					pointer += 6;
-					
-					BL->position = v4(q->bottom_left.x,  q->bottom_left.y,  0, 1);
-					TL->position = v4(q->top_left.x,     q->top_left.y,     0, 1);
-					TR->position = v4(q->top_right.x,    q->top_right.y,    0, 1);
-					BR->position = v4(q->bottom_right.x, q->bottom_right.y, 0, 1);
-					
-					
-					if (q->image) {
-
-						BL->uv = v2(q->uv.x1, q->uv.y1);
-						TL->uv = v2(q->uv.x1, q->uv.y2);
-						TR->uv = v2(q->uv.x2, q->uv.y2);
-						BR->uv = v2(q->uv.x2, q->uv.y1);
-						// #Hack #Bug #Cleanup
-						// When a window dimension is uneven it slightly under/oversamples on an axis by a
-						// seemingly arbitrary amount. The 0.25 is a magic value I got from trial and error.
-						// (It undersamples by a fourth of the atlas texture?)
-						// Anything > 0.25 < will slightly over/undersample on my machine.
-						// I have no idea about #Portability here.
-						// - Charlie M 26th July 2024
-						if (window.width % 2 != 0) {
-							BL->uv.x += (2.0/(float)q->image->width)*0.25;
-							TL->uv.x += (2.0/(float)q->image->width)*0.25;
-							TR->uv.x += (2.0/(float)q->image->width)*0.25;
-							BR->uv.x += (2.0/(float)q->image->width)*0.25;
-						}
-						if (window.height % 2 != 0) {
-							BL->uv.y -= (2.0/(float)q->image->height)*0.25;
-							TL->uv.y -= (2.0/(float)q->image->height)*0.25;
-							TR->uv.y -= (2.0/(float)q->image->height)*0.25;
-							BR->uv.y -= (2.0/(float)q->image->height)*0.25;
-						}
-
-						u8 sampler = -1;
-						if (q->image_min_filter == GFX_FILTER_MODE_NEAREST
-									&& q->image_mag_filter == GFX_FILTER_MODE_NEAREST)
-								sampler = 0;
-						if (q->image_min_filter == GFX_FILTER_MODE_LINEAR
-									&& q->image_mag_filter == GFX_FILTER_MODE_LINEAR)
-								sampler = 1;
-						if (q->image_min_filter == GFX_FILTER_MODE_LINEAR
-									&& q->image_mag_filter == GFX_FILTER_MODE_NEAREST)
-								sampler = 2;
-						if (q->image_min_filter == GFX_FILTER_MODE_NEAREST
-									&& q->image_mag_filter == GFX_FILTER_MODE_LINEAR)
-								sampler = 3;
-						BL->sampler=TL->sampler=TR->sampler=BR->sampler = (u8)sampler;
-								
-					}
-					BL->texture_index=TL->texture_index=TR->texture_index=BR->texture_index = texture_index;
-					
-					BL->self_uv = v2(0, 0);
-					TL->self_uv = v2(0, 1);
-					TR->self_uv = v2(1, 1);
-					BR->self_uv = v2(1, 0);
-					
-					// #Speed
-					memcpy(BL->userdata, q->userdata, sizeof(q->userdata));
-					memcpy(TL->userdata, q->userdata, sizeof(q->userdata));
-					memcpy(TR->userdata, q->userdata, sizeof(q->userdata));
-					memcpy(BR->userdata, q->userdata, sizeof(q->userdata));
-					
-					BL->color = TL->color = TR->color = BR->color = q->color;
-					
-					BL->type=TL->type=TR->type=BR->type = (u8)q->type;
-					
-					float t = q->scissor.y1;
-					q->scissor.y1 = q->scissor.y2;
-					q->scissor.y2 = t;
-					
-					q->scissor.y1 = window.pixel_height - q->scissor.y1;
-					q->scissor.y2 = window.pixel_height - q->scissor.y2;
-					
-					BL->has_scissor=TL->has_scissor=TR->has_scissor=BR->has_scissor = q->has_scissor;
-					BL->scissor=TL->scissor=TR->scissor=BR->scissor = q->scissor;
-					
-					*BL2 = *BL;
-					*TR2 = *TR;
-					
-					number_of_rendered_quads += 1;
-				}
+			tm_scope("Vertex generation") {
+				batch_count = generate_quad_vertices(quads, number_of_quads, (D3D11_Vertex*)d3d11_staging_quad_buffer, &d3d11_vertex_batches);
 			}
 		}
 		
@@ -825,7 +654,7 @@ void d3d11_process_draw_frame() {
 			d3d11_check_hr(hr);
 			}
 			tm_scope("The memcpy") {
-				memcpy(buffer_mapping.pData, d3d11_staging_quad_buffer, number_of_rendered_quads*sizeof(D3D11_Vertex)*6);
+				memcpy(buffer_mapping.pData, d3d11_staging_quad_buffer, number_of_quads*sizeof(D3D11_Vertex)*6);
 			}
 			tm_scope("The Unmap call") {
 				ID3D11DeviceContext_Unmap(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0);
@@ -833,8 +662,12 @@ void d3d11_process_draw_frame() {
 		}
 		
 		///
-		// Draw call
-		tm_scope("Draw call") d3d11_draw_call(number_of_rendered_quads, textures, num_textures);
+		// Draw calls, one per set of textures
+		gfx_frame_stats.texture_flushes = batch_count - 1;
+		tm_scope("Draw call") for (u64 i = 0; i < batch_count; i++) {
+			Vertex_2D_Batch *batch = &d3d11_vertex_batches[i];
+			d3d11_draw_call(batch->first_quad, batch->quad_count, batch->textures, batch->texture_count);
+		}
     }
     
     reset_draw_frame(&draw_frame);
@@ -852,7 +685,15 @@ void gfx_update() {
 		d3d11_update_swapchain();
 	}
 
+	draw_frame_flush_pending_quad();
+	
+	tm_gauge("Quads", draw_frame.quad_buffer ? growing_array_get_valid_count(draw_frame.quad_buffer) : 0);
+	tm_gauge("Heap bytes in use", heap_bytes_in_use);
+	tm_gauge("Temporary storage high water", temporary_storage_high_water);
+
 	d3d11_process_draw_frame();
+	
+	tm_gauge("Draw calls", gfx_frame_stats.draw_calls);
 
 	tm_scope("Present") {
 		IDXGISwapChain1_Present(d3d11_swap_chain, window.enable_vsync, window.enable_vsync ? 0 : DXGI_PRESENT_ALLOW_TEARING);
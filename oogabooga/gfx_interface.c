@@ -37,6 +37,39 @@ typedef struct Gfx_Image {
 	Allocator allocator;
 } Gfx_Image;
 
+// #Volatile reflected in 2D batch shader
+#define VERTEX_2D_MAX_TEXTURES 32
+
+// Quads are drawn as two triangles of these, see generate_quad_vertices() in drawing.c
+// #Volatile reflected in 2D batch shader and the renderer's input layout
+// We wanna pack this at some point
+// #Cleanup #Memory why am I doing alignat(16)?
+typedef struct alignat(16) Vertex_2D {
+	
+	Vector4 color;
+	Vector4 position;
+	Vector2 uv;
+	Vector2 self_uv;
+	s8 texture_index; // -1 if no texture
+	u8 type;
+	u8 sampler;
+	u8 has_scissor;
+	
+	Vector4 userdata[VERTEX_2D_USER_DATA_COUNT];
+	
+	Vector4 scissor;
+	
+} Vertex_2D;
+
+// A run of quads that can be drawn with one draw call, texture_index in the vertices
+// indexes into textures.
+typedef struct Vertex_2D_Batch {
+	u64 first_quad;
+	u64 quad_count;
+	u64 texture_count;
+	Gfx_Handle textures[VERTEX_2D_MAX_TEXTURES];
+} Vertex_2D_Batch;
+
 Gfx_Image *
 make_image(u32 width, u32 height, u32 channels, void *initial_data, Allocator allocator);
 Gfx_Image *
@@ -54,6 +87,16 @@ gfx_read_image_data(Gfx_Image *image, u32 x, u32 y, u32 w, u32 h, void *output);
 ogb_instance void 
 gfx_deinit_image(Gfx_Image *image);
 
+typedef struct Gfx_Frame_Stats {
+	u64 quads;
+	u64 draw_calls;
+	u64 texture_flushes; // Draw calls made early because all texture slots were used
+} Gfx_Frame_Stats;
+
+// Stats of the last frame rendered by gfx_update. With draw_frame.enable_batch_sorting,
+// draw_calls only drops as far as quads that overlap allow, since those keep their order.
+ogb_instance Gfx_Frame_Stats gfx_frame_stats;
+
 ogb_instance void 
 gfx_init();
 ogb_instance void 
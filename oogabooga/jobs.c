@@ -0,0 +1,779 @@
+
+///
+///
+// Job system
+///
+// A work-stealing job scheduler with one worker per logical processor. The thread that calls
+// job_system_init (the main thread) is worker 0 and helps out with jobs while it waits on a
+// counter, the other workers are dedicated threads.
+//
+// Each worker has a Chase-Lev deque: the owner pushes and pops jobs at the bottom (LIFO, good
+// for cache locality) while idle workers steal from the top (FIFO, steals the biggest chunks
+// of remaining work). Jobs submitted from threads that are not workers (audio thread etc.)
+// go into a small global queue.
+//
+// Jobs run on fibers from a fixed pool. When a job calls job_wait_for_counter, its fiber is
+// parked and the worker goes on with other jobs instead of blocking. Once the counter hits zero
+// any worker may pick the fiber back up, so a job can continue on a different thread than it
+// started on. Don't keep pointers to thread_local's across a wait.
+//
+// Each fiber has its own temporary storage which is reset when it starts a new job, so temp
+// allocations in a job stay valid until the job returns, even across waits.
+//
+// With ENABLE_PROFILING, each time a fiber runs on a worker shows up as a "Job fiber" event
+// (or "Job fiber yield" if it ended by waiting on a counter), so tm_scope's inside jobs nest
+// under it. A tm_scope around a job_wait_for_counter may start and end on different threads.
+//
+// Example:
+//
+//	Job_Counter counter = {0};
+//	job_submit(do_thing, &thing_a, &counter);
+//	job_submit(do_thing, &thing_b, &counter);
+//	job_wait_for_counter(&counter);
+//
+//	parallel_for(particle_count, 256, update_particles, &particles);
+//
+// If the job system is not running, jobs run immediately on the submitting thread.
+
+#define JOB_DEQUE_CAPACITY 4096 // Must be power of two
+#define JOB_GLOBAL_QUEUE_CAPACITY 4096
+#define MAX_JOB_WORKERS 64
+#define JOB_FIBER_COUNT 128
+#define JOB_FIBER_STACK_SIZE KB(512) // Reserved, committed as it's used
+// Same as the threads get, so a job can talloc and tprint as much as any other code.
+// Only fibers that actually get used allocate theirs.
+#ifndef JOB_FIBER_TEMPORARY_STORAGE_SIZE
+	#define JOB_FIBER_TEMPORARY_STORAGE_SIZE TEMPORARY_STORAGE_SIZE
+#endif
+// parallel_for bookkeeping bigger than this goes on the heap instead of temporary storage
+#define PARALLEL_FOR_MAX_TEMPORARY_BYTES KB(16)
+
+typedef void(*Job_Proc)(void *data);
+
+// Zero initialize. Counts how many jobs are still in flight.
+typedef struct Job_Counter {
+	volatile u64 value;
+} Job_Counter;
+
+typedef struct Job {
+	Job_Proc proc;
+	void *data;
+	Job_Counter *counter;
+} Job;
+
+typedef struct Job_Deque {
+	volatile s64 top; // Thieves take from here
+	u8 _pad0[64-sizeof(s64)];
+	volatile s64 bottom; // The owning worker pushes & pops here
+	u8 _pad1[64-sizeof(s64)];
+	Job *jobs;
+} Job_Deque;
+
+typedef enum Job_Fiber_State {
+	JOB_FIBER_IDLE,
+	JOB_FIBER_RUNNING,
+	JOB_FIBER_WAITING, // Parked on wait_counter
+	JOB_FIBER_DONE,    // Finished its job, goes back to the pool
+} Job_Fiber_State;
+
+typedef struct Job_Fiber {
+	Fiber_Handle handle;
+	Job_Fiber_State state;
+	Job job;
+	Job_Counter *wait_counter;
+
+	void *temporary_storage;
+	void *temporary_storage_pointer;
+} Job_Fiber;
+
+typedef struct Job_Worker {
+	Job_Deque deque;
+	Thread thread;
+	u64 index;
+	u64 steal_seed;
+
+	Fiber_Handle scheduler_fiber; // The thread itself, fibers switch back here
+	Job_Fiber *current_fiber; // 0 if we're on the scheduler
+} Job_Worker;
+
+typedef struct Job_System {
+	Job_Worker *workers;
+	u64 worker_count; // Including the main thread
+	volatile bool running;
+
+	Mpmc_Queue global_queue;
+
+	// Idle workers sleep on wake_generation, submitters bump it if anyone is sleeping
+	volatile u32 wake_generation;
+	volatile u32 sleeping_worker_count;
+
+	Job_Fiber fibers[JOB_FIBER_COUNT];
+	Spinlock fiber_lock;
+	Job_Fiber *free_fibers[JOB_FIBER_COUNT];
+	u64 free_fiber_count;
+	Job_Fiber *waiting_fibers[JOB_FIBER_COUNT];
+	volatile u64 waiting_fiber_count;
+} Job_System;
+
+// first is the first index in the batch, end is one past the last
+typedef void(*Parallel_For_Proc)(u64 first, u64 end, void *userdata);
+
+// #Global
+ogb_instance Job_System job_system;
+
+// worker_count includes the calling thread. Pass 0 to use os_get_number_of_logical_processors().
+void ogb_instance
+job_system_init(u64 worker_count);
+
+void ogb_instance
+job_system_shutdown();
+
+void ogb_instance
+job_submit(Job_Proc proc, void *data, Job_Counter *counter);
+
+void ogb_instance
+job_submit_many(Job *jobs, u64 count, Job_Counter *counter);
+
+// In a job, this parks the fiber and lets the worker run other jobs until counter reaches
+// zero. Outside of jobs, workers run other jobs while waiting and other threads just yield.
+void ogb_instance
+job_wait_for_counter(Job_Counter *counter);
+
+// Calls proc for [0, count) split into batches of batch_size, spread over all workers, and
+// returns when all batches are done. Pass 0 batch_size to pick one based on worker count.
+void ogb_instance
+parallel_for(u64 count, u64 batch_size, Parallel_For_Proc proc, void *userdata);
+
+u64 ogb_instance
+job_get_worker_count();
+
+// -1 if calling thread is not a worker
+s64 ogb_instance
+job_get_current_worker_index();
+
+///
+// Parallel radix sort
+// Same as radix_sort/radix_sort_pairs in utility.c, but each worker counts and scatters its
+// own block of the collection. Small collections are sorted on the calling thread.
+#define RADIX_SORT_PARALLEL_MIN_ITEMS_PER_BLOCK 16384
+#define RADIX_SORT_PARALLEL_MAX_BLOCKS 64
+
+void ogb_instance
+radix_sort_parallel(void *collection, void *help_buffer, u64 item_count, u64 item_size, u64 sort_value_offset_in_item, u64 number_of_bits);
+
+void ogb_instance
+radix_sort_pairs_parallel(Radix_Sort_Pair *pairs, Radix_Sort_Pair *help_buffer, u64 item_count, u64 number_of_bits);
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+Job_System job_system = {0};
+thread_local Job_Worker *_job_current_worker = 0;
+
+// A fiber can resume on another thread, and the compiler is allowed to cache the address of
+// a thread_local across a call. So fiber code needs to go through here after a switch.
+noinline Job_Worker *_job_get_current_worker() {
+	return _job_current_worker;
+}
+
+void _job_wake_sleeping_worker() {
+	// The job (or counter) we just published must be visible before we look for sleepers
+	_mm_mfence();
+	if (atomic_load_acquire_32(&job_system.sleeping_worker_count) == 0) return;
+
+	atomic_fetch_add_32(&job_system.wake_generation, 1);
+	os_wake_one_waiting_on_address(&job_system.wake_generation);
+}
+
+void _job_counter_add(Job_Counter *counter, s64 delta) {
+	u64 old = atomic_fetch_add_64(&counter->value, (u64)delta);
+
+	// A parked fiber might be ready now
+	if (old + (u64)delta == 0 && job_system.waiting_fiber_count > 0) _job_wake_sleeping_worker();
+}
+
+///
+// Chase-Lev deque
+
+bool job_deque_push(Job_Deque *d, Job job) {
+	s64 b = d->bottom;
+	s64 t = d->top;
+	if (b - t >= JOB_DEQUE_CAPACITY) return false;
+
+	d->jobs[b & (JOB_DEQUE_CAPACITY-1)] = job;
+	MEMORY_BARRIER;
+	d->bottom = b + 1;
+	return true;
+}
+bool job_deque_pop(Job_Deque *d, Job *job) {
+	s64 b = d->bottom - 1;
+	d->bottom = b;
+	_mm_mfence(); // The store to bottom must be visible before we read top
+	s64 t = d->top;
+
+	if (t > b) {
+		d->bottom = b + 1;
+		return false;
+	}
+
+	*job = d->jobs[b & (JOB_DEQUE_CAPACITY-1)];
+	if (t == b) {
+		// Last job, race against thieves
+		bool won = compare_and_swap_64((volatile u64*)&d->top, (u64)(t + 1), (u64)t);
+		d->bottom = b + 1;
+		return won;
+	}
+	return true;
+}
+bool job_deque_steal(Job_Deque *d, Job *job) {
+	s64 t = d->top;
+	MEMORY_BARRIER;
+	s64 b = d->bottom;
+	if (t >= b) return false;
+
+	// This might be overwritten while we read it, but then top has moved and the CAS fails
+	Job j = d->jobs[t & (JOB_DEQUE_CAPACITY-1)];
+	if (!compare_and_swap_64((volatile u64*)&d->top, (u64)(t + 1), (u64)t)) return false;
+
+	*job = j;
+	return true;
+}
+
+///
+// Global queue, for jobs submitted from threads which are not workers
+
+bool _job_global_queue_push(Job job) {
+	return mpmc_queue_push(&job_system.global_queue, &job);
+}
+bool _job_global_queue_pop(Job *job) {
+	return mpmc_queue_pop(&job_system.global_queue, job);
+}
+
+///
+// Scheduling
+
+void _job_run(Job job) {
+	job.proc(job.data);
+
+	if (job.counter) _job_counter_add(job.counter, -1);
+}
+
+bool _job_find(Job_Worker *w, Job *job) {
+	if (job_deque_pop(&w->deque, job)) return true;
+	if (_job_global_queue_pop(job)) return true;
+
+	u64 n = job_system.worker_count;
+	if (n <= 1) return false;
+
+	// xorshift, just to spread out which victim we start stealing from
+	w->steal_seed ^= w->steal_seed << 13;
+	w->steal_seed ^= w->steal_seed >> 7;
+	w->steal_seed ^= w->steal_seed << 17;
+	u64 start = w->steal_seed % n;
+
+	for (u64 i = 0; i < n; i++) {
+		Job_Worker *victim = &job_system.workers[(start + i) % n];
+		if (victim == w) continue;
+		if (job_deque_steal(&victim->deque, job)) return true;
+	}
+	return false;
+}
+
+
+///
+// Fibers
+
+noinline void _job_fiber_reset_temporary_storage() {
+	reset_temporary_storage();
+}
+
+void _job_fiber_proc(void *data) {
+	Job_Fiber *f = (Job_Fiber*)data;
+	while (true) {
+		_job_fiber_reset_temporary_storage();
+		_job_run(f->job);
+
+		f->state = JOB_FIBER_DONE;
+		os_fiber_switch(_job_get_current_worker()->scheduler_fiber);
+	}
+}
+
+Job_Fiber *_job_take_free_fiber() {
+	Job_Fiber *f = 0;
+	spinlock_acquire_or_wait(&job_system.fiber_lock);
+	if (job_system.free_fiber_count > 0) {
+		job_system.free_fiber_count -= 1;
+		f = job_system.free_fibers[job_system.free_fiber_count];
+	}
+	spinlock_release(&job_system.fiber_lock);
+	return f;
+}
+
+// A parked fiber whose counter has reached zero
+Job_Fiber *_job_take_ready_fiber() {
+	if (job_system.waiting_fiber_count == 0) return 0;
+
+	Job_Fiber *f = 0;
+	spinlock_acquire_or_wait(&job_system.fiber_lock);
+	for (u64 i = 0; i < job_system.waiting_fiber_count; i++) {
+		Job_Fiber *waiting = job_system.waiting_fibers[i];
+		if (waiting->wait_counter->value == 0) {
+			f = waiting;
+			job_system.waiting_fiber_count -= 1;
+			job_system.waiting_fibers[i] = job_system.waiting_fibers[job_system.waiting_fiber_count];
+			break;
+		}
+	}
+	spinlock_release(&job_system.fiber_lock);
+	return f;
+}
+
+// Runs the fiber until it finishes its job or parks itself
+void _job_resume_fiber(Job_Worker *w, Job_Fiber *f) {
+	void *thread_temporary_storage = temporary_storage;
+	void *thread_temporary_storage_pointer = temporary_storage_pointer;
+	u64 thread_temporary_storage_size = temporary_storage_size;
+	if (!f->temporary_storage) {
+		f->temporary_storage = heap_alloc(JOB_FIBER_TEMPORARY_STORAGE_SIZE);
+		f->temporary_storage_pointer = f->temporary_storage;
+	}
+	temporary_storage = f->temporary_storage;
+	temporary_storage_pointer = f->temporary_storage_pointer;
+	temporary_storage_size = JOB_FIBER_TEMPORARY_STORAGE_SIZE;
+
+	f->state = JOB_FIBER_RUNNING;
+	w->current_fiber = f;
+
+	u64 start = profiler_get_ticks();
+	os_fiber_switch(f->handle);
+	u64 end = profiler_get_ticks();
+
+	w->current_fiber = 0;
+
+	f->temporary_storage_pointer = temporary_storage_pointer;
+	temporary_storage = thread_temporary_storage;
+	temporary_storage_pointer = thread_temporary_storage_pointer;
+	temporary_storage_size = thread_temporary_storage_size;
+
+#if ENABLE_PROFILING
+	_profiler_report_time_cycles(f->state == JOB_FIBER_WAITING ? STR("Job fiber yield") : STR("Job fiber"), end-start, start);
+#endif
+
+	// The fiber is switched out now, so it's safe to let other workers pick it up
+	spinlock_acquire_or_wait(&job_system.fiber_lock);
+	if (f->state == JOB_FIBER_WAITING) {
+		job_system.waiting_fibers[job_system.waiting_fiber_count] = f;
+		job_system.waiting_fiber_count += 1;
+	} else {
+		assert(f->state == JOB_FIBER_DONE, "Job fiber switched out in unexpected state %d", f->state);
+		f->state = JOB_FIBER_IDLE;
+		job_system.free_fibers[job_system.free_fiber_count] = f;
+		job_system.free_fiber_count += 1;
+	}
+	spinlock_release(&job_system.fiber_lock);
+}
+
+// Resumes a ready fiber or starts a new job. Returns false if there was nothing to do.
+bool _job_scheduler_step(Job_Worker *w) {
+	Job_Fiber *f = _job_take_ready_fiber();
+	if (!f) {
+		Job job;
+		if (!_job_find(w, &job)) return false;
+
+		f = _job_take_free_fiber();
+		if (!f) {
+			// All fibers are busy or parked, run it right here instead
+			_job_run(job);
+			return true;
+		}
+		f->job = job;
+	}
+
+	_job_resume_fiber(w, f);
+	return true;
+}
+
+// Spin a little, then yield, then sleep until there's something to do.
+// generation is wake_generation from before we last looked for work.
+void _job_idle(Job_Worker *w, u64 *idle_count, u32 generation) {
+	*idle_count += 1;
+	if (*idle_count < 64) {
+		_mm_pause();
+	} else if (*idle_count < 256) {
+		os_yield_thread();
+	} else {
+		atomic_fetch_add_32(&job_system.sleeping_worker_count, 1);
+
+		// Look again now that submitters can see us sleeping. Either we find the job, or
+		// the submitter saw us and bumped wake_generation so the wait returns right away.
+		if (_job_scheduler_step(w)) {
+			reset_temporary_storage();
+			*idle_count = 0;
+		} else if (job_system.running) {
+			os_wait_on_address(&job_system.wake_generation, &generation, sizeof(u32), OS_WAIT_INFINITE);
+		}
+
+		atomic_fetch_add_32(&job_system.sleeping_worker_count, (u32)-1);
+	}
+}
+
+void job_worker_thread_proc(Thread *t) {
+	Job_Worker *w = (Job_Worker*)t->data;
+	_job_current_worker = w;
+	w->scheduler_fiber = os_fiber_convert_current_thread();
+	profiler_set_thread_name(tprint("Job worker %llu", w->index));
+
+	// Keep going until shutdown and there's nothing left to do
+	u64 idle_count = 0;
+	while (true) {
+		u32 generation = atomic_load_acquire_32(&job_system.wake_generation);
+		if (_job_scheduler_step(w)) {
+			reset_temporary_storage();
+			idle_count = 0;
+		} else if (!job_system.running) {
+			break;
+		} else {
+			_job_idle(w, &idle_count, generation);
+		}
+	}
+
+	os_fiber_convert_back_to_thread();
+}
+
+void job_system_init(u64 worker_count) {
+	assert(!job_system.running, "Job system is already initialized");
+
+	if (worker_count == 0) worker_count = os_get_number_of_logical_processors();
+	worker_count = clamp(worker_count, 1, MAX_JOB_WORKERS);
+
+	mpmc_queue_init(&job_system.global_queue, sizeof(Job), JOB_GLOBAL_QUEUE_CAPACITY, get_heap_allocator());
+	job_system.wake_generation = 0;
+	job_system.sleeping_worker_count = 0;
+
+	spinlock_init(&job_system.fiber_lock);
+	job_system.free_fiber_count = 0;
+	job_system.waiting_fiber_count = 0;
+	for (u64 i = 0; i < JOB_FIBER_COUNT; i++) {
+		Job_Fiber *f = &job_system.fibers[i];
+		f->handle = os_fiber_create(_job_fiber_proc, f, JOB_FIBER_STACK_SIZE);
+		f->state = JOB_FIBER_IDLE;
+		f->temporary_storage = 0; // Allocated the first time the fiber runs
+		f->temporary_storage_pointer = 0;
+		job_system.free_fibers[job_system.free_fiber_count] = f;
+		job_system.free_fiber_count += 1;
+	}
+
+	job_system.worker_count = worker_count;
+	job_system.workers = (Job_Worker*)alloc(get_heap_allocator(), worker_count*sizeof(Job_Worker));
+
+	for (u64 i = 0; i < worker_count; i++) {
+		Job_Worker *w = &job_system.workers[i];
+		w->index = i;
+		w->steal_seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+		w->deque.top = 0;
+		w->deque.bottom = 0;
+		w->deque.jobs = (Job*)alloc(get_heap_allocator(), JOB_DEQUE_CAPACITY*sizeof(Job));
+		w->current_fiber = 0;
+	}
+
+	_job_current_worker = &job_system.workers[0];
+	job_system.workers[0].scheduler_fiber = os_fiber_convert_current_thread();
+
+	job_system.running = true;
+	MEMORY_BARRIER;
+
+	for (u64 i = 1; i < worker_count; i++) {
+		Job_Worker *w = &job_system.workers[i];
+		os_thread_init(&w->thread, job_worker_thread_proc);
+		w->thread.data = w;
+		w->thread.temporary_storage_size = JOB_FIBER_TEMPORARY_STORAGE_SIZE; // For jobs that run without a fiber
+		os_thread_start(&w->thread);
+	}
+}
+
+void job_system_shutdown() {
+	if (!job_system.running) return;
+
+	job_system.running = false;
+	atomic_fetch_add_32(&job_system.wake_generation, 1);
+	os_wake_all_waiting_on_address(&job_system.wake_generation);
+
+	// Help finish whatever is queued up
+	while (_job_scheduler_step(&job_system.workers[0]) || job_system.waiting_fiber_count > 0) {}
+
+	for (u64 i = 1; i < job_system.worker_count; i++) {
+		os_thread_join(&job_system.workers[i].thread);
+	}
+
+	assert(job_system.waiting_fiber_count == 0, "Job system shut down while %llu jobs are still waiting on counters", job_system.waiting_fiber_count);
+
+	for (u64 i = 0; i < JOB_FIBER_COUNT; i++) {
+		os_fiber_destroy(job_system.fibers[i].handle);
+		if (job_system.fibers[i].temporary_storage) heap_dealloc(job_system.fibers[i].temporary_storage);
+	}
+
+	for (u64 i = 0; i < job_system.worker_count; i++) {
+		dealloc(get_heap_allocator(), job_system.workers[i].deque.jobs);
+	}
+	dealloc(get_heap_allocator(), job_system.workers);
+	mpmc_queue_destroy(&job_system.global_queue);
+	job_system.workers = 0;
+	job_system.worker_count = 0;
+	_job_current_worker = 0;
+
+	os_fiber_convert_back_to_thread();
+}
+
+void _job_push(Job job) {
+	Job_Worker *w = _job_get_current_worker();
+	bool ok;
+	if (w) ok = job_deque_push(&w->deque, job);
+	else   ok = _job_global_queue_push(job);
+
+	if (ok) _job_wake_sleeping_worker();
+	else    _job_run(job); // Queue is full, just do it now
+}
+
+void job_submit(Job_Proc proc, void *data, Job_Counter *counter) {
+	Job job = (Job){proc, data, counter};
+	if (counter) _job_counter_add(counter, 1);
+
+	if (!job_system.running) {
+		_job_run(job);
+		return;
+	}
+
+	_job_push(job);
+}
+
+void job_submit_many(Job *jobs, u64 count, Job_Counter *counter) {
+	if (counter) _job_counter_add(counter, (s64)count);
+
+	for (u64 i = 0; i < count; i++) {
+		Job job = jobs[i];
+		job.counter = counter;
+
+		if (!job_system.running) _job_run(job);
+		else                     _job_push(job);
+	}
+}
+
+void job_wait_for_counter(Job_Counter *counter) {
+	if (counter->value == 0) return;
+
+	Job_Worker *w = _job_get_current_worker();
+	if (w && w->current_fiber) {
+		// Park this fiber. We might be resumed on another worker.
+		Job_Fiber *f = w->current_fiber;
+		f->wait_counter = counter;
+		f->state = JOB_FIBER_WAITING;
+		os_fiber_switch(w->scheduler_fiber);
+		return;
+	}
+
+	u64 idle_count = 0;
+	while (counter->value != 0) {
+		if (w && _job_scheduler_step(w)) {
+			idle_count = 0;
+		} else {
+			// Don't sleep, the jobs we wait for might finish any moment
+			if (idle_count < 64) { _mm_pause(); idle_count += 1; }
+			else os_yield_thread();
+		}
+	}
+}
+
+typedef struct Parallel_For_Batch {
+	Parallel_For_Proc proc;
+	void *userdata;
+	u64 first;
+	u64 end;
+} Parallel_For_Batch;
+
+void _parallel_for_job(void *data) {
+	Parallel_For_Batch *batch = (Parallel_For_Batch*)data;
+	batch->proc(batch->first, batch->end, batch->userdata);
+}
+
+void parallel_for(u64 count, u64 batch_size, Parallel_For_Proc proc, void *userdata) {
+	if (count == 0) return;
+
+	if (batch_size == 0) {
+		// A few batches per worker so stealing can even out uneven batches
+		batch_size = max(count / (max(job_system.worker_count, 1)*4), 1);
+	}
+
+	u64 batch_count = (count + batch_size - 1) / batch_size;
+	if (batch_count == 1 || !job_system.running) {
+		proc(0, count, userdata);
+		return;
+	}
+
+	// We wait for all of these before returning, so temp is fine. In a job this is the
+	// fiber's temp storage, which stays put while we wait. Lots of tiny batches would eat
+	// too much of it though.
+	u64 bookkeeping_size = batch_count*(sizeof(Parallel_For_Batch)+sizeof(Job));
+	bool on_heap = bookkeeping_size > PARALLEL_FOR_MAX_TEMPORARY_BYTES;
+	void *bookkeeping = on_heap ? alloc(get_heap_allocator(), bookkeeping_size) : talloc(bookkeeping_size);
+	Parallel_For_Batch *batches = (Parallel_For_Batch*)bookkeeping;
+	Job *jobs = (Job*)(batches + batch_count);
+
+	for (u64 i = 0; i < batch_count; i++) {
+		batches[i].proc = proc;
+		batches[i].userdata = userdata;
+		batches[i].first = i*batch_size;
+		batches[i].end = min((i+1)*batch_size, count);
+
+		jobs[i].proc = _parallel_for_job;
+		jobs[i].data = &batches[i];
+		jobs[i].counter = 0;
+	}
+
+	Job_Counter counter = {0};
+
+	// Submit in reverse so the owner pops batch 1 first and thieves steal from the end
+	// (which is the top of the deque).
+	for (u64 i = batch_count-1; i >= 1; i--) {
+		job_submit_many(&jobs[i], 1, &counter);
+	}
+
+	_parallel_for_job(&batches[0]);
+
+	job_wait_for_counter(&counter);
+	
+	if (on_heap) dealloc(get_heap_allocator(), bookkeeping);
+}
+
+u64 job_get_worker_count() {
+	return job_system.running ? job_system.worker_count : 1;
+}
+
+s64 job_get_current_worker_index() {
+	Job_Worker *w = _job_get_current_worker();
+	return w ? (s64)w->index : -1;
+}
+
+typedef struct Radix_Sort_Parallel_State {
+	u8 *src;
+	u8 *dst;
+	u64 item_count;
+	u64 item_size;
+	u64 sort_value_offset_in_item;
+	u64 bias;
+	u64 block_size;
+	u32 pass_count;
+	u32 pass;
+	u64 *counts;  // [block][pass][RADIX_SORT_RADIX]
+	u64 *offsets; // [block][RADIX_SORT_RADIX]
+} Radix_Sort_Parallel_State;
+
+void _radix_sort_parallel_count_all_passes(u64 first, u64 end, void *userdata) {
+	Radix_Sort_Parallel_State *s = (Radix_Sort_Parallel_State*)userdata;
+	for (u64 block = first; block < end; block++) {
+		u64 *counts = s->counts + block*s->pass_count*RADIX_SORT_RADIX;
+		memset(counts, 0, sizeof(u64)*s->pass_count*RADIX_SORT_RADIX);
+		u64 item_end = min((block+1)*s->block_size, s->item_count);
+		_radix_sort_count(s->src, block*s->block_size, item_end, s->item_size, s->sort_value_offset_in_item, s->bias, s->pass_count, counts);
+	}
+}
+void _radix_sort_parallel_count_pass(u64 first, u64 end, void *userdata) {
+	Radix_Sort_Parallel_State *s = (Radix_Sort_Parallel_State*)userdata;
+	u32 shift = s->pass*RADIX_SORT_BITS_PER_PASS;
+	for (u64 block = first; block < end; block++) {
+		u64 *count = s->counts + (block*s->pass_count + s->pass)*RADIX_SORT_RADIX;
+		memset(count, 0, sizeof(u64)*RADIX_SORT_RADIX);
+		u64 item_end = min((block+1)*s->block_size, s->item_count);
+		for (u64 i = block*s->block_size; i < item_end; i++) {
+			u64 sort_value = _radix_sort_key(s->src + i*s->item_size, s->sort_value_offset_in_item, s->bias);
+			++count[(sort_value >> shift) & (RADIX_SORT_RADIX-1)];
+		}
+	}
+}
+void _radix_sort_parallel_scatter(u64 first, u64 end, void *userdata) {
+	Radix_Sort_Parallel_State *s = (Radix_Sort_Parallel_State*)userdata;
+	u32 shift = s->pass*RADIX_SORT_BITS_PER_PASS;
+	for (u64 block = first; block < end; block++) {
+		u64 offsets[RADIX_SORT_RADIX];
+		memcpy(offsets, s->offsets + block*RADIX_SORT_RADIX, sizeof(offsets));
+		u64 item_end = min((block+1)*s->block_size, s->item_count);
+		for (u64 i = block*s->block_size; i < item_end; i++) {
+			u8 *item = s->src + i*s->item_size;
+			u64 sort_value = _radix_sort_key(item, s->sort_value_offset_in_item, s->bias);
+			u32 digit = (sort_value >> shift) & (RADIX_SORT_RADIX-1);
+			_radix_sort_copy_item(s->dst + offsets[digit]*s->item_size, item, s->item_size);
+			++offsets[digit];
+		}
+	}
+}
+
+void _radix_sort_parallel_generic(void *collection, void *help_buffer, u64 item_count, u64 item_size, u64 sort_value_offset_in_item, u64 number_of_bits, u64 bias) {
+	u64 block_count = min(job_get_worker_count(), item_count/RADIX_SORT_PARALLEL_MIN_ITEMS_PER_BLOCK);
+	block_count = min(block_count, RADIX_SORT_PARALLEL_MAX_BLOCKS);
+	if (block_count <= 1) {
+		_radix_sort_generic(collection, help_buffer, item_count, item_size, sort_value_offset_in_item, number_of_bits, bias);
+		return;
+	}
+	
+	assert(number_of_bits > 0 && number_of_bits <= 64, "radix_sort number_of_bits must be 1-64");
+	
+	Radix_Sort_Parallel_State s;
+	s.src = (u8*)collection;
+	s.dst = (u8*)help_buffer;
+	s.item_count = item_count;
+	s.item_size = item_size;
+	s.sort_value_offset_in_item = sort_value_offset_in_item;
+	s.bias = bias;
+	s.block_size = (item_count + block_count - 1) / block_count;
+	s.pass_count = (u32)((number_of_bits + RADIX_SORT_BITS_PER_PASS - 1) / RADIX_SORT_BITS_PER_PASS);
+	s.pass = 0;
+	block_count = (item_count + s.block_size - 1) / s.block_size;
+	
+	// #Memory #Heapalloc
+	s.counts = (u64*)alloc(get_heap_allocator(), sizeof(u64)*block_count*s.pass_count*RADIX_SORT_RADIX);
+	s.offsets = (u64*)alloc(get_heap_allocator(), sizeof(u64)*block_count*RADIX_SORT_RADIX);
+	
+	// Digit totals don't change when items move around, so one count tells us which passes
+	// to skip. The per block counts are only valid until the first scatter.
+	parallel_for(block_count, 1, _radix_sort_parallel_count_all_passes, &s);
+	bool block_counts_valid = true;
+	
+	for (u32 pass = 0; pass < s.pass_count; pass++) {
+		s.pass = pass;
+		
+		u64 total[RADIX_SORT_RADIX] = {0};
+		for (u64 block = 0; block < block_count; block++) {
+			u64 *count = s.counts + (block*s.pass_count + pass)*RADIX_SORT_RADIX;
+			for (u32 d = 0; d < RADIX_SORT_RADIX; d++) total[d] += count[d];
+		}
+		if (_radix_sort_pass_is_trivial(total, item_count)) continue;
+		
+		if (!block_counts_valid) parallel_for(block_count, 1, _radix_sort_parallel_count_pass, &s);
+		
+		// Items with the same digit are placed in block order, which keeps the sort stable
+		u64 offset = 0;
+		for (u32 d = 0; d < RADIX_SORT_RADIX; d++) {
+			for (u64 block = 0; block < block_count; block++) {
+				s.offsets[block*RADIX_SORT_RADIX + d] = offset;
+				offset += s.counts[(block*s.pass_count + pass)*RADIX_SORT_RADIX + d];
+			}
+		}
+		
+		parallel_for(block_count, 1, _radix_sort_parallel_scatter, &s);
+		
+		swap(s.src, s.dst, u8*);
+		block_counts_valid = false;
+	}
+	
+	if (s.src != collection) memcpy(collection, s.src, item_count*item_size);
+	
+	dealloc(get_heap_allocator(), s.counts);
+	dealloc(get_heap_allocator(), s.offsets);
+}
+
+void radix_sort_parallel(void *collection, void *help_buffer, u64 item_count, u64 item_size, u64 sort_value_offset_in_item, u64 number_of_bits) {
+	_radix_sort_parallel_generic(collection, help_buffer, item_count, item_size, sort_value_offset_in_item, number_of_bits, 1ULL << (number_of_bits - 1));
+}
+void radix_sort_pairs_parallel(Radix_Sort_Pair *pairs, Radix_Sort_Pair *help_buffer, u64 item_count, u64 number_of_bits) {
+	_radix_sort_parallel_generic(pairs, help_buffer, item_count, sizeof(Radix_Sort_Pair), offsetof(Radix_Sort_Pair, key), number_of_bits, 0);
+}
+
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
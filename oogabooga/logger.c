@@ -0,0 +1,322 @@
+
+///
+///
+// Asynchronous logging
+///
+// log_xxx() copies the formatted message into a lock-free ring buffer owned by the calling
+// thread. A background thread drains all rings in batches and writes them to stdout and
+// (optionally) a log file, so latency sensitive threads like the audio thread never have
+// to wait for console I/O.
+//
+// Messages from the same thread are always written in order, but messages from different
+// threads may be interleaved differently than they were logged.
+//
+// If the logger thread is not running, messages are written synchronously.
+
+#ifndef LOG_RING_SIZE
+	#define LOG_RING_SIZE KB(64) // Per thread, must be a power of two
+#endif
+#define LOG_MAX_THREAD_RINGS 128
+#define LOG_FLUSH_INTERVAL_MS 2
+#define LOG_MAX_MESSAGE_SIZE (LOG_RING_SIZE/4) // Longer messages are truncated
+#define LOG_BATCH_SIZE KB(32)
+
+typedef enum Log_Overflow_Policy {
+	LOG_OVERFLOW_DROP,  // Drop the message if the ring is full. Dropped messages are counted and reported.
+	LOG_OVERFLOW_BLOCK, // Wait for the logger thread to make room in the ring.
+} Log_Overflow_Policy;
+
+typedef struct Log_Record_Header {
+	u32 size; // Message size, excluding header
+	u32 level;
+} Log_Record_Header;
+
+// Single producer (the owning thread), single consumer (whoever holds flush_lock)
+typedef struct Log_Ring {
+	volatile u64 write_pos;
+	u8 _pad0[64-sizeof(u64)]; // Keep producer and consumer on different cache lines
+	volatile u64 read_pos;
+	u8 _pad1[64-sizeof(u64)];
+
+	u8 *buffer;
+	volatile u64 dropped_count;
+	u64 reported_dropped_count;
+	volatile bool claimed;
+} Log_Ring;
+
+typedef struct Async_Logger {
+	Log_Ring rings[LOG_MAX_THREAD_RINGS];
+
+	Log_Overflow_Policy overflow_policy;
+	File file;
+
+	Thread thread;
+	volatile bool running;
+
+	Spinlock flush_lock;
+	u8 batch[LOG_BATCH_SIZE];
+	u64 batch_count;
+
+	// Used when there is no ring available
+	Spinlock fallback_lock;
+} Async_Logger;
+
+// #Global
+ogb_instance Async_Logger async_logger;
+
+void ogb_instance
+async_logger_init();
+
+void ogb_instance
+async_logger_shutdown();
+
+// Writes everything that has been logged so far, on the calling thread.
+void ogb_instance
+log_flush();
+
+// Also write logs to a file. Pass an empty string to stop writing to file.
+// Requires ENABLE_ASYNC_LOGGING.
+bool ogb_instance
+log_set_output_file(string path);
+
+void ogb_instance
+log_set_overflow_policy(Log_Overflow_Policy policy);
+
+u64 ogb_instance
+log_get_dropped_count();
+
+void ogb_instance
+async_logger_push(Log_Level level, string s);
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+Async_Logger async_logger = {0};
+thread_local Log_Ring *_log_thread_ring = 0;
+
+string _log_level_prefix(Log_Level level) {
+	switch (level) {
+		case LOG_VERBOSE: return STR("[VERBOSE]: ");
+		case LOG_INFO:    return STR("[INFO]:    ");
+		case LOG_WARNING: return STR("[WARNING]: ");
+		case LOG_ERROR:   return STR("[ERROR]:   ");
+		case LOG_LEVEL_COUNT: break;
+	}
+	return STR("");
+}
+
+void _log_batch_submit() {
+	if (async_logger.batch_count == 0) return;
+
+	string s = (string){async_logger.batch_count, async_logger.batch};
+	os_write_string_to_stdout(s);
+	if (async_logger.file != OS_INVALID_FILE) os_file_write_string(async_logger.file, s);
+
+	async_logger.batch_count = 0;
+}
+void _log_batch_append(string s) {
+	while (s.count > 0) {
+		if (async_logger.batch_count == LOG_BATCH_SIZE) _log_batch_submit();
+
+		u64 n = min(s.count, LOG_BATCH_SIZE-async_logger.batch_count);
+		memcpy(async_logger.batch+async_logger.batch_count, s.data, n);
+		async_logger.batch_count += n;
+		s.data  += n;
+		s.count -= n;
+	}
+}
+
+// Copies out of the ring, handling wrap-around
+void _log_ring_read(Log_Ring *ring, u64 pos, void *dst, u64 size) {
+	u64 offset = pos & (LOG_RING_SIZE-1);
+	u64 first = min(size, LOG_RING_SIZE-offset);
+	memcpy(dst, ring->buffer+offset, first);
+	memcpy((u8*)dst+first, ring->buffer, size-first);
+}
+void _log_ring_write(Log_Ring *ring, u64 pos, void *src, u64 size) {
+	u64 offset = pos & (LOG_RING_SIZE-1);
+	u64 first = min(size, LOG_RING_SIZE-offset);
+	memcpy(ring->buffer+offset, src, first);
+	memcpy(ring->buffer, (u8*)src+first, size-first);
+}
+
+void _log_drain_ring(Log_Ring *ring) {
+	u64 read_pos = ring->read_pos;
+	u64 write_pos = ring->write_pos;
+	MEMORY_BARRIER;
+
+	while (read_pos != write_pos) {
+		Log_Record_Header header;
+		_log_ring_read(ring, read_pos, &header, sizeof(header));
+
+		u8 message[LOG_MAX_MESSAGE_SIZE];
+		_log_ring_read(ring, read_pos+sizeof(header), message, header.size);
+
+		_log_batch_append(_log_level_prefix((Log_Level)header.level));
+		_log_batch_append((string){header.size, message});
+		_log_batch_append(STR("\n"));
+
+		read_pos += align_next(sizeof(header)+header.size, 8);
+	}
+
+	MEMORY_BARRIER;
+	ring->read_pos = read_pos;
+
+	u64 dropped_count = ring->dropped_count;
+	if (dropped_count != ring->reported_dropped_count) {
+		char buffer[128];
+		u64 n = format_string_to_buffer_va(buffer, sizeof(buffer), "[WARNING]: Logger dropped %llu messages because a log ring was full\n", dropped_count-ring->reported_dropped_count);
+		_log_batch_append((string){n, (u8*)buffer});
+		ring->reported_dropped_count = dropped_count;
+	}
+}
+
+void _log_flush_rings() {
+	for (u64 i = 0; i < LOG_MAX_THREAD_RINGS; i++) {
+		Log_Ring *ring = &async_logger.rings[i];
+		if (!ring->buffer) continue;
+		_log_drain_ring(ring);
+	}
+	_log_batch_submit();
+}
+
+void log_flush() {
+	spinlock_acquire_or_wait(&async_logger.flush_lock);
+	_log_flush_rings();
+	spinlock_release(&async_logger.flush_lock);
+}
+
+void _log_flush_on_crash() {
+	// The logger thread might be the one crashing, or just be in the middle of a flush.
+	// Either way, we would rather get duplicate output than none at all.
+	bool acquired = spinlock_acquire_or_wait_timeout(&async_logger.flush_lock, 0.1);
+	_log_flush_rings();
+	if (acquired) spinlock_release(&async_logger.flush_lock);
+}
+
+void async_logger_thread_proc(Thread *t) {
+	profiler_set_thread_name(STR("Logger"));
+	while (async_logger.running) {
+		log_flush();
+		os_sleep(LOG_FLUSH_INTERVAL_MS);
+	}
+	log_flush();
+}
+
+void async_logger_init() {
+	spinlock_init(&async_logger.flush_lock);
+	spinlock_init(&async_logger.fallback_lock);
+	async_logger.file = OS_INVALID_FILE;
+	async_logger.overflow_policy = LOG_OVERFLOW_DROP;
+
+	add_crash_hook(_log_flush_on_crash);
+
+	async_logger.running = true;
+	os_thread_init(&async_logger.thread, async_logger_thread_proc);
+	async_logger.thread.initial_context.logger = 0; // The logger thread must never log
+	os_thread_start(&async_logger.thread);
+}
+void async_logger_shutdown() {
+	if (!async_logger.running) return;
+
+	async_logger.running = false;
+	os_thread_join(&async_logger.thread);
+
+	if (async_logger.file != OS_INVALID_FILE) {
+		os_file_close(async_logger.file);
+		async_logger.file = OS_INVALID_FILE;
+	}
+}
+
+bool log_set_output_file(string path) {
+	if (!async_logger.running) return false;
+	
+	spinlock_acquire_or_wait(&async_logger.flush_lock);
+
+	if (async_logger.file != OS_INVALID_FILE) os_file_close(async_logger.file);
+	async_logger.file = OS_INVALID_FILE;
+
+	if (path.count > 0) async_logger.file = os_file_open_s(path, O_CREATE | O_WRITE);
+
+	spinlock_release(&async_logger.flush_lock);
+
+	return path.count == 0 || async_logger.file != OS_INVALID_FILE;
+}
+
+void log_set_overflow_policy(Log_Overflow_Policy policy) {
+	async_logger.overflow_policy = policy;
+}
+
+u64 log_get_dropped_count() {
+	u64 n = 0;
+	for (u64 i = 0; i < LOG_MAX_THREAD_RINGS; i++) n += async_logger.rings[i].dropped_count;
+	return n;
+}
+
+Log_Ring *_log_claim_thread_ring() {
+	for (u64 i = 0; i < LOG_MAX_THREAD_RINGS; i++) {
+		Log_Ring *ring = &async_logger.rings[i];
+		if (!ring->claimed && compare_and_swap_bool(&ring->claimed, true, false)) {
+			if (!ring->buffer) {
+				u8 *buffer = (u8*)alloc(get_heap_allocator(), LOG_RING_SIZE);
+				MEMORY_BARRIER;
+				ring->buffer = buffer;
+			}
+			return ring;
+		}
+	}
+	return 0;
+}
+// Called when a thread exits so its ring can be reused by another thread.
+// Anything left in the ring is still flushed as normal.
+void _log_release_thread_ring() {
+	if (!_log_thread_ring) return;
+	MEMORY_BARRIER;
+	_log_thread_ring->claimed = false;
+	_log_thread_ring = 0;
+}
+
+void _log_write_synchronous(Log_Level level, string s) {
+	spinlock_acquire_or_wait(&async_logger.fallback_lock);
+	print("%s%s\n", _log_level_prefix(level), s);
+	spinlock_release(&async_logger.fallback_lock);
+}
+
+void async_logger_push(Log_Level level, string s) {
+	if (!async_logger.running) {
+		_log_write_synchronous(level, s);
+		return;
+	}
+
+	if (!_log_thread_ring) _log_thread_ring = _log_claim_thread_ring();
+	Log_Ring *ring = _log_thread_ring;
+	if (!ring) {
+		_log_write_synchronous(level, s);
+		return;
+	}
+
+	if (s.count > LOG_MAX_MESSAGE_SIZE) s.count = LOG_MAX_MESSAGE_SIZE;
+
+	Log_Record_Header header;
+	header.size = (u32)s.count;
+	header.level = (u32)level;
+
+	u64 record_size = align_next(sizeof(header)+s.count, 8);
+	u64 write_pos = ring->write_pos;
+
+	while (write_pos + record_size - ring->read_pos > LOG_RING_SIZE) {
+		if (async_logger.overflow_policy == LOG_OVERFLOW_DROP || !async_logger.running) {
+			ring->dropped_count += 1;
+			return;
+		}
+		os_yield_thread();
+	}
+	MEMORY_BARRIER;
+
+	_log_ring_write(ring, write_pos, &header, sizeof(header));
+	_log_ring_write(ring, write_pos+sizeof(header), s.data, s.count);
+
+	MEMORY_BARRIER;
+	ring->write_pos = write_pos + record_size;
+}
+
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
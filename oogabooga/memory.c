@@ -87,11 +87,13 @@ typedef alignat(16) struct Heap_Allocation_Metadata {
 ogb_instance Heap_Block *heap_head;
 ogb_instance bool heap_initted;
 ogb_instance Spinlock heap_lock;
+ogb_instance u64 heap_bytes_in_use; // Sum of the sizes of all live heap allocations
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 Heap_Block *heap_head;
 bool heap_initted = false;
 Spinlock heap_lock;
+u64 heap_bytes_in_use = 0;
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 	
 
@@ -377,6 +379,7 @@ void *heap_alloc(u64 size) {
 	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)best_fit;
 	meta->size = size;
 	meta->block = best_fit_block;
+	heap_bytes_in_use += size;
 #if CONFIGURATION == DEBUG
 	meta->signature = HEAP_META_SIGNATURE;
 	meta->block->total_allocated += size;
@@ -411,6 +414,7 @@ void heap_dealloc(void *p) {
 	// Yoink meta data before we start overwriting it
 	Heap_Block *block = meta->block;
 	u64 size = meta->size;
+	heap_bytes_in_use -= size;
 	
 #if CONFIGURATION == DEBUG
 	memset(p, 0x69696969, size);
@@ -585,7 +589,9 @@ get_temporary_allocator();
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 thread_local void * temporary_storage = 0;
 thread_local void * temporary_storage_pointer = 0;
+thread_local u64    temporary_storage_size = 0;
 thread_local bool   has_warned_temporary_storage_overflow = false;
+thread_local u64    temporary_storage_high_water = 0; // Most bytes used before any reset
 thread_local Allocator temp_allocator;
 
 ogb_instance Allocator 
@@ -631,6 +637,7 @@ void temporary_storage_init(u64 arena_size) {
 	temporary_storage = heap_alloc(arena_size);
 	assert(temporary_storage, "Failed allocating temporary storage");
 	temporary_storage_pointer = temporary_storage;
+	temporary_storage_size = arena_size;
 
 	temp_allocator.proc = temp_allocator_proc;
 	temp_allocator.data = 0;
@@ -640,13 +647,13 @@ void temporary_storage_init(u64 arena_size) {
 
 void* talloc(u64 size) {
 	
-	assert(size < TEMPORARY_STORAGE_SIZE, "Bruddah this is too large for temp allocator");
+	assert(size < temporary_storage_size, "Bruddah this is too large for temp allocator");
 	
 	void* p = temporary_storage_pointer;
 	
 	temporary_storage_pointer = (u8*)temporary_storage_pointer + size;
 	
-	if ((u8*)temporary_storage_pointer >= (u8*)temporary_storage+TEMPORARY_STORAGE_SIZE) {
+	if ((u8*)temporary_storage_pointer >= (u8*)temporary_storage+temporary_storage_size) {
 		if (!has_warned_temporary_storage_overflow) {
 			os_write_string_to_stdout(STR("WARNING: temporary storage was overflown, we wrap around at the start.\n"));
 			has_warned_temporary_storage_overflow = true;
@@ -659,6 +666,10 @@ void* talloc(u64 size) {
 }
 
 void reset_temporary_storage() {
+	u64 used = (u8*)temporary_storage_pointer-(u8*)temporary_storage;
+	if (has_warned_temporary_storage_overflow) used = temporary_storage_size;
+	temporary_storage_high_water = max(temporary_storage_high_water, used);
+	
 	temporary_storage_pointer = temporary_storage;	
 	has_warned_temporary_storage_overflow = false;
 }
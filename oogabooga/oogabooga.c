@@ -29,6 +29,17 @@
 			
 				#define OOGABOOGA_EXTENSION_PARTICLES 1
 				
+		- OOGABOOGA_EXTENSION_FRAME_HUD
+			Enable the 'frame hud' oogabooga extension to see frame times (p50/p99/max) and
+			tm_scope_accum buckets live in game. Toggled with F3, see ext_frame_hud.c.
+		
+			0: Disable
+			1: Enable
+			
+			Example:
+			
+				#define OOGABOOGA_EXTENSION_FRAME_HUD 1
+				
 	
 		- ENTRY_PROC
 			Define this as whatever the entry procedure of your program should be.
@@ -110,8 +121,32 @@
 			
 				#define RUN_TESTS 1
 				
+		- RUN_PERF_TESTS
+			Run a fixed set of the benchmarks in benchmarks.c before the program and fail if
+			any is slower than the checked in baseline (see oogabooga_run_perf_tests in
+			tests.c). Results are normalized by a calibration loop. The first run writes the
+			baseline. This is separate from RUN_TESTS, enable both to run both.
+		
+			0: Disable
+			1: Enable
+			
+			Example:
+			
+				#define RUN_PERF_TESTS 1
+				
+		- RUN_BENCHMARKS
+			Compile the benchmark runner (bench.c) and the engine benchmarks (benchmarks.c)
+			so you can call bench_main() or add your own with BENCH(). See build_bench.c.
+		
+			0: Disable
+			1: Enable
+			
+			Example:
+			
+				#define RUN_BENCHMARKS 1
+				
 		- ENABLE_PROFILING
-			Enable time profiling which will be dumped to google_trace.json.
+			Enable time profiling which will be streamed to google_trace.json.
 		
 			0: Disable
 			1: Enable
@@ -125,7 +160,47 @@
 					tm_scope
 					tm_scope_var
 					tm_scope_accum
+					tm_counter
+					tm_gauge
+				Captures can be limited to a window with profiler_start_capture/profiler_stop_capture,
+				see PROFILER_CAPTURE_ON_INIT, PROFILER_MAX_FILE_SIZE and PROFILER_MAX_FILE_SECONDS.
+				#define PROFILER_SAMPLING 1 to also sample call stacks of all threads without any
+				tm_scope, written to profile_samples.folded for flamegraphs.
 					
+		- ENABLE_LOCK_CONTENTION_STATS
+			Count how often Spinlock and Ticket_Lock had to wait and for how long (see
+			Lock_Stats in concurrency.c). With ENABLE_PROFILING, contended acquires also show
+			up as "Lock contention" in google_trace.json.
+			
+			0: Disable
+			1: Enable
+			
+			Example:
+			
+				#define ENABLE_LOCK_CONTENTION_STATS 1
+				
+		- ENABLE_ASYNC_LOGGING
+			Write logs from a background thread instead of on the thread that logs.
+			See logger.c
+			
+			0: Disable
+			1: Enable
+			
+			Example:
+			
+				// Log synchronously
+				#define ENABLE_ASYNC_LOGGING 0
+				
+		- JOB_WORKER_COUNT
+			Number of job system workers, including the main thread. See jobs.c
+			
+			0: One per logical processor
+			1: No worker threads, jobs run on the thread that submits them
+			
+			Example:
+			
+				#define JOB_WORKER_COUNT 4
+				
 		- OOGABOOGA_HEADLESS
             Run oogabooga in headless mode, i.e. no window, no graphics, no audio.
             Useful if you only need the oogabooga standard library for something like a game server.
@@ -219,6 +294,18 @@ typedef u8 bool;
 	#define ENABLE_SIMD 1
 #endif
 
+#ifndef ENABLE_LOCK_CONTENTION_STATS
+	#define ENABLE_LOCK_CONTENTION_STATS 0
+#endif
+
+#ifndef ENABLE_ASYNC_LOGGING
+	#define ENABLE_ASYNC_LOGGING 1
+#endif
+
+#ifndef JOB_WORKER_COUNT
+	#define JOB_WORKER_COUNT 0
+#endif
+
 #ifndef INITIAL_PROGRAM_MEMORY_SIZE
     #define INITIAL_PROGRAM_MEMORY_SIZE MB(5)
 #endif
@@ -271,13 +358,7 @@ typedef u8 bool;
 	#error "Current OS not supported!";
 #endif
 
-#if OOGABOOGA_LINK_EXTERNAL_INSTANCE
-    #define ogb_instance SHARED_IMPORT extern
-#elif OOGABOOGA_BUILD_SHARED_LIBRARY
-    #define ogb_instance SHARED_EXPORT
-#else
-    #define ogb_instance
-#endif
+// ogb_instance is defined in cpu.c, next to SHARED_EXPORT/SHARED_IMPORT
 
 
 // This needs to be included before dependencies
@@ -332,6 +413,8 @@ typedef u8 bool;
 #include "random.c"
 #include "color.c"
 #include "memory.c"
+#include "logger.c"
+#include "jobs.c"
 #include "input.c"
 
 #ifndef OOGABOOGA_HEADLESS
@@ -377,29 +460,18 @@ typedef u8 bool;
     
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
+#if RUN_BENCHMARKS || RUN_PERF_TESTS
+	#include "bench.c"
+	#include "benchmarks.c"
+#endif
 #include "tests.c"
 
 #define malloc please_use_alloc_for_memory_allocations_instead_of_malloc
 #define free please_use_dealloc_for_memory_deallocations_instead_of_free
 
-Mutex _default_logger_mutex;
-bool _default_logger_mutex_initted = false;
 void default_logger(Log_Level level, string s) {
-
-	if (!_default_logger_mutex_initted) {
-		mutex_init(&_default_logger_mutex);
-		_default_logger_mutex_initted = true;
-	}
-	
-	mutex_acquire_or_wait(&_default_logger_mutex);
-	switch (level) {
-		case LOG_VERBOSE: print("[VERBOSE]: %s\n", s); break;
-		case LOG_INFO:    print("[INFO]:    %s\n", s); break;
-		case LOG_WARNING: print("[WARNING]: %s\n", s); break;
-		case LOG_ERROR:   print("[ERROR]:   %s\n", s); break;
-		case LOG_LEVEL_COUNT: break;
-	}
-	mutex_release(&_default_logger_mutex);
+	// Never blocks on I/O, see logger.c
+	async_logger_push(level, s);
 }
 
 ogb_instance void oogabooga_init(u64 program_memory_size);
@@ -412,6 +484,13 @@ void oogabooga_init(u64 program_memory_size) {
 	os_init(program_memory_size);
 	heap_init();
 	temporary_storage_init(TEMPORARY_STORAGE_SIZE);
+#if ENABLE_PROFILING
+	profiler_init();
+#endif
+#if ENABLE_ASYNC_LOGGING
+	async_logger_init();
+#endif
+	if (JOB_WORKER_COUNT != 1) job_system_init(JOB_WORKER_COUNT);
 	log_info("Ooga booga version is %d.%02d.%03d", OGB_VERSION_MAJOR, OGB_VERSION_MINOR, OGB_VERSION_PATCH);
 #ifndef OOGABOOGA_HEADLESS
 	gfx_init();
@@ -432,6 +511,7 @@ void oogabooga_init(u64 program_memory_size) {
 	log_verbose("CPU has avx:    %cs", features.avx    ? "true" : "false");
 	log_verbose("CPU has avx2:   %cs", features.avx2   ? "true" : "false");
 	log_verbose("CPU has avx512: %cs", features.avx512 ? "true" : "false");
+	log_verbose("CPU has invariant TSC: %cs", features.invariant_tsc ? "true" : "false");
 	
 	Os_Monitor *m = os.primary_monitor;
 	log_verbose("Primary Monitor:\n\t%s\n\t%dhz\n\t%dx%d\n\tdpi: %d", m->name, m->refresh_rate, m->resolution_x, m->resolution_y, m->dpi);
@@ -448,6 +528,7 @@ int SHARED_EXPORT main(int argc, char **argv) {
 int main(int argc, char **argv) {
 #endif
 
+	add_crash_hook(_flush_all_output_on_crash);
 
 	print("Ooga booga program started\n");
 	oogabooga_init(INITIAL_PROGRAM_MEMORY_SIZE); 
@@ -461,17 +542,28 @@ int main(int argc, char **argv) {
 	#if RUN_TESTS
 		oogabooga_run_tests();
 	#endif
+	#if RUN_PERF_TESTS
+		print("Running perf tests...\n");
+		oogabooga_run_perf_tests();
+		print("Perf tests ok!\n");
+	#endif
 	
 	int code = ENTRY_PROC(argc, argv);
 	
 #if ENABLE_PROFILING
 	
 	dump_profile_result();
+	profiler_shutdown();
 	
 #endif
+
+	job_system_shutdown();
+	async_logger_shutdown();
 	
 	printf("Ooga booga program exit with code %i\n", code);
 	
+	os_flush_thread_output();
+	
 	return code;
 }
 #endif
@@ -596,6 +596,10 @@ DWORD WINAPI win32_thread_invoker(LPVOID param) {
 	
 	t->proc(t);
 	
+	_log_release_thread_ring();
+	_profiler_release_thread_buffer();
+	_output_thread_exit();
+	
 	heap_dealloc(temporary_storage);
 	
 	return 0;
@@ -661,6 +665,31 @@ void os_thread_join(Thread *t) {
 	WaitForSingleObject(t->os_handle, INFINITE);
 }
 
+///
+// Fibers
+
+Fiber_Handle os_fiber_convert_current_thread() {
+	Fiber_Handle f = ConvertThreadToFiberEx(0, FIBER_FLAG_FLOAT_SWITCH);
+	if (!f && GetLastError() == ERROR_ALREADY_FIBER) f = GetCurrentFiber();
+	assert(f, "Failed converting thread to fiber. error %d", GetLastError());
+	return f;
+}
+void os_fiber_convert_back_to_thread() {
+	ConvertFiberToThread();
+}
+Fiber_Handle os_fiber_create(Fiber_Proc proc, void *data, u64 stack_size) {
+	// On x64 the fiber start routine has the same calling convention as Fiber_Proc
+	Fiber_Handle f = CreateFiberEx(KB(16), stack_size, FIBER_FLAG_FLOAT_SWITCH, (LPFIBER_START_ROUTINE)proc, data);
+	assert(f, "Failed creating fiber. error %d", GetLastError());
+	return f;
+}
+void os_fiber_destroy(Fiber_Handle f) {
+	DeleteFiber(f);
+}
+void os_fiber_switch(Fiber_Handle f) {
+	SwitchToFiber(f);
+}
+
 ///
 // Mutex primitive
 
@@ -701,6 +730,25 @@ void os_unlock_mutex(Mutex_Handle m) {
 	assert(result, "Unlock mutex 0x%x failed with error %d", m, GetLastError());
 }
 
+///
+// Wait on address
+
+bool os_wait_on_address(volatile void *address, void *compare_address, u64 size, s64 timeout_ms) {
+	DWORD timeout = timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms;
+	BOOL ok = WaitOnAddress(address, compare_address, (SIZE_T)size, timeout);
+	if (!ok) {
+		assert(GetLastError() == ERROR_TIMEOUT, "WaitOnAddress failed with error %d", GetLastError());
+		return false;
+	}
+	return true;
+}
+void os_wake_one_waiting_on_address(volatile void *address) {
+	WakeByAddressSingle((PVOID)address);
+}
+void os_wake_all_waiting_on_address(volatile void *address) {
+	WakeByAddressAll((PVOID)address);
+}
+
 
 void os_sleep(u32 ms) {
     Sleep(ms);
@@ -787,6 +835,12 @@ void os_write_string_to_stdout(string s) {
 	
 	WriteFile(win32_stdout, s.data, s.count, 0, 0);
 }
+bool os_is_stdout_a_console() {
+	HANDLE win32_stdout = GetStdHandle(STD_OUTPUT_HANDLE);
+	if (win32_stdout == INVALID_HANDLE_VALUE || win32_stdout == 0) return false;
+	
+	return GetFileType(win32_stdout) == FILE_TYPE_CHAR;
+}
 
 
 
@@ -810,6 +864,7 @@ File os_file_open_s(string path, Os_Io_Open_Flags flags) {
 }
 
 void os_file_close(File f) {
+	_release_output_buffer(f);
     CloseHandle(f);
 }
 
@@ -920,6 +975,7 @@ bool os_file_read(File f, void* buffer, u64 bytes_to_read, u64 *actual_read_byte
 
 bool os_file_set_pos(File f, s64 pos_in_bytes) {
 	if (pos_in_bytes < 0) return false;
+	os_flush(f);
     LARGE_INTEGER pos;
     pos.QuadPart = pos_in_bytes;
     return SetFilePointerEx(f, pos, NULL, FILE_BEGIN);
@@ -959,6 +1015,7 @@ os_file_get_size_from_path(string path) {
 }
 
 s64 os_file_get_pos(File f) {
+	os_flush(f);
     LARGE_INTEGER pos = {0};
     LARGE_INTEGER new_pos;
     if (SetFilePointerEx(f, pos, &new_pos, FILE_CURRENT)) {
@@ -1289,6 +1346,136 @@ os_get_stack_trace(u64 *trace_count, Allocator allocator) {
 #endif // NOT DEBUG
 }
 
+// Enough for most stacks, deeper ones are cut off at the outermost frames
+#define WIN32_SAMPLE_STACK_COPY_SIZE KB(256)
+
+// THREAD_BASIC_INFORMATION isn't in the regular windows headers
+typedef struct Win32_Thread_Basic_Information {
+	LONG exit_status;
+	PVOID teb_base_address;
+	HANDLE unique_process;
+	HANDLE unique_thread;
+	ULONG_PTR affinity_mask;
+	LONG priority;
+	LONG base_priority;
+} Win32_Thread_Basic_Information;
+
+u64
+os_sample_thread_stack(u64 thread_id, u64 *frames, u64 max_frames) {
+#ifdef _M_X64
+	// Only the profiler's sampler thread calls this, so one copy buffer is enough
+	local_persist u8 *stack_copy = 0;
+	local_persist LONG (*NtQueryInformationThread)(HANDLE, ULONG, PVOID, ULONG, PULONG) = 0;
+	if (!stack_copy) stack_copy = (u8*)alloc(get_heap_allocator(), WIN32_SAMPLE_STACK_COPY_SIZE);
+	if (!NtQueryInformationThread) NtQueryInformationThread = (LONG (*)(HANDLE, ULONG, PVOID, ULONG, PULONG))GetProcAddress(GetModuleHandleA("ntdll.dll"), "NtQueryInformationThread");
+	if (!NtQueryInformationThread) return 0;
+	
+	HANDLE thread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION, FALSE, (DWORD)thread_id);
+	if (!thread) return 0;
+	
+	// The stack base is in the NT_TIB at the start of the thread's TEB
+	Win32_Thread_Basic_Information info;
+	const ULONG ThreadBasicInformation = 0;
+	if (NtQueryInformationThread(thread, ThreadBasicInformation, &info, sizeof(info), 0) != 0 || !info.teb_base_address) {
+		CloseHandle(thread);
+		return 0;
+	}
+	u64 stack_base = (u64)((NT_TIB*)info.teb_base_address)->StackBase;
+	
+	if (SuspendThread(thread) == (DWORD)-1) {
+		CloseHandle(thread);
+		return 0;
+	}
+	
+	// The thread may be holding any lock (heap, loader, dbghelp), and looking up unwind
+	// info can take the loader lock. So while it's suspended we only copy its registers
+	// and the live part of its stack, and unwind on the copy once it's running again.
+	CONTEXT context;
+	memset(&context, 0, sizeof(CONTEXT));
+	context.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+	u64 stack_top = 0;
+	u64 copy_size = 0;
+	if (GetThreadContext(thread, &context) && context.Rsp < stack_base) {
+		stack_top = context.Rsp;
+		copy_size = min(stack_base-stack_top, WIN32_SAMPLE_STACK_COPY_SIZE);
+		memcpy(stack_copy, (void*)stack_top, copy_size);
+	}
+	
+	ResumeThread(thread);
+	CloseHandle(thread);
+	
+	if (!copy_size) return 0;
+	
+	u64 copy_start = (u64)stack_copy;
+	u64 copy_end = copy_start+copy_size;
+	DWORD64 *nonvolatile_registers[] = {
+		&context.Rsp, &context.Rbp, &context.Rbx, &context.Rsi, &context.Rdi,
+		&context.R12, &context.R13, &context.R14, &context.R15,
+	};
+	
+	u64 count = 0;
+	while (count < max_frames && context.Rip) {
+		// Anything pointing into the original stack (like a frame pointer, even one the
+		// unwind just restored from the copy) is moved to the same spot in the copy.
+		for (u64 i = 0; i < sizeof(nonvolatile_registers)/sizeof(nonvolatile_registers[0]); i++) {
+			DWORD64 *r = nonvolatile_registers[i];
+			if (*r >= stack_top && *r < stack_top+copy_size) *r = *r - stack_top + copy_start;
+		}
+		// Frames beyond what we copied are lost
+		if (context.Rsp < copy_start || context.Rsp+8 > copy_end) break;
+		
+		frames[count] = context.Rip;
+		count += 1;
+		
+		DWORD64 image_base;
+		PRUNTIME_FUNCTION function = RtlLookupFunctionEntry(context.Rip, &image_base, 0);
+		if (function) {
+			void *handler_data;
+			DWORD64 establisher_frame;
+			RtlVirtualUnwind(UNW_FLAG_NHANDLER, image_base, context.Rip, function, &context, &handler_data, &establisher_frame, 0);
+		} else {
+			// Leaf function, return address is right on top of the stack
+			context.Rip = *(DWORD64*)context.Rsp;
+			context.Rsp += 8;
+		}
+	}
+	
+	return count;
+#else
+	// #Incomplete only x64 has unwind tables we can walk like this
+	return 0;
+#endif
+}
+
+string
+os_get_symbol_name(u64 address, Allocator allocator) {
+	HANDLE process = GetCurrentProcess();
+#if CONFIGURATION != DEBUG
+	// Only initialized at startup in debug, it's slow to load all the symbols
+	local_persist bool symbols_initted = false;
+	if (!symbols_initted) {
+		SymInitialize(process, NULL, TRUE);
+		symbols_initted = true;
+	}
+#endif
+
+	DWORD64 displacement = 0;
+	char buffer[sizeof(SYMBOL_INFO) + WIN32_MAX_SYMBOL_NAME_LENGTH * sizeof(TCHAR)];
+	PSYMBOL_INFO symbol = (PSYMBOL_INFO)buffer;
+	symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+	symbol->MaxNameLen = WIN32_MAX_SYMBOL_NAME_LENGTH;
+	
+	if (SymFromAddr(process, address, &displacement, symbol)) {
+		string result;
+		result.count = (u64)symbol->NameLen;
+		result.data = (u8*)alloc(allocator, result.count);
+		memcpy(result.data, symbol->Name, result.count);
+		return result;
+	}
+	
+	return sprint(allocator, STR("0x%llx"), address);
+}
+
 bool os_grow_program_memory(u64 new_size) {
 	os_lock_mutex(program_memory_mutex); // #Sync
 	if (program_memory_capacity >= new_size) {
@@ -1687,6 +1874,7 @@ win32_audio_init() {
 
 void
 win32_audio_poll_default_device_thread(Thread *t) {
+	profiler_set_thread_name(STR("Audio device poll"));
 	while (!win32_has_audio_thread_started) {
 		os_yield_thread();
 	}
@@ -1728,6 +1916,7 @@ win32_audio_poll_default_device_thread(Thread *t) {
 }
 void 
 win32_audio_thread(Thread *t) {
+	profiler_set_thread_name(STR("Audio"));
 	
 	mutex_init(&audio_init_mutex);
 	
@@ -1889,6 +2078,9 @@ void os_update() {
 	}
 
 	has_os_update_been_called_at_all = true;
+	
+	// So redirected stdout (which only flushes when full) still shows up about once a frame
+	os_flush_stdout();
 
 	win32_do_handle_raw_input = true;
 #ifndef OOGABOOGA_HEADLESS
@@ -3,6 +3,7 @@
 #ifdef _WIN32
 	typedef HANDLE Mutex_Handle;
 	typedef HANDLE Thread_Handle;
+	typedef LPVOID Fiber_Handle;
 	typedef HMODULE Dynamic_Library_Handle;
 	typedef HWND Window_Handle;
 	typedef HANDLE File;
@@ -13,6 +14,7 @@
     #endif
 	typedef SOMETHING Mutex_Handle;
 	typedef SOMETHING Thread_Handle;
+	typedef SOMETHING Fiber_Handle;
 	typedef SOMETHING Dynamic_Library_Handle;
 	typedef SOMETHING Window_Handle;
 	typedef SOMETHING File;
@@ -20,6 +22,7 @@
 #elif defined(__APPLE__) && defined(__MACH__)
 	typedef SOMETHING Mutex_Handle;
 	typedef SOMETHING Thread_Handle;
+	typedef SOMETHING Fiber_Handle;
 	typedef SOMETHING Dynamic_Library_Handle;
 	typedef SOMETHING Window_Handle;
 	typedef SOMETHING File;
@@ -147,6 +150,31 @@ os_thread_start(Thread *t);
 void ogb_instance
 os_thread_join(Thread *t);
 
+///
+// Fibers
+// A fiber is a stack that you switch to manually on whichever thread you're on. A thread must
+// be converted to a fiber before it can switch to other fibers.
+
+// Must never return, switch to another fiber instead.
+typedef void(*Fiber_Proc)(void *data);
+
+// Returns the fiber for the current thread so other fibers can switch back to it.
+Fiber_Handle ogb_instance
+os_fiber_convert_current_thread();
+
+void ogb_instance
+os_fiber_convert_back_to_thread();
+
+// Stack is reserved up front but only committed as it's used.
+Fiber_Handle ogb_instance
+os_fiber_create(Fiber_Proc proc, void *data, u64 stack_size);
+
+void ogb_instance
+os_fiber_destroy(Fiber_Handle f);
+
+void ogb_instance
+os_fiber_switch(Fiber_Handle f);
+
 
 
 ///
@@ -163,6 +191,25 @@ os_lock_mutex(Mutex_Handle m);
 void ogb_instance
 os_unlock_mutex(Mutex_Handle m);
 
+///
+// Wait on address (futex)
+// Lets a thread sleep until another thread changes a value, without any kernel object.
+// Mutex, Semaphore and Binary_Semaphore in concurrency.c are built on these.
+
+#define OS_WAIT_INFINITE -1
+
+// Sleeps while the size bytes at address equal the ones at compare_address (size is 1, 2, 4
+// or 8). Might return early for no reason, so always check the value again in a loop.
+// Returns false if timeout_ms passed.
+bool ogb_instance
+os_wait_on_address(volatile void *address, void *compare_address, u64 size, s64 timeout_ms);
+
+void ogb_instance
+os_wake_one_waiting_on_address(volatile void *address);
+
+void ogb_instance
+os_wake_all_waiting_on_address(volatile void *address);
+
 ///
 // Threading utilities
 
@@ -211,9 +258,13 @@ os_unload_dynamic_library(Dynamic_Library_Handle l);
 
 ogb_instance const File OS_INVALID_FILE;
 
+// Unbuffered, goes straight to the OS. print() goes through the thread's output buffer.
 void ogb_instance
 os_write_string_to_stdout(string s);
 
+bool ogb_instance
+os_is_stdout_a_console();
+
 bool ogb_instance
 os_write_entire_file_handle(File f, string data);
 
@@ -371,6 +422,243 @@ fprintf(File f, const char* fmt, ...);
                           )(__VA_ARGS__)
 
 
+///
+// Buffered output
+// print() and fprint() don't write to the OS directly. They append to a per-thread buffer
+// for that File, which is written when it's full, on newline (if OUTPUT_FLUSH_ON_NEWLINE),
+// on os_flush(), when the file is closed, when the thread exits, at program exit and on crash().
+//
+// Stdout flushes on newline when it's a console and only when full when it's redirected.
+// Other files only flush when full.
+// If you mix fprint() and os_file_write_xxx() on the same file, call os_flush() in between.
+
+#define OUTPUT_BUFFER_SIZE KB(4)
+#define MAX_OUTPUT_BUFFERS_PER_THREAD 4 // Including stdout
+
+typedef enum Output_Flush_Mode {
+	OUTPUT_FLUSH_WHEN_FULL,
+	OUTPUT_FLUSH_ON_NEWLINE,
+} Output_Flush_Mode;
+
+typedef struct Output_Buffer {
+	File file;
+	bool in_use;
+	bool is_stdout;
+	Output_Flush_Mode flush_mode;
+	u64 count;
+	u8 data[OUTPUT_BUFFER_SIZE];
+} Output_Buffer;
+
+typedef struct Thread_Output_Buffers {
+	Output_Buffer buffers[MAX_OUTPUT_BUFFERS_PER_THREAD]; // [0] is stdout
+	u64 next_eviction;
+	bool initted;
+	struct Thread_Output_Buffers *next;
+	struct Thread_Output_Buffers *prev;
+} Thread_Output_Buffers;
+
+void ogb_instance
+os_write_string_to_stdout_buffered(string s);
+
+void ogb_instance
+os_file_write_string_buffered(File f, string s);
+
+// Writes whatever this thread has buffered for f.
+void ogb_instance
+os_flush(File f);
+
+void ogb_instance
+os_flush_stdout();
+
+// Flushes all of this thread's buffers.
+void ogb_instance
+os_flush_thread_output();
+
+// Only affects the calling thread.
+void ogb_instance
+os_set_output_flush_mode(File f, Output_Flush_Mode mode);
+
+void ogb_instance
+os_set_stdout_flush_mode(Output_Flush_Mode mode);
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+thread_local Thread_Output_Buffers _thread_output_buffers = {0};
+
+// All threads' buffers, so we can flush everything on crash
+Thread_Output_Buffers *_output_buffers_list = 0;
+volatile bool _output_buffers_list_locked = false;
+
+void _output_buffers_list_lock() {
+	while (!compare_and_swap_bool(&_output_buffers_list_locked, true, false)) os_yield_thread();
+}
+void _output_buffers_list_unlock() {
+	MEMORY_BARRIER;
+	_output_buffers_list_locked = false;
+}
+
+Thread_Output_Buffers *_get_thread_output_buffers() {
+	Thread_Output_Buffers *t = &_thread_output_buffers;
+	if (!t->initted) {
+		t->initted = true;
+		t->next_eviction = 1;
+		
+		Output_Buffer *out = &t->buffers[0];
+		out->in_use = true;
+		out->is_stdout = true;
+		out->flush_mode = os_is_stdout_a_console() ? OUTPUT_FLUSH_ON_NEWLINE : OUTPUT_FLUSH_WHEN_FULL;
+		
+		_output_buffers_list_lock();
+		t->prev = 0;
+		t->next = _output_buffers_list;
+		if (_output_buffers_list) _output_buffers_list->prev = t;
+		_output_buffers_list = t;
+		_output_buffers_list_unlock();
+	}
+	return t;
+}
+
+void _output_buffer_flush(Output_Buffer *b) {
+	if (b->count == 0) return;
+	
+	string s = (string){b->count, b->data};
+	b->count = 0;
+	
+	if (b->is_stdout) os_write_string_to_stdout(s);
+	else              os_file_write_string(b->file, s);
+}
+
+void _output_buffer_write(Output_Buffer *b, string s) {
+	if (b->count + s.count > OUTPUT_BUFFER_SIZE) {
+		_output_buffer_flush(b);
+	}
+	
+	if (s.count > OUTPUT_BUFFER_SIZE) {
+		// Too big to buffer, no point in copying it
+		if (b->is_stdout) os_write_string_to_stdout(s);
+		else              os_file_write_string(b->file, s);
+		return;
+	}
+	
+	memcpy(b->data+b->count, s.data, s.count);
+	b->count += s.count;
+	
+	if (b->flush_mode == OUTPUT_FLUSH_ON_NEWLINE) {
+		for (s64 i = (s64)s.count-1; i >= 0; i--) {
+			if (s.data[i] == '\n') {
+				_output_buffer_flush(b);
+				break;
+			}
+		}
+	}
+}
+
+Output_Buffer *_find_output_buffer(Thread_Output_Buffers *t, File f) {
+	for (u64 i = 1; i < MAX_OUTPUT_BUFFERS_PER_THREAD; i++) {
+		if (t->buffers[i].in_use && t->buffers[i].file == f) return &t->buffers[i];
+	}
+	return 0;
+}
+Output_Buffer *_find_or_make_output_buffer(Thread_Output_Buffers *t, File f) {
+	Output_Buffer *b = _find_output_buffer(t, f);
+	if (b) return b;
+	
+	for (u64 i = 1; i < MAX_OUTPUT_BUFFERS_PER_THREAD; i++) {
+		if (!t->buffers[i].in_use) {
+			b = &t->buffers[i];
+			break;
+		}
+	}
+	if (!b) {
+		// Out of buffers, evict one
+		b = &t->buffers[t->next_eviction];
+		_output_buffer_flush(b);
+		t->next_eviction = t->next_eviction % (MAX_OUTPUT_BUFFERS_PER_THREAD-1) + 1;
+	}
+	
+	b->in_use = true;
+	b->is_stdout = false;
+	b->file = f;
+	b->count = 0;
+	b->flush_mode = OUTPUT_FLUSH_WHEN_FULL;
+	return b;
+}
+
+void os_write_string_to_stdout_buffered(string s) {
+	_output_buffer_write(&_get_thread_output_buffers()->buffers[0], s);
+}
+void os_file_write_string_buffered(File f, string s) {
+	_output_buffer_write(_find_or_make_output_buffer(_get_thread_output_buffers(), f), s);
+}
+
+void os_flush(File f) {
+	if (!_thread_output_buffers.initted) return;
+	
+	Output_Buffer *b = _find_output_buffer(&_thread_output_buffers, f);
+	if (b) _output_buffer_flush(b);
+}
+void os_flush_stdout() {
+	if (!_thread_output_buffers.initted) return;
+	_output_buffer_flush(&_thread_output_buffers.buffers[0]);
+}
+void os_flush_thread_output() {
+	if (!_thread_output_buffers.initted) return;
+	for (u64 i = 0; i < MAX_OUTPUT_BUFFERS_PER_THREAD; i++) {
+		if (_thread_output_buffers.buffers[i].in_use) _output_buffer_flush(&_thread_output_buffers.buffers[i]);
+	}
+}
+
+void os_set_output_flush_mode(File f, Output_Flush_Mode mode) {
+	Output_Buffer *b = _find_or_make_output_buffer(_get_thread_output_buffers(), f);
+	b->flush_mode = mode;
+}
+void os_set_stdout_flush_mode(Output_Flush_Mode mode) {
+	_get_thread_output_buffers()->buffers[0].flush_mode = mode;
+}
+
+// When a file is closed, so a new file which gets the same handle doesn't write to a stale buffer.
+// Any thread might have buffered output for f, so we flush and release all of them.
+// Other threads should not be writing to f while it's being closed.
+void _release_output_buffer(File f) {
+	_output_buffers_list_lock();
+	for (Thread_Output_Buffers *t = _output_buffers_list; t; t = t->next) {
+		Output_Buffer *b = _find_output_buffer(t, f);
+		if (b) {
+			_output_buffer_flush(b);
+			b->in_use = false;
+		}
+	}
+	_output_buffers_list_unlock();
+}
+
+// Called when a thread exits
+void _output_thread_exit() {
+	if (!_thread_output_buffers.initted) return;
+	
+	os_flush_thread_output();
+	
+	Thread_Output_Buffers *t = &_thread_output_buffers;
+	_output_buffers_list_lock();
+	if (t->prev) t->prev->next = t->next;
+	else         _output_buffers_list = t->next;
+	if (t->next) t->next->prev = t->prev;
+	_output_buffers_list_unlock();
+	
+	t->initted = false;
+}
+
+// Best effort, other threads might be writing to their buffers while we flush them.
+// We don't take the list lock because the crashing thread might be holding it.
+void _flush_all_output_on_crash() {
+	for (Thread_Output_Buffers *t = _output_buffers_list; t; t = t->next) {
+		for (u64 i = 0; i < MAX_OUTPUT_BUFFERS_PER_THREAD; i++) {
+			if (t->buffers[i].in_use) _output_buffer_flush(&t->buffers[i]);
+		}
+	}
+}
+
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
 void fprint_va_list_buffered(File f, const string fmt, va_list args) {
 
 	string current = fmt;
@@ -388,7 +676,7 @@ void fprint_va_list_buffered(File f, const string fmt, va_list args) {
 		fmt_cstring[size] = 0;
 		
 		string s = sprint_null_terminated_string_va_list_to_buffer(fmt_cstring, args, buffer, PRINT_BUFFER_SIZE);
-		os_file_write_string(f, s);
+		os_file_write_string_buffered(f, s);
 		
 		current.count -= size;
 		current.data += size;
@@ -417,6 +705,18 @@ os_get_number_of_logical_processors();
 ogb_instance string*
 os_get_stack_trace(u64 *trace_count, Allocator allocator);
 
+// Writes the return addresses on the thread's stack into frames (innermost first). Returns
+// the number of frames, 0 if the thread couldn't be sampled. The thread is only suspended
+// while its registers and stack are copied, the unwinding happens on the copy after it's
+// resumed, so sampling a thread holding the loader or heap lock can't deadlock.
+// Never call this on the calling thread, and only call it from one thread at a time.
+ogb_instance u64
+os_sample_thread_stack(u64 thread_id, u64 *frames, u64 max_frames);
+
+// Name of the function containing address, or the address in hex if there are no symbols
+ogb_instance string
+os_get_symbol_name(u64 address, Allocator allocator);
+
 inline void 
 dump_stack_trace() {
 	u64 count;
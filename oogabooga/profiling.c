@@ -1,48 +1,780 @@
 
+///
+///
+// Profiling
+///
+// tm_scope pushes a small binary event into a ring buffer owned by the calling thread, so a
+// measured scope costs a few dozen cycles and never takes a lock. A background thread turns
+// the events into google trace JSON, and dump_profile_result writes it to google_trace.json
+// (open it in chrome://tracing or https://ui.perfetto.dev).
+//
+// Events only keep an id for the scope name, so names must stay valid until the profile is
+// dumped. String literals (which is what tm_scope takes) are fine.
+//
+// If a thread produces events faster than the background thread can keep up, events are
+// dropped and reported when the profile is dumped. Bump PROFILER_EVENTS_PER_THREAD if so.
+//
+// Events are timed with rdtsc if the cpu has an invariant TSC, which is calibrated against
+// os_get_elapsed_seconds in profiler_init. Otherwise os_get_elapsed_seconds is used directly,
+// which is slower but correct. Either way the trace is in real microseconds since
+// profiler_init. Name threads with profiler_set_thread_name.
+//
+// Captures are streamed to file by the background thread as they happen, so long captures
+// don't pile up in memory and the file is valid JSON even if the program crashes. A capture
+// to google_trace.json starts in profiler_init (unless PROFILER_CAPTURE_ON_INIT is 0).
+// To record just a window, use profiler_start_capture/profiler_stop_capture. Events from
+// the last PROFILER_CAPTURE_PRE_ROLL_SECONDS before profiler_start_capture are included (up to
+// PROFILER_PRE_ROLL_MAX_EVENTS per thread), so you can start a capture right after noticing a hitch. Files are rotated (trace_1.json,
+// trace_2.json, ...) once they reach PROFILER_MAX_FILE_SIZE bytes or PROFILER_MAX_FILE_SECONDS
+// seconds, 0 to never rotate. Those are copied to profiler.max_file_size and
+// profiler.max_file_seconds in profiler_init, which can be changed at runtime.
+//
+// With PROFILER_SAMPLING, a sampler thread also walks the stack of every thread the profiler
+// knows about (anything that has named itself or recorded an event) each
+// PROFILER_SAMPLE_INTERVAL_MS, so you can see where time goes without placing any tm_scope.
+// Samples show up in the trace as instant events named after the innermost function, and
+// profiler_shutdown writes all stacks to PROFILER_SAMPLES_PATH in folded format
+// ("thread;outer;inner count") which flamegraph.pl, speedscope and friends take as is.
+//
+// tm_counter and tm_gauge plot values on the same timeline as the scopes:
+//
+//	tm_gauge("Quads", number_of_quads);      // Plots the value as is
+//	tm_counter("Particle emissions", 1);     // Plots the running total of all values
+
+#ifndef PROFILER_EVENTS_PER_THREAD
+	#define PROFILER_EVENTS_PER_THREAD 65536 // Must be a power of two
+#endif
+#define PROFILER_MAX_THREAD_BUFFERS 128
+#define PROFILER_MAX_NAMES 4096 // Must be a power of two
+#define PROFILER_FLUSH_INTERVAL_MS 5
+#define PROFILER_TSC_CALIBRATION_SECONDS 0.02
+#define PROFILER_MAX_THREAD_NAME_LENGTH 64
+#define PROFILER_MAX_THREAD_NAMES 256
+#ifndef PROFILER_CAPTURE_ON_INIT
+	#define PROFILER_CAPTURE_ON_INIT 1
+#endif
+#ifndef PROFILER_CAPTURE_PRE_ROLL_SECONDS
+	#define PROFILER_CAPTURE_PRE_ROLL_SECONDS 2.0
+#endif
+// While not capturing, the oldest events are thrown away once a ring is this full, even if
+// they are within the pre-roll, so new events always have room.
+#define PROFILER_PRE_ROLL_MAX_EVENTS (PROFILER_EVENTS_PER_THREAD/2)
+#ifndef PROFILER_MAX_FILE_SIZE
+	#define PROFILER_MAX_FILE_SIZE MB(512)
+#endif
+#ifndef PROFILER_MAX_FILE_SECONDS
+	#define PROFILER_MAX_FILE_SECONDS 0
+#endif
+#ifndef PROFILER_SAMPLING
+	#define PROFILER_SAMPLING 0
+#endif
+#ifndef PROFILER_SAMPLE_INTERVAL_MS
+	#define PROFILER_SAMPLE_INTERVAL_MS 1
+#endif
+#ifndef PROFILER_SAMPLES_PATH
+	#define PROFILER_SAMPLES_PATH "profile_samples.folded"
+#endif
+#define PROFILER_MAX_SAMPLE_DEPTH 48
+#define PROFILER_MAX_SAMPLE_STACKS 8192 // Must be a power of two
+
+typedef enum Profiler_Event_Kind {
+	PROFILER_EVENT_SCOPE,
+	PROFILER_EVENT_THREAD_NAME, // name_id is the thread name
+	PROFILER_EVENT_COUNTER,     // duration is the float64 value, added to a running total
+	PROFILER_EVENT_GAUGE,       // duration is the float64 value
+	PROFILER_EVENT_SAMPLE,      // name_id is the index into profiler.sample_stacks
+} Profiler_Event_Kind;
+
+typedef struct Profiler_Event {
+	u64 start;    // Profiler ticks, see profiler_get_ticks
+	u64 duration; // Profiler ticks, or the value bits for counters and gauges
+	u32 name_id;
+	u32 kind;     // Profiler_Event_Kind
+} Profiler_Event;
+
+// Single producer (the owning thread), single consumer (whoever holds _profiler_lock)
+typedef struct Profiler_Thread_Buffer {
+	volatile u64 write_pos;
+	u8 _pad0[64-sizeof(u64)]; // Keep producer and consumer on different cache lines
+	volatile u64 read_pos;
+	u8 _pad1[64-sizeof(u64)];
+
+	Profiler_Event *events;
+	u64 thread_id;
+	volatile u64 dropped_count;
+	volatile bool claimed;
+} Profiler_Thread_Buffer;
+
+typedef struct Profiler_Name {
+	const u8 *volatile data;
+	u64 count;
+} Profiler_Name;
+
+typedef struct Profiler_Thread_Name {
+	u64 thread_id;
+	u32 name_id;
+} Profiler_Thread_Name;
+
+// Identical stacks from the same thread are only stored once
+typedef struct Profiler_Sample_Stack {
+	u64 hash; // 0 if the slot is free
+	u64 thread_id;
+	u64 count;
+	string leaf_name; // Looked up the first time the stack is written to the trace
+	u64 depth;
+	u64 frames[PROFILER_MAX_SAMPLE_DEPTH]; // Innermost first
+} Profiler_Sample_Stack;
+
+typedef struct Profiler {
+	Profiler_Thread_Buffer buffers[PROFILER_MAX_THREAD_BUFFERS];
+
+	// Open addressed on the name pointer, the slot index is the name id
+	Profiler_Name names[PROFILER_MAX_NAMES];
+	Spinlock name_lock;
+	// Also under name_lock. Interned by content so naming threads again doesn't use up names.
+	string thread_name_copies[PROFILER_MAX_THREAD_NAMES];
+	u64 thread_name_copy_count;
+	u32 lock_contention_name_id;
+	u32 too_many_names_name_id;
+	
+	// Only touched while holding _profiler_lock
+	float64 counter_totals[PROFILER_MAX_NAMES];
+	Profiler_Thread_Name thread_names[PROFILER_MAX_THREAD_NAMES]; // Written at the start of each file
+	u64 thread_name_count;
+	
+	volatile bool capturing;
+	string capture_path;
+	File capture_file;
+	u64 capture_file_index; // For rotation
+	u64 capture_file_end;   // Where the closing "{}]" starts
+	float64 capture_file_start_seconds;
+	u64 max_file_size;        // PROFILER_MAX_FILE_SIZE
+	float64 max_file_seconds; // PROFILER_MAX_FILE_SECONDS
+
+	Thread thread;
+	volatile bool running;
+	
+	// Only written by the sampler thread
+	Profiler_Sample_Stack *sample_stacks;
+	u64 dropped_sample_count;
+	Thread sampler_thread;
+	u64 reported_dropped_count;
+	
+	bool use_tsc;
+	float64 ticks_per_second;
+	float64 tsc_cycles_per_second; // Calibrated even if we don't use_tsc, for lock contention events
+	u64 start_ticks;
+} Profiler;
 
 // #Global
 ogb_instance String_Builder _profile_output;
 ogb_instance bool profiler_initted;
-ogb_instance Spinlock _profiler_lock;
+ogb_instance Spinlock _profiler_lock; // Held while converting events into _profile_output
+ogb_instance Profiler profiler;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 String_Builder _profile_output = {0};
 bool profiler_initted = false;
 Spinlock _profiler_lock;
+Profiler profiler = {0};
 #endif
 
-void dump_profile_result() {
-	File file = os_file_open("google_trace.json", O_CREATE | O_WRITE);
+void ogb_instance
+profiler_init();
+
+void ogb_instance
+profiler_shutdown();
+
+// Converts all events recorded so far and writes them to the capture file, on the calling thread.
+void ogb_instance
+profiler_flush();
+
+// Stops any running capture. Returns false if the file couldn't be opened.
+bool ogb_instance
+profiler_start_capture(string path);
+
+void ogb_instance
+profiler_stop_capture();
+
+bool ogb_instance
+profiler_is_capturing();
+
+void ogb_instance
+dump_profile_result();
+
+// Shows up as the thread's name in the trace. Copied, so any string is fine. Each distinct
+// name is only kept once, up to PROFILER_MAX_THREAD_NAMES of them.
+void ogb_instance
+profiler_set_thread_name(string name);
+
+// rdtsc() if the TSC is invariant, otherwise a slower but steady clock.
+// Only meaningful relative to other profiler ticks.
+u64 ogb_instance
+profiler_get_ticks();
+
+thread_local Profiler_Thread_Buffer *_profiler_thread_buffer = 0;
+thread_local bool _profiler_is_claiming_buffer = false;
+
+u64 profiler_get_ticks() {
+	if (profiler.use_tsc) return rdtsc();
+	return (u64)(os_get_elapsed_seconds()*1000000000.0);
+}
+
+u32 _profiler_get_name_id(string name) {
+	u64 hash = ((u64)name.data * 0x9E3779B97F4A7C15ULL) >> 32;
+	for (u64 i = 0; i < PROFILER_MAX_NAMES; i++) {
+		u32 slot = (u32)((hash + i) & (PROFILER_MAX_NAMES-1));
+		Profiler_Name *n = &profiler.names[slot];
+
+		const u8 *data = n->data;
+		if (data == name.data && n->count == name.count) return slot;
+
+		if (!data) {
+			spinlock_acquire_or_wait(&profiler.name_lock);
+			bool inserted = false;
+			if (!n->data) {
+				n->count = name.count;
+				MEMORY_BARRIER;
+				n->data = name.data;
+				inserted = true;
+			}
+			spinlock_release(&profiler.name_lock);
+
+			if (inserted) return slot;
+
+			// Someone else got the slot first, look at it again
+			i -= 1;
+		}
+	}
+	return profiler.too_many_names_name_id;
+}
+
+Profiler_Thread_Buffer *_profiler_claim_thread_buffer() {
+	// Allocating the events may report lock contention, which comes back here
+	if (_profiler_is_claiming_buffer) return 0;
+	_profiler_is_claiming_buffer = true;
+
+	Profiler_Thread_Buffer *result = 0;
+	for (u64 i = 0; i < PROFILER_MAX_THREAD_BUFFERS; i++) {
+		Profiler_Thread_Buffer *b = &profiler.buffers[i];
+		// Buffers released by exited threads are only reused once drained, so their events
+		// keep the right thread id.
+		if (b->claimed || b->read_pos != b->write_pos) continue;
+		if (!compare_and_swap_bool(&b->claimed, true, false)) continue;
+
+		if (!b->events) {
+			Profiler_Event *events = (Profiler_Event*)alloc(get_heap_allocator(), PROFILER_EVENTS_PER_THREAD*sizeof(Profiler_Event));
+			MEMORY_BARRIER;
+			b->events = events;
+		}
+		b->thread_id = get_context().thread_id;
+		result = b;
+		break;
+	}
+
+	_profiler_thread_buffer = result;
+	_profiler_is_claiming_buffer = false;
+	return result;
+}
+// Called when a thread exits so its buffer can be reused by another thread.
+void _profiler_release_thread_buffer() {
+	if (!_profiler_thread_buffer) return;
+	MEMORY_BARRIER;
+	_profiler_thread_buffer->claimed = false;
+	_profiler_thread_buffer = 0;
+}
+
+void _profiler_push_event(u32 name_id, Profiler_Event_Kind kind, u64 start, u64 duration) {
+	if (!profiler_initted) return;
+
+	Profiler_Thread_Buffer *b = _profiler_thread_buffer;
+	if (!b) b = _profiler_claim_thread_buffer();
+	if (!b) return;
+
+	u64 write_pos = b->write_pos;
+	if (write_pos - b->read_pos >= PROFILER_EVENTS_PER_THREAD) {
+		// Outside a capture this only shortens the pre-roll, which isn't worth a warning
+		if (profiler.capturing) b->dropped_count += 1;
+		return;
+	}
+
+	Profiler_Event *e = &b->events[write_pos & (PROFILER_EVENTS_PER_THREAD-1)];
+	e->start = start;
+	e->duration = duration;
+	e->name_id = name_id;
+	e->kind = kind;
+
+	MEMORY_BARRIER;
+	b->write_pos = write_pos + 1;
+}
+
+// Called from inside locks (like heap_lock), so this must never allocate or take a lock.
+// The name is interned in profiler_init for that reason.
+void _profiler_report_lock_contention(u64 start_cycles, u64 wait_cycles) {
+#if ENABLE_PROFILING
+	if (!profiler_initted) return;
 	
-	os_file_write_string(file, STR("["));
-	os_file_write_string(file, _profile_output.result);
-	os_file_write_string(file, STR("{}]"));
+	u64 start = start_cycles;
+	u64 duration = wait_cycles;
+	if (!profiler.use_tsc) {
+		// Lock stats are always in cycles, so translate to the fallback clock as well as we can
+		float64 ticks_per_cycle = profiler.ticks_per_second/profiler.tsc_cycles_per_second;
+		u64 now = profiler_get_ticks();
+		start = now - (u64)((float64)(rdtsc()-start_cycles)*ticks_per_cycle);
+		duration = (u64)((float64)wait_cycles*ticks_per_cycle);
+	}
+	_profiler_push_event(profiler.lock_contention_name_id, PROFILER_EVENT_SCOPE, start, duration);
+#endif
+}
+
+void _profiler_report_time_cycles(string name, u64 count, u64 start) {
+	if (!profiler_initted) return;
+	_profiler_push_event(_profiler_get_name_id(name), PROFILER_EVENT_SCOPE, start, count);
+}
+
+void _profiler_report_value(string name, float64 value, Profiler_Event_Kind kind) {
+	if (!profiler_initted) return;
+	u64 bits;
+	memcpy(&bits, &value, sizeof(u64));
+	_profiler_push_event(_profiler_get_name_id(name), kind, profiler_get_ticks(), bits);
+}
+
+void profiler_set_thread_name(string name) {
+	if (!profiler_initted) return;
 	
-	os_file_close(file);
+	// The name is looked up by pointer when the event is converted, so it must live forever.
+	// Threads that come and go (like job workers) reuse the same names, so each distinct name
+	// is only copied once.
+	name.count = min(name.count, PROFILER_MAX_THREAD_NAME_LENGTH);
+	string copy = ZERO(string);
+	bool found = false;
+	spinlock_acquire_or_wait(&profiler.name_lock);
+	for (u64 i = 0; i < profiler.thread_name_copy_count; i++) {
+		if (strings_match(profiler.thread_name_copies[i], name)) {
+			copy = profiler.thread_name_copies[i];
+			found = true;
+			break;
+		}
+	}
+	if (!found && profiler.thread_name_copy_count < PROFILER_MAX_THREAD_NAMES) {
+		copy = string_copy(name, get_heap_allocator());
+		profiler.thread_name_copies[profiler.thread_name_copy_count++] = copy;
+		found = true;
+	}
+	spinlock_release(&profiler.name_lock);
 	
-	log_verbose("Wrote profiling result to google_trace.json");
+	u32 name_id = found ? _profiler_get_name_id(copy) : profiler.too_many_names_name_id;
+	_profiler_push_event(name_id, PROFILER_EVENT_THREAD_NAME, profiler_get_ticks(), 0);
 }
-void _profiler_report_time_cycles(string name, u64 count, u64 start) {
-	if (!profiler_initted) {
-		spinlock_init(&_profiler_lock);
-		profiler_initted = true;
-		
-		string_builder_init_reserve(&_profile_output, 1024*1000, get_heap_allocator());	
-		
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+void _profiler_write_thread_name(u64 thread_id, u32 name_id) {
+	Profiler_Name *n = &profiler.names[name_id];
+	string name = (string){n->count, (u8*)n->data};
+	string fmt = STR("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%zu,\"args\":{\"name\":\"%s\"}},");
+	string_builder_print(&_profile_output, fmt, thread_id, name);
+}
+void _profiler_remember_thread_name(u64 thread_id, u32 name_id) {
+	for (u64 i = 0; i < profiler.thread_name_count; i++) {
+		if (profiler.thread_names[i].thread_id == thread_id) {
+			profiler.thread_names[i].name_id = name_id;
+			return;
+		}
+	}
+	if (profiler.thread_name_count < PROFILER_MAX_THREAD_NAMES) {
+		profiler.thread_names[profiler.thread_name_count].thread_id = thread_id;
+		profiler.thread_names[profiler.thread_name_count].name_id = name_id;
+		profiler.thread_name_count += 1;
+	}
+}
+
+void _profiler_write_event(Profiler_Event *e, u64 thread_id) {
+	string name = ZERO(string);
+	if (e->kind != PROFILER_EVENT_SAMPLE) {
+		Profiler_Name *n = &profiler.names[e->name_id];
+		name = (string){n->count, (u8*)n->data};
 	}
+
+	float64 us_per_tick = 1000000.0/profiler.ticks_per_second;
+	// Events from before profiler_init (f.ex. a tm_scope around it) get negative timestamps
+	float64 ts = (float64)(s64)(e->start-profiler.start_ticks)*us_per_tick;
 	
+	switch ((Profiler_Event_Kind)e->kind) {
+		case PROFILER_EVENT_SCOPE: {
+			float64 dur = (float64)e->duration*us_per_tick;
+			string fmt = STR("{\"cat\":\"function\",\"dur\":%.3f,\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%zu,\"ts\":%.3f},");
+			string_builder_print(&_profile_output, fmt, dur, name, thread_id, ts);
+			break;
+		}
+		case PROFILER_EVENT_THREAD_NAME: {
+			_profiler_write_thread_name(thread_id, e->name_id);
+			break;
+		}
+		case PROFILER_EVENT_SAMPLE: {
+			// Samples are pushed from the sampler thread's buffer, but belong on the sampled thread's track
+			Profiler_Sample_Stack *stack = &profiler.sample_stacks[e->name_id];
+			if (!stack->leaf_name.data) stack->leaf_name = os_get_symbol_name(stack->frames[0], get_heap_allocator());
+			string fmt = STR("{\"cat\":\"sample\",\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%zu,\"ts\":%.3f},");
+			string_builder_print(&_profile_output, fmt, stack->leaf_name, stack->thread_id, ts);
+			break;
+		}
+		case PROFILER_EVENT_COUNTER:
+		case PROFILER_EVENT_GAUGE: {
+			float64 value;
+			memcpy(&value, &e->duration, sizeof(float64));
+			if (e->kind == PROFILER_EVENT_COUNTER) value = profiler.counter_totals[e->name_id];
+			string fmt = STR("{\"name\":\"%s\",\"ph\":\"C\",\"pid\":0,\"tid\":%zu,\"ts\":%.3f,\"args\":{\"value\":%.3f}},");
+			string_builder_print(&_profile_output, fmt, name, thread_id, ts, value);
+			break;
+		}
+	}
+}
+
+// Thread names and counter totals must be tracked even for events we don't write
+void _profiler_track_event(Profiler_Event *e, u64 thread_id) {
+	if (e->kind == PROFILER_EVENT_THREAD_NAME) {
+		_profiler_remember_thread_name(thread_id, e->name_id);
+	} else if (e->kind == PROFILER_EVENT_COUNTER) {
+		float64 value;
+		memcpy(&value, &e->duration, sizeof(float64));
+		profiler.counter_totals[e->name_id] += value;
+	}
+}
+
+// Each file starts out as "[...{}]". New events are written over the "{}]" with a new one
+// after them, in one write, so whatever is on disk is always a complete JSON array.
+void _profiler_write_to_capture_file() {
+	string_builder_append(&_profile_output, STR("{}]"));
+	
+	os_file_set_pos(profiler.capture_file, (s64)profiler.capture_file_end);
+	os_file_write_string(profiler.capture_file, _profile_output.result);
+	
+	profiler.capture_file_end += _profile_output.count-3;
+	_profile_output.count = 0;
+}
+bool _profiler_open_capture_file() {
+	string path = profiler.capture_path;
+	if (profiler.capture_file_index > 0) {
+		string extension = STR(".json");
+		if (path.count >= extension.count && strings_match(string_view(path, path.count-extension.count, extension.count), extension)) {
+			path.count -= extension.count;
+		}
+		path = tprint("%s_%llu.json", path, profiler.capture_file_index);
+	}
+	
+	profiler.capture_file = os_file_open_s(path, O_CREATE | O_WRITE);
+	if (profiler.capture_file == OS_INVALID_FILE) return false;
+	
+	profiler.capture_file_start_seconds = os_get_elapsed_seconds();
+	
+	_profile_output.count = 0;
+	string_builder_append(&_profile_output, STR("["));
+	string_builder_print(&_profile_output, STR("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"Ooga booga program\"}},"));
+	for (u64 i = 0; i < profiler.thread_name_count; i++) {
+		_profiler_write_thread_name(profiler.thread_names[i].thread_id, profiler.thread_names[i].name_id);
+	}
+	
+	profiler.capture_file_end = 0;
+	_profiler_write_to_capture_file();
+	return true;
+}
+void _profiler_maybe_rotate_capture_file() {
+	bool too_big = profiler.max_file_size > 0 && profiler.capture_file_end >= profiler.max_file_size;
+	bool too_old = profiler.max_file_seconds > 0 && os_get_elapsed_seconds()-profiler.capture_file_start_seconds >= profiler.max_file_seconds;
+	if (!too_big && !too_old) return;
+	
+	os_file_close(profiler.capture_file);
+	profiler.capture_file_index += 1;
+	if (!_profiler_open_capture_file()) {
+		log_error("Profiler failed opening next capture file, stopping capture");
+		profiler.capturing = false;
+	}
+}
+
+void _profiler_flush_buffers() {
+	// While not capturing, we keep the last PROFILER_CAPTURE_PRE_ROLL_SECONDS in the rings, or
+	// the last PROFILER_PRE_ROLL_MAX_EVENTS if a thread makes more events than that.
+	u64 pre_roll_ticks = (u64)(PROFILER_CAPTURE_PRE_ROLL_SECONDS*profiler.ticks_per_second);
+	u64 now = profiler_get_ticks();
+	
+	for (u64 i = 0; i < PROFILER_MAX_THREAD_BUFFERS; i++) {
+		Profiler_Thread_Buffer *b = &profiler.buffers[i];
+		if (!b->events) continue;
+
+		u64 read_pos = b->read_pos;
+		u64 write_pos = b->write_pos;
+		MEMORY_BARRIER;
+
+		while (read_pos != write_pos) {
+			Profiler_Event *e = &b->events[read_pos & (PROFILER_EVENTS_PER_THREAD-1)];
+			if (!profiler.capturing && (s64)(now - e->start) < (s64)pre_roll_ticks
+			 && write_pos - read_pos <= PROFILER_PRE_ROLL_MAX_EVENTS) {
+				break;
+			}
+			
+			Profiler_Event copy = *e;
+			_profiler_track_event(&copy, b->thread_id);
+			if (profiler.capturing) _profiler_write_event(&copy, b->thread_id);
+			read_pos += 1;
+		}
+
+		MEMORY_BARRIER;
+		b->read_pos = read_pos;
+	}
+	
+	if (profiler.capturing) {
+		_profiler_write_to_capture_file();
+		_profiler_maybe_rotate_capture_file();
+	}
+}
+
+void profiler_flush() {
+	if (!profiler_initted) return;
 	spinlock_acquire_or_wait(&_profiler_lock);
+	_profiler_flush_buffers();
+	spinlock_release(&_profiler_lock);
+}
+
+void _profiler_flush_on_crash() {
+	if (!profiler_initted) return;
+	// Same as the logger, rather risk a messed up flush than have nothing
+	bool acquired = spinlock_acquire_or_wait_timeout(&_profiler_lock, 0.1);
+	_profiler_flush_buffers();
+	if (acquired) spinlock_release(&_profiler_lock);
+}
+
+bool profiler_start_capture(string path) {
+	if (!profiler_initted) return false;
+	
+	profiler_stop_capture();
+	
+	spinlock_acquire_or_wait(&_profiler_lock);
+	
+	if (profiler.capture_path.data) dealloc(get_heap_allocator(), profiler.capture_path.data);
+	profiler.capture_path.data = (u8*)alloc(get_heap_allocator(), path.count);
+	profiler.capture_path.count = path.count;
+	memcpy(profiler.capture_path.data, path.data, path.count);
+	profiler.capture_file_index = 0;
 	
-	string fmt = STR("{\"cat\":\"function\",\"dur\":%.3f,\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%zu,\"ts\":%lld},");
-	string_builder_print(&_profile_output, fmt, (float64)count*1000, name, get_context().thread_id, start*1000);
+	bool ok = _profiler_open_capture_file();
+	if (ok) {
+		profiler.capturing = true;
+		// Write the pre-roll right away
+		_profiler_flush_buffers();
+	}
 	
 	spinlock_release(&_profiler_lock);
+	
+	if (!ok) log_error("Profiler failed opening capture file '%s'", path);
+	return ok;
+}
+void profiler_stop_capture() {
+	if (!profiler_initted) return;
+	
+	spinlock_acquire_or_wait(&_profiler_lock);
+	if (profiler.capturing) {
+		_profiler_flush_buffers();
+		profiler.capturing = false;
+		os_file_close(profiler.capture_file);
+		profiler.capture_file = OS_INVALID_FILE;
+	}
+	spinlock_release(&_profiler_lock);
+}
+bool profiler_is_capturing() {
+	return profiler.capturing;
+}
+
+// Returns PROFILER_MAX_SAMPLE_STACKS if the table is full
+u32 _profiler_intern_sample_stack(u64 thread_id, u64 *frames, u64 depth) {
+	u64 hash = thread_id * 0x9E3779B97F4A7C15ULL;
+	for (u64 i = 0; i < depth; i++) hash = (hash ^ frames[i]) * 0x9E3779B97F4A7C15ULL;
+	hash |= 1;
+	
+	for (u64 i = 0; i < PROFILER_MAX_SAMPLE_STACKS; i++) {
+		u32 slot = (u32)(((hash >> 32) + i) & (PROFILER_MAX_SAMPLE_STACKS-1));
+		Profiler_Sample_Stack *stack = &profiler.sample_stacks[slot];
+		
+		if (stack->hash == hash && stack->thread_id == thread_id && stack->depth == depth
+		 && memcmp(stack->frames, frames, depth*sizeof(u64)) == 0) {
+			stack->count += 1;
+			return slot;
+		}
+		
+		if (stack->hash == 0) {
+			stack->thread_id = thread_id;
+			stack->count = 1;
+			stack->depth = depth;
+			memcpy(stack->frames, frames, depth*sizeof(u64));
+			MEMORY_BARRIER;
+			stack->hash = hash;
+			return slot;
+		}
+	}
+	return PROFILER_MAX_SAMPLE_STACKS;
+}
+
+void profiler_sampler_proc(Thread *t) {
+	profiler_set_thread_name(STR("Profiler sampler"));
+	u64 self = get_context().thread_id;
+	
+	u64 frames[PROFILER_MAX_SAMPLE_DEPTH];
+	while (profiler.running) {
+		for (u64 i = 0; i < PROFILER_MAX_THREAD_BUFFERS; i++) {
+			Profiler_Thread_Buffer *b = &profiler.buffers[i];
+			u64 thread_id = b->thread_id;
+			if (!b->claimed || thread_id == self) continue;
+			
+			u64 start = profiler_get_ticks();
+			u64 depth = os_sample_thread_stack(thread_id, frames, PROFILER_MAX_SAMPLE_DEPTH);
+			if (depth == 0) continue;
+			
+			u32 stack_index = _profiler_intern_sample_stack(thread_id, frames, depth);
+			if (stack_index == PROFILER_MAX_SAMPLE_STACKS) {
+				profiler.dropped_sample_count += 1;
+				continue;
+			}
+			_profiler_push_event(stack_index, PROFILER_EVENT_SAMPLE, start, 0);
+		}
+		os_sleep(PROFILER_SAMPLE_INTERVAL_MS);
+	}
+}
+
+void _profiler_write_folded_stacks() {
+	String_Builder builder;
+	string_builder_init_reserve(&builder, KB(64), get_heap_allocator());
+	
+	for (u64 i = 0; i < PROFILER_MAX_SAMPLE_STACKS; i++) {
+		Profiler_Sample_Stack *stack = &profiler.sample_stacks[i];
+		if (!stack->hash) continue;
+		
+		bool named = false;
+		for (u64 j = 0; j < profiler.thread_name_count; j++) {
+			if (profiler.thread_names[j].thread_id != stack->thread_id) continue;
+			Profiler_Name *n = &profiler.names[profiler.thread_names[j].name_id];
+			string_builder_append(&builder, (string){n->count, (u8*)n->data});
+			named = true;
+			break;
+		}
+		if (!named) string_builder_print(&builder, STR("Thread %zu"), stack->thread_id);
+		
+		for (u64 j = stack->depth; j > 0; j--) {
+			string name = os_get_symbol_name(stack->frames[j-1], get_heap_allocator());
+			string_builder_print(&builder, STR(";%s"), name);
+			dealloc_string(get_heap_allocator(), name);
+		}
+		string_builder_print(&builder, STR(" %llu\n"), stack->count);
+	}
+	
+	if (!os_write_entire_file_s(STR(PROFILER_SAMPLES_PATH), builder.result)) {
+		log_error("Profiler failed writing samples to %s", STR(PROFILER_SAMPLES_PATH));
+	} else {
+		log_verbose("Wrote profiler samples to %s", STR(PROFILER_SAMPLES_PATH));
+	}
+	if (profiler.dropped_sample_count) {
+		log_warning("Profiler dropped %llu samples because there were too many unique stacks", profiler.dropped_sample_count);
+	}
+	
+	string_builder_deinit(&builder);
 }
+
+void profiler_thread_proc(Thread *t) {
+	profiler_set_thread_name(STR("Profiler"));
+	while (profiler.running) {
+		profiler_flush();
+		os_sleep(PROFILER_FLUSH_INTERVAL_MS);
+	}
+}
+
+void profiler_init() {
+	if (profiler_initted) return;
+
+	spinlock_init(&_profiler_lock);
+	spinlock_init(&profiler.name_lock);
+	string_builder_init_reserve(&_profile_output, KB(64), get_heap_allocator());
+	profiler.capture_file = OS_INVALID_FILE;
+	profiler.max_file_size = PROFILER_MAX_FILE_SIZE;
+	profiler.max_file_seconds = PROFILER_MAX_FILE_SECONDS;
+	
+	// Spin against the OS clock for a bit to find the TSC rate
+	float64 start_seconds = os_get_elapsed_seconds();
+	u64 start_cycles = rdtsc();
+	float64 end_seconds = start_seconds;
+	while (end_seconds-start_seconds < PROFILER_TSC_CALIBRATION_SECONDS) {
+		_mm_pause();
+		end_seconds = os_get_elapsed_seconds();
+	}
+	u64 end_cycles = rdtsc();
+	profiler.tsc_cycles_per_second = (float64)(end_cycles-start_cycles)/(end_seconds-start_seconds);
+	
+	profiler.use_tsc = query_cpu_capabilities().invariant_tsc && profiler.tsc_cycles_per_second > 0;
+	profiler.ticks_per_second = profiler.use_tsc ? profiler.tsc_cycles_per_second : 1000000000.0;
+	profiler.start_ticks = profiler_get_ticks();
+	
+	if (!profiler.use_tsc) {
+		log_warning("CPU does not have an invariant TSC, profiler falls back to a slower clock");
+	}
+
+	profiler.lock_contention_name_id = _profiler_get_name_id(STR("Lock contention"));
+	profiler.too_many_names_name_id = _profiler_get_name_id(STR("(Too many profiler names)"));
+
+	MEMORY_BARRIER;
+	profiler_initted = true;
+	
+	add_crash_hook(_profiler_flush_on_crash);
+	
+	profiler_set_thread_name(STR("Main thread"));
+	
+	if (PROFILER_CAPTURE_ON_INIT) profiler_start_capture(STR("google_trace.json"));
+
+	profiler.running = true;
+	os_thread_init(&profiler.thread, profiler_thread_proc);
+	os_thread_start(&profiler.thread);
+	
+	if (PROFILER_SAMPLING) {
+		profiler.sample_stacks = (Profiler_Sample_Stack*)alloc(get_heap_allocator(), PROFILER_MAX_SAMPLE_STACKS*sizeof(Profiler_Sample_Stack));
+		memset(profiler.sample_stacks, 0, PROFILER_MAX_SAMPLE_STACKS*sizeof(Profiler_Sample_Stack));
+		os_thread_init(&profiler.sampler_thread, profiler_sampler_proc);
+		os_thread_start(&profiler.sampler_thread);
+	}
+}
+void profiler_shutdown() {
+	if (!profiler.running) return;
+
+	profiler.running = false;
+	os_thread_join(&profiler.thread);
+	if (PROFILER_SAMPLING) os_thread_join(&profiler.sampler_thread);
+	profiler_stop_capture();
+	
+	if (PROFILER_SAMPLING) {
+		spinlock_acquire_or_wait(&_profiler_lock);
+		_profiler_write_folded_stacks();
+		spinlock_release(&_profiler_lock);
+	}
+}
+
+// Everything is streamed to the capture file already, this just makes sure it's all written.
+void dump_profile_result() {
+	profiler_flush();
+
+	u64 dropped_count = 0;
+	for (u64 i = 0; i < PROFILER_MAX_THREAD_BUFFERS; i++) dropped_count += profiler.buffers[i].dropped_count;
+	if (dropped_count != profiler.reported_dropped_count) {
+		log_warning("Profiler dropped %llu events because a thread's event buffer was full", dropped_count-profiler.reported_dropped_count);
+		profiler.reported_dropped_count = dropped_count;
+	}
+
+	if (profiler.capturing) log_verbose("Wrote profiling result to %s", profiler.capture_path);
+}
+
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
 #if ENABLE_PROFILING
+// elapsed_time may be 0 if the fallback clock is too coarse, so we loop on a separate flag
 #define tm_scope(name) \
-    for (u64 start_time = rdtsc(), end_time = start_time, elapsed_time = 0; \
-         elapsed_time == 0; \
-         elapsed_time = (end_time = rdtsc()) - start_time, _profiler_report_time_cycles(STR(name), elapsed_time, start_time))
+    for (u64 start_time = profiler_get_ticks(), elapsed_time = 0, done = 0; \
+         !done; \
+         done = 1, elapsed_time = profiler_get_ticks() - start_time, _profiler_report_time_cycles(STR(name), elapsed_time, start_time))
 #define tm_scope_var(name, var) \
     for (u64 start_time = rdtsc(), end_time = start_time, elapsed_time = 0; \
          elapsed_time == 0; \
@@ -51,8 +783,12 @@ void _profiler_report_time_cycles(string name, u64 count, u64 start) {
     for (u64 start_time = rdtsc(), end_time = start_time, elapsed_time = 0; \
          elapsed_time == 0; \
          elapsed_time = (end_time = rdtsc()) - start_time, var+=elapsed_time)
+#define tm_counter(name, value) _profiler_report_value(STR(name), (float64)(value), PROFILER_EVENT_COUNTER)
+#define tm_gauge(name, value) _profiler_report_value(STR(name), (float64)(value), PROFILER_EVENT_GAUGE)
 #else
 	#define tm_scope(...)
 	#define tm_scope_var(...)
 	#define tm_scope_accum(...)
-#endif
\ No newline at end of file
+	#define tm_counter(...)
+	#define tm_gauge(...)
+#endif
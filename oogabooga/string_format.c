@@ -29,6 +29,7 @@
 */
 
 ogb_instance void os_write_string_to_stdout(string s);
+ogb_instance void os_write_string_to_stdout_buffered(string s);
 inline int crt_sprintf(char *str, const char *format, ...);
 int vsnprintf(char* buffer, size_t n, const char* fmt, va_list args);
 bool is_pointer_valid(void *p);
@@ -301,7 +302,7 @@ void print_va_list_buffered(const string fmt, va_list args) {
 		fmt_cstring[size] = 0;
 		
 		string s = sprint_null_terminated_string_va_list_to_buffer(fmt_cstring, args, buffer, PRINT_BUFFER_SIZE);
-		os_write_string_to_stdout(s);
+		os_write_string_to_stdout_buffered(s);
 		
 		current.count -= size;
 		current.data += size;
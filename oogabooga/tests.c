@@ -450,6 +450,70 @@ void test_strings() {
     assert(strings_match(hello_balls, STR("Greetings, Balls!")), "Failed: string_replace");
 }
 
+void test_utf8() {
+	Allocator heap = get_heap_allocator();
+	
+	// 'å' is 2 bytes, '€' is 3 bytes, the smiley is 4 bytes
+	string mixed = STR("Hello \xc3\xa5 w\xe2\x82\xacrld \xf0\x9f\x98\x80!");
+	assert(utf8_validate(mixed), "Failed: utf8_validate on valid string");
+	assert(!utf8_validate(STR("abc\x80" "def")), "Failed: utf8_validate stray continuation byte");
+	assert(!utf8_validate(STR("abc\xc3")), "Failed: utf8_validate truncated sequence");
+	assert(!utf8_validate(STR("\xc0\xaf")), "Failed: utf8_validate overlong encoding");
+	
+	u32 expected[] = {'H','e','l','l','o',' ',0xE5,' ','w',0x20AC,'r','l','d',' ',0x1F600,'!'};
+	u32 decoded[32];
+	u64 consumed = 0;
+	u64 decoded_count = utf8_to_utf32_bulk(mixed, decoded, 32, &consumed);
+	assert(decoded_count == sizeof(expected)/sizeof(u32), "Failed: utf8_to_utf32_bulk count, got %llu", decoded_count);
+	assert(consumed == mixed.count, "Failed: utf8_to_utf32_bulk consumed");
+	assert(bytes_match(decoded, expected, sizeof(expected)), "Failed: utf8_to_utf32_bulk");
+	
+	decoded_count = utf8_to_utf32_bulk(STR("ab\x80z"), decoded, 32, &consumed);
+	assert(decoded_count == 4 && decoded[2] == UNI_REPLACEMENT_CHAR && decoded[3] == 'z', "Failed: utf8_to_utf32_bulk stray continuation byte");
+	
+	// Long enough to go through the wide ascii path, with some multi-byte codepoints in between
+	String_Builder b;
+	string_builder_init(&b, heap);
+	for (u64 i = 0; i < 200; i++) {
+		string_builder_append(&b, STR("The quick brown fox jumps over the lazy dog. "));
+		if (i % 3 == 0) string_builder_append(&b, STR("\xe2\x82\xac"));
+	}
+	string text = b.result;
+	assert(utf8_validate(text), "Failed: utf8_validate long string");
+	
+	u32 *text_utf32 = alloc(heap, text.count*sizeof(u32));
+	u64 text_codepoints = utf8_to_utf32_bulk(text, text_utf32, text.count, 0);
+	
+	Utf8_Index index;
+	utf8_index_init(&index, text, 16, heap);
+	assert(index.codepoint_count == text_codepoints, "Failed: Utf8_Index codepoint count");
+	for (u64 i = 0; i <= text_codepoints + 2; i += 7) {
+		assert(utf8_index_lookup(&index, i) == utf8_index_to_byte_index(text, i), "Failed: utf8_index_lookup at %llu", i);
+	}
+	
+	string slice = utf8_index_slice(&index, 45, 3);
+	string slow_slice = utf8_slice(text, 45, 3);
+	assert(strings_match(slice, slow_slice), "Failed: utf8_index_slice");
+	assert(next_utf8(&slice) == 0x20AC, "Failed: utf8_index_slice");
+	
+	utf8_index_deinit(&index);
+	dealloc(heap, text_utf32);
+	string_builder_deinit(&b);
+}
+
+typedef struct File_Close_Test_Data {
+	File file;
+	volatile bool written;
+	volatile bool closed;
+} File_Close_Test_Data;
+void file_close_test_writer(Thread *t) {
+	File_Close_Test_Data *data = (File_Close_Test_Data*)t->data;
+	fprint(data->file, "Other thread;");
+	data->written = true;
+	// Stay alive so the close has to flush our buffer, not the thread exit
+	while (!data->closed) os_yield_thread();
+}
+
 void test_file_io() {
 
 #if TARGET_OS == WINDOWS && !OOGABOOGA_LINK_EXTERNAL_INSTANCE
@@ -523,6 +587,48 @@ void test_file_io() {
     assert(read_entire_result, "Failed: could not read balls.txt");
     assert(strings_match(hello_balls, STR("Hello, Balls!")), "Failed: balls read/write mismatch. Expected 'Hello, Balls!', got '%s'", hello_balls);
     
+    // Test buffered fprint across many buffer flushes
+    File lines_file = os_file_open("lines.txt", O_WRITE | O_CREATE);
+    assert(lines_file != OS_INVALID_FILE, "Failed: Could not create lines.txt");
+    String_Builder expected_lines;
+    string_builder_init(&expected_lines, heap);
+    for (u64 i = 0; i < 2000; i++) {
+    	fprint(lines_file, "Line number %llu\n", i);
+    	string_builder_print(&expected_lines, "Line number %llu\n", i);
+    }
+    os_flush(lines_file);
+    assert(os_file_get_size(lines_file) == expected_lines.count, "Failed: os_flush did not write all buffered output");
+    fprint(lines_file, "Last line");
+    string_builder_append(&expected_lines, STR("Last line"));
+    os_file_close(lines_file);
+    string lines_read;
+    read_entire_result = os_read_entire_file("lines.txt", &lines_read, heap);
+    assert(read_entire_result, "Failed: could not read lines.txt");
+    assert(strings_match(lines_read, expected_lines.result), "Failed: buffered fprint output mismatch");
+    dealloc(heap, lines_read.data);
+    string_builder_deinit(&expected_lines);
+    
+    // Closing a file flushes what other threads have buffered for it too
+    File_Close_Test_Data close_data = {0};
+    close_data.file = os_file_open("close.txt", O_WRITE | O_CREATE);
+    assert(close_data.file != OS_INVALID_FILE, "Failed: Could not create close.txt");
+    Thread close_thread;
+    os_thread_init(&close_thread, file_close_test_writer);
+    close_thread.data = &close_data;
+    os_thread_start(&close_thread);
+    while (!close_data.written) os_yield_thread();
+    fprint(close_data.file, "This thread;");
+    os_file_close(close_data.file);
+    close_data.closed = true;
+    os_thread_join(&close_thread);
+    os_thread_destroy(&close_thread);
+    string close_read;
+    read_entire_result = os_read_entire_file("close.txt", &close_read, heap);
+    assert(read_entire_result, "Failed: could not read close.txt");
+    assert(close_read.count == STR("Other thread;This thread;").count, "Failed: os_file_close did not flush other threads' output, got '%s'", close_read);
+    assert(string_find_from_left(close_read, STR("Other thread;")) != -1, "Failed: os_file_close lost other thread's output");
+    dealloc(heap, close_read.data);
+    
     u64 integers[4096];
     for (u64 i = 0; i < 4096; i++) {
     	integers[i] = get_random();
@@ -581,6 +687,10 @@ void test_file_io() {
     assert(delete_ok, "Failed: could not delete entire_test.txt");
     delete_ok = os_file_delete("balls.txt");
     assert(delete_ok, "Failed: could not delete balls.txt");
+    delete_ok = os_file_delete("lines.txt");
+    assert(delete_ok, "Failed: could not delete lines.txt");
+    delete_ok = os_file_delete("close.txt");
+    assert(delete_ok, "Failed: could not delete close.txt");
     delete_ok = os_file_delete("integers");
     assert(delete_ok, "Failed: could not delete integers"); 
     delete_ok = os_delete_directory("test_dir", false);
@@ -1224,6 +1334,59 @@ void test_random_distribution() {
     print("Min: %d, max: %d\n", min_bin, max_bin);
 }
 
+#define LOCK_TEST_THREAD_COUNT 8
+#define LOCK_TEST_ITERATIONS 10000
+typedef struct Lock_Test_Data {
+	Spinlock spinlock;
+	Ticket_Lock ticket_lock;
+	u64 spinlock_counter;
+	u64 ticket_lock_counter;
+} Lock_Test_Data;
+void lock_test_thread_proc(Thread *t) {
+	Lock_Test_Data *data = (Lock_Test_Data*)t->data;
+	for (u64 i = 0; i < LOCK_TEST_ITERATIONS; i++) {
+		spinlock_acquire_or_wait(&data->spinlock);
+		data->spinlock_counter += 1;
+		spinlock_release(&data->spinlock);
+		
+		ticket_lock_acquire_or_wait(&data->ticket_lock);
+		data->ticket_lock_counter += 1;
+		ticket_lock_release(&data->ticket_lock);
+	}
+}
+void test_spinlocks() {
+	Lock_Test_Data data = {0};
+	spinlock_init(&data.spinlock);
+	ticket_lock_init(&data.ticket_lock);
+	
+	assert(spinlock_acquire_or_wait_timeout(&data.spinlock, 0.1), "Failed: Spinlock should be free");
+	assert(!spinlock_acquire_or_wait_timeout(&data.spinlock, 0.001), "Failed: Spinlock acquire should time out");
+	spinlock_release(&data.spinlock);
+	
+	assert(ticket_lock_try_acquire(&data.ticket_lock), "Failed: ticket_lock_try_acquire on free lock");
+	assert(!ticket_lock_try_acquire(&data.ticket_lock), "Failed: ticket_lock_try_acquire on acquired lock");
+	ticket_lock_release(&data.ticket_lock);
+	
+	Thread threads[LOCK_TEST_THREAD_COUNT];
+	for (u64 i = 0; i < LOCK_TEST_THREAD_COUNT; i++) {
+		os_thread_init(&threads[i], lock_test_thread_proc);
+		threads[i].data = &data;
+		os_thread_start(&threads[i]);
+	}
+	for (u64 i = 0; i < LOCK_TEST_THREAD_COUNT; i++) {
+		os_thread_join(&threads[i]);
+		os_thread_destroy(&threads[i]);
+	}
+	
+	assert(data.spinlock_counter == LOCK_TEST_THREAD_COUNT*LOCK_TEST_ITERATIONS, "Failed: Spinlock let more than one thread in");
+	assert(data.ticket_lock_counter == LOCK_TEST_THREAD_COUNT*LOCK_TEST_ITERATIONS, "Failed: Ticket lock let more than one thread in");
+	
+#if ENABLE_LOCK_CONTENTION_STATS
+	assert(data.ticket_lock.stats.acquire_count == LOCK_TEST_THREAD_COUNT*LOCK_TEST_ITERATIONS+1, "Failed: Ticket lock acquire count is %llu", data.ticket_lock.stats.acquire_count);
+	print("\n\tSpinlock contended %llu times, ticket lock contended %llu times\n", data.spinlock.stats.contended_count, data.ticket_lock.stats.contended_count);
+#endif
+}
+
 #define MUTEX_TEST_TASK_COUNT 1000
 typedef struct Mutex_Test_Shared_Data {
     int counter;
@@ -1246,15 +1409,16 @@ void test_mutex() {
     
     // Test initialization
     mutex_init(&m);
-    assert(m.spin_time_microseconds == MUTEX_DEFAULT_SPIN_TIME_MICROSECONDS, "Failed: Default spin time incorrect");
-    assert(!m.spinlock_acquired, "Failed: Spinlock should not be acquired after initialization");
+    assert(m.spin_count == MUTEX_DEFAULT_SPIN_COUNT, "Failed: Default spin count incorrect");
+    assert(m.state == MUTEX_UNLOCKED, "Failed: Mutex should not be acquired after initialization");
 
     // Test acquire and release without contention
     mutex_acquire_or_wait(&m);
-    assert(m.spinlock_acquired, "Failed: Mutex should be acquired after mutex_acquire_or_wait");
+    assert(m.state != MUTEX_UNLOCKED, "Failed: Mutex should be acquired after mutex_acquire_or_wait");
+    assert(!mutex_try_acquire(&m), "Failed: mutex_try_acquire should fail when the mutex is acquired");
     
     mutex_release(&m);
-    assert(!m.spinlock_acquired, "Failed: Spinlock should not be acquired after mutex_release");
+    assert(m.state == MUTEX_UNLOCKED, "Failed: Mutex should not be acquired after mutex_release");
 
     // Clean up
     mutex_destroy(&m);
@@ -1285,7 +1449,1018 @@ void test_mutex() {
     mutex_destroy(&data.mutex);
 }
 
+#define SEMAPHORE_TEST_THREAD_COUNT 8
+#define SEMAPHORE_TEST_ITEM_COUNT 10000
+typedef struct Semaphore_Test_Data {
+	Semaphore items;
+	Semaphore done;
+	volatile u64 consumed;
+} Semaphore_Test_Data;
+void semaphore_test_consumer(Thread *t) {
+	Semaphore_Test_Data *data = (Semaphore_Test_Data*)t->data;
+	while (true) {
+		semaphore_wait(&data->items);
+		if (atomic_fetch_add_64(&data->consumed, 1) + 1 == SEMAPHORE_TEST_ITEM_COUNT) {
+			semaphore_signal(&data->done, 1);
+		}
+		if (data->consumed >= SEMAPHORE_TEST_ITEM_COUNT) break;
+	}
+}
+void test_semaphore() {
+	Semaphore s;
+	semaphore_init(&s, 2);
+	assert(semaphore_try_wait(&s), "Failed: semaphore_try_wait with count 2");
+	assert(semaphore_try_wait(&s), "Failed: semaphore_try_wait with count 1");
+	assert(!semaphore_try_wait(&s), "Failed: semaphore_try_wait should fail with count 0");
+	assert(!semaphore_wait_timeout(&s, 1), "Failed: semaphore_wait_timeout should time out");
+	semaphore_signal(&s, 1);
+	assert(semaphore_wait_timeout(&s, 0), "Failed: semaphore_wait_timeout after signal");
+	semaphore_destroy(&s);
+	
+	Binary_Semaphore b;
+	binary_semaphore_init(&b, true);
+	binary_semaphore_wait(&b);
+	assert(b.signaled == 0, "Failed: binary_semaphore_wait should reset the semaphore");
+	binary_semaphore_signal(&b);
+	binary_semaphore_signal(&b);
+	assert(b.signaled == 1, "Failed: binary semaphore should not count signals");
+	binary_semaphore_destroy(&b);
+	
+	// Consumers sleep on the semaphore while we produce
+	Semaphore_Test_Data data;
+	semaphore_init(&data.items, 0);
+	semaphore_init(&data.done, 0);
+	data.consumed = 0;
+	
+	Thread threads[SEMAPHORE_TEST_THREAD_COUNT];
+	for (u64 i = 0; i < SEMAPHORE_TEST_THREAD_COUNT; i++) {
+		os_thread_init(&threads[i], semaphore_test_consumer);
+		threads[i].data = &data;
+		os_thread_start(&threads[i]);
+	}
+	for (u64 i = 0; i < SEMAPHORE_TEST_ITEM_COUNT; i++) {
+		semaphore_signal(&data.items, 1);
+	}
+	semaphore_wait(&data.done);
+	assert(data.consumed == SEMAPHORE_TEST_ITEM_COUNT, "Failed: consumed %llu items, expected %d", data.consumed, SEMAPHORE_TEST_ITEM_COUNT);
+	
+	// Release the consumers still waiting
+	semaphore_signal(&data.items, SEMAPHORE_TEST_THREAD_COUNT);
+	for (u64 i = 0; i < SEMAPHORE_TEST_THREAD_COUNT; i++) {
+		os_thread_join(&threads[i]);
+		os_thread_destroy(&threads[i]);
+	}
+}
+
+#define RW_LOCK_TEST_READER_COUNT 6
+#define RW_LOCK_TEST_WRITER_COUNT 2
+#define RW_LOCK_TEST_ITERATIONS 20000
+typedef struct Rw_Lock_Test_Pair {
+	u64 a;
+	u64 b; // Always a*3
+} Rw_Lock_Test_Pair;
+typedef struct Rw_Lock_Test_Data {
+	RW_Lock rw_lock;
+	Seqlock seqlock;
+	Rw_Lock_Test_Pair locked_pair;
+	Rw_Lock_Test_Pair seqlock_pair;
+	volatile u64 active_readers;
+	volatile u64 active_writers;
+	volatile u64 torn_reads;
+} Rw_Lock_Test_Data;
+void rw_lock_test_reader(Thread *t) {
+	Rw_Lock_Test_Data *data = (Rw_Lock_Test_Data*)t->data;
+	for (u64 i = 0; i < RW_LOCK_TEST_ITERATIONS; i++) {
+		rw_lock_acquire_read(&data->rw_lock);
+		atomic_fetch_add_64(&data->active_readers, 1);
+		assert(data->active_writers == 0, "Failed: Reader got in while a writer held the lock");
+		Rw_Lock_Test_Pair pair = data->locked_pair;
+		if (pair.b != pair.a*3) atomic_fetch_add_64(&data->torn_reads, 1);
+		atomic_fetch_add_64(&data->active_readers, (u64)-1);
+		rw_lock_release_read(&data->rw_lock);
+		
+		seqlock_read_copy(&data->seqlock, &pair, &data->seqlock_pair, sizeof(pair));
+		if (pair.b != pair.a*3) atomic_fetch_add_64(&data->torn_reads, 1);
+		
+		if (i % 64 == 0) os_yield_thread();
+	}
+}
+void rw_lock_test_writer(Thread *t) {
+	Rw_Lock_Test_Data *data = (Rw_Lock_Test_Data*)t->data;
+	for (u64 i = 0; i < RW_LOCK_TEST_ITERATIONS; i++) {
+		rw_lock_acquire_write(&data->rw_lock);
+		assert(atomic_fetch_add_64(&data->active_writers, 1) == 0, "Failed: More than one writer got in");
+		assert(data->active_readers == 0, "Failed: Writer got in while readers held the lock");
+		data->locked_pair.a += 1;
+		data->locked_pair.b = data->locked_pair.a*3;
+		atomic_fetch_add_64(&data->active_writers, (u64)-1);
+		rw_lock_release_write(&data->rw_lock);
+		
+		seqlock_write_begin(&data->seqlock);
+		data->seqlock_pair.a += 1;
+		data->seqlock_pair.b = data->seqlock_pair.a*3;
+		seqlock_write_end(&data->seqlock);
+		
+		if (i % 64 == 0) os_yield_thread();
+	}
+}
+void test_rw_locks() {
+	Rw_Lock_Test_Data data = {0};
+	rw_lock_init(&data.rw_lock);
+	seqlock_init(&data.seqlock);
+	
+	rw_lock_acquire_read(&data.rw_lock);
+	rw_lock_acquire_read(&data.rw_lock);
+	assert(data.rw_lock.state == 2, "Failed: Two readers should hold the lock");
+	rw_lock_release_read(&data.rw_lock);
+	rw_lock_release_read(&data.rw_lock);
+	rw_lock_acquire_write(&data.rw_lock);
+	assert(data.rw_lock.state == RW_LOCK_WRITER, "Failed: Writer should hold the lock");
+	rw_lock_release_write(&data.rw_lock);
+	
+	u32 sequence = seqlock_read_begin(&data.seqlock);
+	assert(!seqlock_read_retry(&data.seqlock, sequence), "Failed: Seqlock read should not retry without writes");
+	seqlock_write_begin(&data.seqlock);
+	seqlock_write_end(&data.seqlock);
+	assert(seqlock_read_retry(&data.seqlock, sequence), "Failed: Seqlock read should retry after a write");
+	
+	Thread threads[RW_LOCK_TEST_READER_COUNT+RW_LOCK_TEST_WRITER_COUNT];
+	for (u64 i = 0; i < RW_LOCK_TEST_READER_COUNT+RW_LOCK_TEST_WRITER_COUNT; i++) {
+		os_thread_init(&threads[i], i < RW_LOCK_TEST_READER_COUNT ? rw_lock_test_reader : rw_lock_test_writer);
+		threads[i].data = &data;
+		os_thread_start(&threads[i]);
+	}
+	for (u64 i = 0; i < RW_LOCK_TEST_READER_COUNT+RW_LOCK_TEST_WRITER_COUNT; i++) {
+		os_thread_join(&threads[i]);
+		os_thread_destroy(&threads[i]);
+	}
+	
+	assert(data.torn_reads == 0, "Failed: %llu reads saw a half written pair", data.torn_reads);
+	assert(data.locked_pair.a == RW_LOCK_TEST_WRITER_COUNT*RW_LOCK_TEST_ITERATIONS, "Failed: Lost RW_Lock writes");
+	assert(data.seqlock_pair.a == RW_LOCK_TEST_WRITER_COUNT*RW_LOCK_TEST_ITERATIONS, "Failed: Lost seqlock writes");
+	assert(data.rw_lock.state == 0 && data.rw_lock.waiting_writer_count == 0, "Failed: RW_Lock not released");
+}
+
+#define QUEUE_TEST_ITEM_COUNT 1000000
+#define QUEUE_TEST_THREAD_COUNT 4
+typedef struct Queue_Test_Data {
+	Spsc_Queue spsc;
+	Mpmc_Queue mpmc;
+	volatile u64 consumed_count;
+	volatile u64 consumed_sum;
+} Queue_Test_Data;
+void queue_test_spsc_producer(Thread *t) {
+	Queue_Test_Data *data = (Queue_Test_Data*)t->data;
+	u64 batch[16];
+	u64 i = 0;
+	while (i < QUEUE_TEST_ITEM_COUNT) {
+		if (i % 3 == 0) {
+			u64 n = min(16, QUEUE_TEST_ITEM_COUNT-i);
+			for (u64 j = 0; j < n; j++) batch[j] = i+j;
+			u64 pushed = 0;
+			while (pushed < n) {
+				u64 count = spsc_queue_push_batch(&data->spsc, batch+pushed, n-pushed);
+				if (count == 0) os_yield_thread();
+				pushed += count;
+			}
+			i += n;
+		} else {
+			while (!spsc_queue_push(&data->spsc, &i)) os_yield_thread();
+			i += 1;
+		}
+	}
+}
+void queue_test_mpmc_producer(Thread *t) {
+	Queue_Test_Data *data = (Queue_Test_Data*)t->data;
+	u64 batch[8];
+	for (u64 i = 0; i < QUEUE_TEST_ITEM_COUNT; i += 8) {
+		for (u64 j = 0; j < 8; j++) batch[j] = i+j;
+		u64 pushed = 0;
+		while (pushed < 8) {
+			u64 count = mpmc_queue_push_batch(&data->mpmc, batch+pushed, 8-pushed);
+			if (count == 0) os_yield_thread();
+			pushed += count;
+		}
+	}
+}
+void queue_test_mpmc_consumer(Thread *t) {
+	Queue_Test_Data *data = (Queue_Test_Data*)t->data;
+	u64 count = 0;
+	u64 sum = 0;
+	u64 items[8];
+	while (atomic_load_acquire_64(&data->consumed_count) + count < QUEUE_TEST_ITEM_COUNT*QUEUE_TEST_THREAD_COUNT) {
+		u64 n = mpmc_queue_pop_batch(&data->mpmc, items, 8);
+		for (u64 i = 0; i < n; i++) sum += items[i];
+		count += n;
+		if (n == 0) {
+			// Publish so the others know when we're all done
+			atomic_fetch_add_64(&data->consumed_count, count);
+			atomic_fetch_add_64(&data->consumed_sum, sum);
+			count = 0;
+			sum = 0;
+			os_yield_thread();
+		}
+	}
+	atomic_fetch_add_64(&data->consumed_count, count);
+	atomic_fetch_add_64(&data->consumed_sum, sum);
+}
+void test_queues() {
+	Allocator heap = get_heap_allocator();
+	Queue_Test_Data *data = alloc(heap, sizeof(Queue_Test_Data));
+	
+	// Basics
+	Spsc_Queue q;
+	spsc_queue_init(&q, sizeof(u32), 5, heap);
+	assert(q.capacity == 8, "Failed: Queue capacity should round up to a power of two");
+	for (u32 i = 0; i < 8; i++) assert(spsc_queue_push(&q, &i), "Failed: spsc_queue_push");
+	u32 x = 0;
+	assert(!spsc_queue_push(&q, &x), "Failed: Pushed to a full queue");
+	for (u32 i = 0; i < 8; i++) {
+		assert(spsc_queue_pop(&q, &x) && x == i, "Failed: spsc_queue_pop");
+	}
+	assert(!spsc_queue_pop(&q, &x), "Failed: Popped from an empty queue");
+	spsc_queue_destroy(&q);
+	
+	Mpmc_Queue mq;
+	mpmc_queue_init(&mq, sizeof(u32), 8, heap);
+	u32 values[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+	assert(mpmc_queue_push_batch(&mq, values, 10) == 8, "Failed: mpmc_queue_push_batch should stop when full");
+	u32 out[10];
+	assert(mpmc_queue_pop_batch(&mq, out, 3) == 3 && out[2] == 2, "Failed: mpmc_queue_pop_batch");
+	assert(mpmc_queue_push_batch(&mq, values+8, 2) == 2, "Failed: mpmc_queue_push_batch after wrap");
+	assert(mpmc_queue_pop_batch(&mq, out, 10) == 7 && out[6] == 9, "Failed: mpmc_queue_pop_batch after wrap");
+	assert(!mpmc_queue_pop(&mq, &x), "Failed: Popped from an empty queue");
+	mpmc_queue_destroy(&mq);
+	
+	// SPSC stress, items must come out in order
+	spsc_queue_init(&data->spsc, sizeof(u64), 1024, heap);
+	Thread producer;
+	os_thread_init(&producer, queue_test_spsc_producer);
+	producer.data = data;
+	
+	f64 start = os_get_elapsed_seconds();
+	os_thread_start(&producer);
+	u64 expected = 0;
+	u64 items[32];
+	while (expected < QUEUE_TEST_ITEM_COUNT) {
+		u64 n = spsc_queue_pop_batch(&data->spsc, items, 32);
+		if (n == 0) os_yield_thread();
+		for (u64 i = 0; i < n; i++) {
+			assert(items[i] == expected, "Failed: SPSC queue out of order, expected %llu got %llu", expected, items[i]);
+			expected += 1;
+		}
+	}
+	f64 spsc_seconds = os_get_elapsed_seconds()-start;
+	os_thread_join(&producer);
+	os_thread_destroy(&producer);
+	spsc_queue_destroy(&data->spsc);
+	
+	// MPMC stress, every item must come out exactly once
+	mpmc_queue_init(&data->mpmc, sizeof(u64), 1024, heap);
+	data->consumed_count = 0;
+	data->consumed_sum = 0;
+	Thread producers[QUEUE_TEST_THREAD_COUNT];
+	Thread consumers[QUEUE_TEST_THREAD_COUNT];
+	for (u64 i = 0; i < QUEUE_TEST_THREAD_COUNT; i++) {
+		os_thread_init(&producers[i], queue_test_mpmc_producer);
+		os_thread_init(&consumers[i], queue_test_mpmc_consumer);
+		producers[i].data = data;
+		consumers[i].data = data;
+	}
+	start = os_get_elapsed_seconds();
+	for (u64 i = 0; i < QUEUE_TEST_THREAD_COUNT; i++) {
+		os_thread_start(&producers[i]);
+		os_thread_start(&consumers[i]);
+	}
+	for (u64 i = 0; i < QUEUE_TEST_THREAD_COUNT; i++) {
+		os_thread_join(&producers[i]);
+		os_thread_join(&consumers[i]);
+		os_thread_destroy(&producers[i]);
+		os_thread_destroy(&consumers[i]);
+	}
+	f64 mpmc_seconds = os_get_elapsed_seconds()-start;
+	
+	u64 expected_sum = QUEUE_TEST_THREAD_COUNT*((u64)QUEUE_TEST_ITEM_COUNT*(QUEUE_TEST_ITEM_COUNT-1)/2);
+	assert(data->consumed_count == QUEUE_TEST_ITEM_COUNT*QUEUE_TEST_THREAD_COUNT, "Failed: MPMC queue consumed %llu items", data->consumed_count);
+	assert(data->consumed_sum == expected_sum, "Failed: MPMC queue items were lost or duplicated");
+	mpmc_queue_destroy(&data->mpmc);
+	
+	print("\n\tSPSC: %.2f million items/second", (f64)QUEUE_TEST_ITEM_COUNT/spsc_seconds/1000000.0);
+	print("\n\tMPMC (%d producers, %d consumers): %.2f million items/second\n", QUEUE_TEST_THREAD_COUNT, QUEUE_TEST_THREAD_COUNT, (f64)(QUEUE_TEST_ITEM_COUNT*QUEUE_TEST_THREAD_COUNT)/mpmc_seconds/1000000.0);
+	
+	dealloc(heap, data);
+}
+
+#define LOGGER_TEST_THREAD_COUNT 4
+#define LOGGER_TEST_MESSAGES_PER_THREAD 8
+void logger_test_thread_proc(Thread *t) {
+	for (u64 i = 0; i < LOGGER_TEST_MESSAGES_PER_THREAD; i++) {
+		log_info("Logger test message %llu from thread %llu", i, t->id);
+	}
+}
+void test_logger() {
+	if (!async_logger.running) return;
+	
+	log_flush();
+	bool ok = log_set_output_file(STR("logger_test.txt"));
+	assert(ok, "Failed: log_set_output_file");
+	
+	Thread threads[LOGGER_TEST_THREAD_COUNT];
+	for (u64 i = 0; i < LOGGER_TEST_THREAD_COUNT; i++) {
+		os_thread_init(&threads[i], logger_test_thread_proc);
+		os_thread_start(&threads[i]);
+	}
+	for (u64 i = 0; i < LOGGER_TEST_THREAD_COUNT; i++) {
+		os_thread_join(&threads[i]);
+		os_thread_destroy(&threads[i]);
+	}
+	
+	log_flush();
+	log_set_output_file(STR(""));
+	
+	string content;
+	ok = os_read_entire_file("logger_test.txt", &content, get_heap_allocator());
+	assert(ok, "Failed: could not read logger_test.txt");
+	
+	u64 line_count = 0;
+	for (u64 i = 0; i < content.count; i++) {
+		if (content.data[i] == '\n') line_count += 1;
+	}
+	assert(line_count == LOGGER_TEST_THREAD_COUNT*LOGGER_TEST_MESSAGES_PER_THREAD, "Failed: expected %d log lines, got %llu", LOGGER_TEST_THREAD_COUNT*LOGGER_TEST_MESSAGES_PER_THREAD, line_count);
+	assert(string_starts_with(content, STR("[INFO]:    Logger test message")), "Failed: unexpected log output");
+	
+	dealloc_string(get_heap_allocator(), content);
+	os_file_delete("logger_test.txt");
+}
+
+#if ENABLE_PROFILING
+// Whatever is on disk should always be a complete JSON array
+string profiler_test_read_capture(string path) {
+	string content;
+	bool ok = os_read_entire_file_s(path, &content, get_heap_allocator());
+	assert(ok, "Failed: could not read profiler capture %s", path);
+	assert(content.count >= 4 && content.data[0] == '[', "Failed: profiler capture %s doesn't start with [", path);
+	assert(strings_match(string_view(content, content.count-3, 3), STR("{}]")), "Failed: profiler capture %s doesn't end with {}]", path);
+	return content;
+}
+void test_profiler_capture() {
+	// The capture to google_trace.json is started over after the test
+	bool was_capturing = profiler_is_capturing();
+	string previous_path = string_copy(profiler.capture_path, get_heap_allocator());
+	
+	bool ok = profiler_start_capture(STR("profiler_test.json"));
+	assert(ok, "Failed: profiler_start_capture");
+	tm_scope("Profiler test scope") {
+		tm_counter("Profiler test counter", 2);
+		tm_counter("Profiler test counter", 3);
+		tm_gauge("Profiler test gauge", 69);
+	}
+	profiler_flush();
+	profiler_stop_capture();
+	
+	string content = profiler_test_read_capture(STR("profiler_test.json"));
+	assert(string_find_from_left(content, STR("\"name\":\"Profiler test scope\",\"ph\":\"X\"")) != -1, "Failed: profiler capture is missing the scope");
+	assert(string_find_from_left(content, STR("\"name\":\"Profiler test counter\"")) != -1, "Failed: profiler capture is missing the counter");
+	assert(string_find_from_left(content, STR("\"value\":5.000")) != -1, "Failed: profiler counter should plot the running total");
+	assert(string_find_from_left(content, STR("\"value\":69.000")) != -1, "Failed: profiler capture is missing the gauge");
+	dealloc_string(get_heap_allocator(), content);
+	
+	// With a tiny file size every flush rotates, and each new file names the threads again
+	profiler.max_file_size = 1;
+	ok = profiler_start_capture(STR("profiler_test.json"));
+	assert(ok, "Failed: profiler_start_capture");
+	tm_scope("Profiler test rotation") {}
+	profiler_flush();
+	profiler_stop_capture();
+	profiler.max_file_size = PROFILER_MAX_FILE_SIZE;
+	
+	content = profiler_test_read_capture(STR("profiler_test_1.json"));
+	assert(string_find_from_left(content, STR("\"thread_name\"")) != -1, "Failed: rotated profiler capture doesn't name the threads");
+	assert(string_find_from_left(content, STR("Main thread")) != -1, "Failed: rotated profiler capture is missing the main thread name");
+	dealloc_string(get_heap_allocator(), content);
+	
+	// The background thread might have rotated a few more times
+	os_file_delete("profiler_test.json");
+	for (u64 i = 1; os_file_delete_s(tprint("profiler_test_%llu.json", i)); i++);
+	
+	if (was_capturing) profiler_start_capture(previous_path);
+	dealloc_string(get_heap_allocator(), previous_path);
+}
+void test_profiler_events() {
+	// Drops are only counted while capturing
+	bool was_capturing = profiler_is_capturing();
+	string previous_path = string_copy(profiler.capture_path, get_heap_allocator());
+	bool ok = profiler_start_capture(STR("profiler_test.json"));
+	assert(ok, "Failed: profiler_start_capture");
+	
+	string name = STR("Profiler test drop");
+	u32 name_id = _profiler_get_name_id(name);
+	assert(_profiler_get_name_id(name) == name_id, "Failed: profiler name should keep its id");
+	
+	// Hold the lock so the background thread can't drain the buffer while we fill it
+	spinlock_acquire_or_wait(&_profiler_lock);
+	Profiler_Thread_Buffer *b = _profiler_thread_buffer;
+	assert(b, "Failed: main thread should have a profiler buffer by now");
+	u64 dropped_before = b->dropped_count;
+	u64 reported_before = profiler.reported_dropped_count;
+	u64 free_count = PROFILER_EVENTS_PER_THREAD - (b->write_pos - b->read_pos);
+	for (u64 i = 0; i < free_count+100; i++) {
+		_profiler_push_event(name_id, PROFILER_EVENT_SCOPE, profiler_get_ticks(), 1);
+	}
+	spinlock_release(&_profiler_lock);
+	
+	assert(b->dropped_count-dropped_before == 100, "Failed: expected 100 dropped profiler events, got %llu", b->dropped_count-dropped_before);
+	dump_profile_result();
+	assert(profiler.reported_dropped_count-reported_before >= 100, "Failed: dump_profile_result should report the dropped events");
+	assert(b->read_pos == b->write_pos, "Failed: dump_profile_result should drain the buffers");
+	
+	// Fill every free name slot so the next new name has nowhere to go
+	u32 *filled = (u32*)alloc(get_heap_allocator(), PROFILER_MAX_NAMES*sizeof(u32));
+	u64 filled_count = 0;
+	static u8 dummy_name = 0;
+	spinlock_acquire_or_wait(&profiler.name_lock);
+	for (u32 i = 0; i < PROFILER_MAX_NAMES; i++) {
+		if (profiler.names[i].data) continue;
+		profiler.names[i].count = 0;
+		profiler.names[i].data = &dummy_name;
+		filled[filled_count++] = i;
+	}
+	spinlock_release(&profiler.name_lock);
+	
+	assert(_profiler_get_name_id(STR("Profiler test one name too many")) == profiler.too_many_names_name_id, "Failed: a full name table should give the too many names id");
+	assert(_profiler_get_name_id(name) == name_id, "Failed: existing profiler names should keep working when the table is full");
+	
+	spinlock_acquire_or_wait(&profiler.name_lock);
+	for (u64 i = 0; i < filled_count; i++) {
+		profiler.names[filled[i]].data = 0;
+	}
+	spinlock_release(&profiler.name_lock);
+	dealloc(get_heap_allocator(), filled);
+	
+	// Naming a thread again with the same name, from a different buffer, reuses the copy
+	profiler_set_thread_name(tprint("Profiler test thread %d", 1));
+	u64 thread_name_copy_count = profiler.thread_name_copy_count;
+	profiler_set_thread_name(tprint("Profiler test thread %d", 1));
+	assert(profiler.thread_name_copy_count == thread_name_copy_count, "Failed: profiler_set_thread_name should only copy each name once");
+	profiler_set_thread_name(STR("Main thread"));
+	assert(profiler.thread_name_copy_count == thread_name_copy_count, "Failed: profiler_set_thread_name should only copy each name once");
+	
+	profiler_stop_capture();
+	os_file_delete("profiler_test.json");
+	for (u64 i = 1; os_file_delete_s(tprint("profiler_test_%llu.json", i)); i++);
+	
+	if (was_capturing) profiler_start_capture(previous_path);
+	dealloc_string(get_heap_allocator(), previous_path);
+}
+#endif // ENABLE_PROFILING
+
+#define JOBS_TEST_COUNT 100000
+void jobs_test_parallel_for_proc(u64 first, u64 end, void *userdata) {
+	u64 *results = (u64*)userdata;
+	for (u64 i = first; i < end; i++) {
+		assert(results[i] == 0, "Failed: parallel_for visited index %llu twice", i);
+		results[i] = i*2+1;
+	}
+}
+void jobs_test_nested_proc(u64 first, u64 end, void *userdata) {
+	u64 *results = (u64*)userdata;
+	for (u64 i = first; i < end; i++) {
+		// Temp allocations must survive the nested parallel_for
+		u64 *temp = (u64*)talloc(sizeof(u64));
+		*temp = i;
+		parallel_for(64, 8, jobs_test_parallel_for_proc, results + i*64);
+		assert(*temp == i, "Failed: temp storage was reset during a nested parallel_for");
+	}
+}
+void jobs_test_many_batches_proc(u64 first, u64 end, void *userdata) {
+	// One item per batch, which is a lot of parallel_for bookkeeping for a job
+	u64 *results = (u64*)userdata;
+	for (u64 i = first; i < end; i++) {
+		parallel_for(4096, 1, jobs_test_parallel_for_proc, results + i*4096);
+	}
+}
+void jobs_test_job_proc(void *data) {
+	u64 *value = (u64*)data;
+	*value += 1;
+}
+void jobs_test_waiting_job_proc(void *data) {
+	// Waits on its own child jobs, which parks the fiber
+	u64 *value = (u64*)data;
+	u64 children[4] = {0};
+	Job_Counter counter = {0};
+	for (u64 i = 0; i < 4; i++) job_submit(jobs_test_job_proc, &children[i], &counter);
+	job_wait_for_counter(&counter);
+	
+	for (u64 i = 0; i < 4; i++) *value += children[i];
+}
+void test_jobs() {
+	u64 *results = (u64*)alloc(get_heap_allocator(), JOBS_TEST_COUNT*sizeof(u64));
+	memset(results, 0, JOBS_TEST_COUNT*sizeof(u64));
+	
+	parallel_for(JOBS_TEST_COUNT, 0, jobs_test_parallel_for_proc, results);
+	for (u64 i = 0; i < JOBS_TEST_COUNT; i++) {
+		assert(results[i] == i*2+1, "Failed: parallel_for missed index %llu", i);
+	}
+	
+	memset(results, 0, JOBS_TEST_COUNT*sizeof(u64));
+	parallel_for(JOBS_TEST_COUNT/64, 4, jobs_test_nested_proc, results);
+	for (u64 i = 0; i < (JOBS_TEST_COUNT/64)*64; i++) {
+		assert(results[i] == (i%64)*2+1, "Failed: nested parallel_for missed index %llu", i);
+	}
+	
+	memset(results, 0, JOBS_TEST_COUNT*sizeof(u64));
+	parallel_for(4, 1, jobs_test_many_batches_proc, results);
+	for (u64 i = 0; i < 4*4096; i++) {
+		assert(results[i] == (i%4096)*2+1, "Failed: parallel_for with many batches missed index %llu", i);
+	}
+	
+	u64 values[1000] = {0};
+	Job_Counter counter = {0};
+	for (u64 i = 0; i < 1000; i++) {
+		job_submit(jobs_test_job_proc, &values[i], &counter);
+	}
+	job_wait_for_counter(&counter);
+	assert(counter.value == 0, "Failed: Job counter is not zero after wait");
+	for (u64 i = 0; i < 1000; i++) {
+		assert(values[i] == 1, "Failed: Job %llu ran %llu times", i, values[i]);
+	}
+	
+	// More waiting jobs than there are fibers
+	memset(values, 0, sizeof(values));
+	for (u64 i = 0; i < 1000; i++) {
+		job_submit(jobs_test_waiting_job_proc, &values[i], &counter);
+	}
+	job_wait_for_counter(&counter);
+	for (u64 i = 0; i < 1000; i++) {
+		assert(values[i] == 4, "Failed: Waiting job %llu got %llu", i, values[i]);
+	}
+	
+	dealloc(get_heap_allocator(), results);
+}
+
+#define RADIX_TEST_ITEM_COUNT 200000
+typedef struct Radix_Test_Item {
+	s64 value;
+	u64 original_index;
+} Radix_Test_Item;
+void radix_test_check_sorted(Radix_Test_Item *items, u64 count) {
+	for (u64 i = 1; i < count; i++) {
+		assert(items[i].value >= items[i-1].value, "Failed: not correctly sorted at %llu", i);
+		if (items[i].value == items[i-1].value) {
+			assert(items[i].original_index > items[i-1].original_index, "Failed: radix sort is not stable at %llu", i);
+		}
+	}
+}
+void test_radix_sort() {
+	u64 bits = 21;
+	Radix_Test_Item *items = alloc(get_heap_allocator(), RADIX_TEST_ITEM_COUNT*sizeof(Radix_Test_Item)*3);
+	Radix_Test_Item *help = items + RADIX_TEST_ITEM_COUNT;
+	Radix_Test_Item *copy = items + RADIX_TEST_ITEM_COUNT*2;
+	
+	// Signed values with lots of duplicates
+	for (u64 i = 0; i < RADIX_TEST_ITEM_COUNT; i++) {
+		items[i].value = get_random_int_in_range(-(1 << (bits-1)), (1 << (bits-1))-1) / 16;
+		items[i].original_index = i;
+	}
+	memcpy(copy, items, RADIX_TEST_ITEM_COUNT*sizeof(Radix_Test_Item));
+	
+	radix_sort(items, help, RADIX_TEST_ITEM_COUNT, sizeof(Radix_Test_Item), offsetof(Radix_Test_Item, value), bits);
+	radix_test_check_sorted(items, RADIX_TEST_ITEM_COUNT);
+	
+	radix_sort_parallel(copy, help, RADIX_TEST_ITEM_COUNT, sizeof(Radix_Test_Item), offsetof(Radix_Test_Item, value), bits);
+	assert(bytes_match(items, copy, RADIX_TEST_ITEM_COUNT*sizeof(Radix_Test_Item)), "Failed: radix_sort_parallel and radix_sort disagree");
+	
+	// Only the low digit varies, so the other passes are skipped
+	for (u64 i = 0; i < RADIX_TEST_ITEM_COUNT; i++) {
+		items[i].value = get_random_int_in_range(0, 255);
+		items[i].original_index = i;
+	}
+	radix_sort_parallel(items, help, RADIX_TEST_ITEM_COUNT, sizeof(Radix_Test_Item), offsetof(Radix_Test_Item, value), bits);
+	radix_test_check_sorted(items, RADIX_TEST_ITEM_COUNT);
+	
+	// Pairs share the layout, with unsigned keys
+	Radix_Sort_Pair *pairs = (Radix_Sort_Pair*)items;
+	for (u64 i = 0; i < RADIX_TEST_ITEM_COUNT; i++) {
+		pairs[i].key = get_random() & ((1ULL << 40)-1);
+		pairs[i].index = i;
+	}
+	float64 start_seconds = os_get_elapsed_seconds();
+	radix_sort_pairs_parallel(pairs, (Radix_Sort_Pair*)help, RADIX_TEST_ITEM_COUNT, 40);
+	float64 end_seconds = os_get_elapsed_seconds();
+	radix_test_check_sorted(items, RADIX_TEST_ITEM_COUNT);
+	
+	print("\n\tSorted %d 40-bit (key, index) pairs on %llu workers in %.2f ms\n", RADIX_TEST_ITEM_COUNT, job_get_worker_count(), (end_seconds-start_seconds)*1000.0);
+	
+	dealloc(get_heap_allocator(), items);
+}
+
+#define IN_PLACE_SORT_TEST_COUNT 10000
+int compare_u32(const void *a, const void *b) {
+	u32 x = *(u32*)a, y = *(u32*)b;
+	return (x > y) - (x < y);
+}
+void test_in_place_sort() {
+	u32 *numbers = alloc(get_heap_allocator(), IN_PLACE_SORT_TEST_COUNT*sizeof(u32)*2);
+	u32 *copy = numbers + IN_PLACE_SORT_TEST_COUNT;
+	f32 *floats = alloc(get_heap_allocator(), IN_PLACE_SORT_TEST_COUNT*sizeof(f32));
+	
+	// The patterns that trip up naive quicksort
+	for (int pattern = 0; pattern < 6; pattern++) {
+		for (u64 count = 0; count <= IN_PLACE_SORT_TEST_COUNT; count = count*3+1) {
+			for (u64 i = 0; i < count; i++) {
+				switch (pattern) {
+					case 0: numbers[i] = (u32)get_random(); break;
+					case 1: numbers[i] = (u32)i; break;
+					case 2: numbers[i] = (u32)(count-i); break;
+					case 3: numbers[i] = 7; break;
+					case 4: numbers[i] = (u32)(i % 16); break;
+					case 5: numbers[i] = (u32)(i < count/2 ? i : count-i); break; // Organ pipe
+				}
+				floats[i] = (f32)numbers[i] - 1000.0f;
+			}
+			memcpy(copy, numbers, count*sizeof(u32));
+			
+			sort_u32(numbers, count);
+			sort(copy, count, sizeof(u32), compare_u32);
+			sort_f32(floats, count);
+			
+			for (u64 i = 1; i < count; i++) {
+				assert(numbers[i-1] <= numbers[i], "Failed: sort_u32 pattern %d, count %llu, index %llu", pattern, count, i);
+				assert(floats[i-1] <= floats[i], "Failed: sort_f32 pattern %d, count %llu, index %llu", pattern, count, i);
+			}
+			assert(bytes_match(numbers, copy, count*sizeof(u32)), "Failed: sort and sort_u32 disagree on pattern %d, count %llu", pattern, count);
+		}
+	}
+	
+	dealloc(get_heap_allocator(), numbers);
+	dealloc(get_heap_allocator(), floats);
+}
+
 #ifndef OOGABOOGA_HEADLESS
+typedef struct Draw_Test_State {
+	Matrix4 projection;
+	Matrix4 camera_xform;
+	u64 quad_count;
+	u64 image_count;
+	u64 uv_count;
+	u64 scissor_count;
+	u64 userdata_count;
+} Draw_Test_State;
+
+// Remembers the draw frame and sets up an 800x600 orthographic projection with no camera.
+// draw_test_end() throws away everything drawn since and restores the frame, so the tests
+// don't leave quads for the first real frame.
+Draw_Test_State draw_test_begin() {
+	Draw_Test_State state;
+	state.projection = draw_frame.projection;
+	state.camera_xform = draw_frame.camera_xform;
+	
+	if (!draw_frame.quad_buffer) draw_rect(v2(0, 0), v2(1, 1), COLOR_WHITE);
+	draw_frame_flush_pending_quad();
+	state.quad_count     = growing_array_get_valid_count(draw_frame.quad_buffer);
+	state.image_count    = growing_array_get_valid_count(draw_frame.images);
+	state.uv_count       = growing_array_get_valid_count(draw_frame.uvs);
+	state.scissor_count  = growing_array_get_valid_count(draw_frame.scissors);
+	state.userdata_count = growing_array_get_valid_count(draw_frame.userdata);
+	
+	draw_frame.projection = m4_make_orthographic_projection(-400, 400, -300, 300, -1, 10);
+	draw_frame.camera_xform = m4_scalar(1.0);
+	return state;
+}
+void draw_test_end(Draw_Test_State state) {
+	draw_frame_flush_pending_quad();
+	growing_array_resize((void**)&draw_frame.quad_buffer, state.quad_count);
+	
+	// The side tables can point to the tests' stack images, so they go too. The lookups
+	// might refer to the removed entries, and they only speed up deduplication anyway.
+	growing_array_resize((void**)&draw_frame.images,   state.image_count);
+	growing_array_resize((void**)&draw_frame.uvs,      state.uv_count);
+	growing_array_resize((void**)&draw_frame.scissors, state.scissor_count);
+	growing_array_resize((void**)&draw_frame.userdata, state.userdata_count);
+	memset(draw_frame.image_lookup, 0, sizeof(draw_frame.image_lookup));
+	memset(draw_frame.uv_lookup, 0, sizeof(draw_frame.uv_lookup));
+	
+	draw_frame.projection = state.projection;
+	draw_frame.camera_xform = state.camera_xform;
+}
+
+void test_draw_transforms() {
+	Draw_Test_State state = draw_test_begin();
+	draw_frame.camera_xform = m4_translate(m4_make_scale(v3(2, 2, 1)), v3(30, -20, 0));
+	
+	for (int pass = 0; pass < 2; pass++) {
+		// Second pass moves the camera by assigning, which must invalidate the cached matrix
+		if (pass == 1) draw_frame.camera_xform = m4_rotate_z(draw_frame.camera_xform, 0.5);
+		
+		Matrix4 expected_world_to_clip = m4_mul(draw_frame.projection, m4_inverse(draw_frame.camera_xform));
+		Matrix4 xform = m4_rotate_z(m4_make_translation(v3(10, 5, 0)), 0.25);
+		Matrix4 expected_xform_to_clip = m4_mul(expected_world_to_clip, xform);
+		
+		Draw_Quad *q = draw_rect(v2(10, 20), v2(50, 40), COLOR_WHITE);
+		Vector2 expected = m4_transform(expected_world_to_clip, v4(60, 60, 0, 1)).xy;
+		assert(fabsf(q->top_right.x-expected.x) < 0.0001 && fabsf(q->top_right.y-expected.y) < 0.0001, "draw_rect corner %v2 should be %v2", q->top_right, expected);
+		
+		q = draw_rect_xform(xform, v2(50, 40), COLOR_WHITE);
+		expected = m4_transform(expected_xform_to_clip, v4(50, 40, 0, 1)).xy;
+		assert(fabsf(q->top_right.x-expected.x) < 0.0001 && fabsf(q->top_right.y-expected.y) < 0.0001, "draw_rect_xform corner %v2 should be %v2", q->top_right, expected);
+		
+		Vector4 world = m4_transform(get_clip_to_world(), v4(q->top_right.x, q->top_right.y, 0, 1));
+		Vector4 local = m4_transform(xform, v4(50, 40, 0, 1));
+		assert(fabsf(world.x-local.x) < 0.01 && fabsf(world.y-local.y) < 0.01, "get_clip_to_world gave %v4, expected %v4", world, local);
+	}
+	
+	draw_test_end(state);
+}
+
+void test_draw_batches() {
+	Draw_Test_State state = draw_test_begin();
+	draw_frame.camera_xform = m4_rotate_z(m4_make_translation(v3(30, -20, 0)), 0.3);
+	
+	// Odd count so both the 4-wide loop and the tail get used, some are off screen
+	const u64 count = 103;
+	Vector2 positions[103];
+	Vector2 sizes[103];
+	Vector4 colors[103];
+	Matrix4 xforms[103];
+	Draw_Quad quads[103];
+	for (u64 i = 0; i < count; i++) {
+		positions[i] = v2(get_random_float32_in_range(-700, 700), get_random_float32_in_range(-500, 500));
+		sizes[i] = v2(get_random_float32_in_range(1, 50), get_random_float32_in_range(1, 50));
+		colors[i] = v4(1, (float32)i/(float32)count, 0, 1);
+		xforms[i] = m4_rotate_z(m4_make_translation(v3(positions[i].x, positions[i].y, 0)), (float32)i);
+		quads[i] = ZERO(Draw_Quad);
+		quads[i].bottom_left  = v2(0, 0);
+		quads[i].top_left     = v2(0, sizes[i].y);
+		quads[i].top_right    = sizes[i];
+		quads[i].bottom_right = v2(sizes[i].x, 0);
+		quads[i].color = colors[i];
+	}
+	
+	push_z_layer(5);
+	for (int pass = 0; pass < 2; pass++) {
+		u64 start = growing_array_get_valid_count(draw_frame.quad_buffer);
+		for (u64 i = 0; i < count; i++) {
+			if (pass == 0) draw_circle(positions[i], sizes[i], colors[i]);
+			else           draw_quad_xform(quads[i], xforms[i]);
+		}
+		draw_frame_flush_pending_quad();
+		u64 expected_count = growing_array_get_valid_count(draw_frame.quad_buffer) - start;
+		
+		u64 batch_count = pass == 0 ? draw_circles_batch(positions, sizes, colors, count) : draw_quads_batch(quads, xforms, count);
+		assert(batch_count == expected_count, "Batch added %llu quads, expected %llu", batch_count, expected_count);
+		
+		for (u64 i = 0; i < batch_count; i++) {
+			Draw_Quad_Packed *a = &draw_frame.quad_buffer[start+i];
+			Draw_Quad_Packed *b = &draw_frame.quad_buffer[start+expected_count+i];
+			assert(a->color == b->color && a->type == b->type && b->z == 5, "Batched quad %llu differs from the single draw", i);
+			assert(v2_dist(a->top_right, b->top_right) < 0.0001 && v2_dist(a->bottom_left, b->bottom_left) < 0.0001, "Batched corners %v2 %v2, expected %v2 %v2", b->bottom_left, b->top_right, a->bottom_left, a->top_right);
+		}
+	}
+	pop_z_layer();
+	
+	draw_test_end(state);
+}
+
+void test_draw_quad_packing() {
+	Draw_Test_State state = draw_test_begin();
+	u64 quad_count_before = state.quad_count;
+	
+	// Only the pointer is used for packing so these don't need to be real images
+	Gfx_Image images[2] = {0};
+	Vector4 uv = v4(0.25, 0.5, 0.75, 1.0);
+	
+	push_window_scissor(v2(10, 20), v2(300, 200));
+	for (u64 i = 0; i < 100; i++) {
+		Draw_Quad *q = draw_image(&images[i%2], v2((float32)i, 0), v2(10, 10), v4(0.5, 0.25, 1.0, 0.75));
+		q->uv = uv;
+		q->image_mag_filter = GFX_FILTER_MODE_LINEAR;
+		if (i == 50) q->userdata[0] = v4(1, 2, 3, 4);
+	}
+	pop_window_scissor();
+	draw_rect(v2(0, 0), v2(10, 10), COLOR_RED);
+	draw_frame_flush_pending_quad();
+	
+	assert(growing_array_get_valid_count(draw_frame.quad_buffer) == quad_count_before+101, "Expected 101 new quads");
+	assert(growing_array_get_valid_count(draw_frame.images) == state.image_count+2, "Images should be deduplicated");
+	assert(growing_array_get_valid_count(draw_frame.uvs) <= state.uv_count+1, "Uvs should be deduplicated");
+	assert(growing_array_get_valid_count(draw_frame.userdata) == state.userdata_count+1, "Only set userdata should be stored");
+	
+	for (u64 i = 0; i < 100; i++) {
+		Draw_Quad q = unpack_draw_quad(&draw_frame.quad_buffer[quad_count_before+i]);
+		assert(q.image == &images[i%2], "Wrong image unpacked");
+		assert(memcmp(&q.uv, &uv, sizeof(uv)) == 0, "Wrong uv unpacked %v4", q.uv);
+		assert(q.image_min_filter == GFX_FILTER_MODE_NEAREST && q.image_mag_filter == GFX_FILTER_MODE_LINEAR, "Wrong filters unpacked");
+		assert(q.has_scissor && q.scissor.x1 == 10 && q.scissor.y2 == 200, "Wrong scissor unpacked %v4", q.scissor);
+		assert(fabsf(q.color.g-0.25) < 1.0/255.0 && fabsf(q.color.a-0.75) < 1.0/255.0, "Color %v4 was not packed to 8 bits properly", q.color);
+		assert(q.userdata[0].w == (i == 50 ? 4 : 0), "Userdata of quad %llu was not kept", i);
+	}
+	Draw_Quad last = unpack_draw_quad(&draw_frame.quad_buffer[quad_count_before+100]);
+	assert(!last.image && !last.has_scissor && last.color.r == 1.0 && last.color.g == 0.0, "Wrong plain quad unpacked");
+	
+	draw_test_end(state);
+}
+
+void set_test_quad_rect(Draw_Quad_Packed *q, float32 x, float32 y, float32 size) {
+	q->bottom_left  = v2(x, y);
+	q->top_left     = v2(x, y+size);
+	q->top_right    = v2(x+size, y+size);
+	q->bottom_right = v2(x+size, y);
+}
+
+void test_draw_batch_sorting() {
+	const u64 count = 3000;
+	Draw_Quad_Packed *quads = alloc(get_heap_allocator(), count*2*sizeof(Draw_Quad_Packed));
+	Draw_Quad_Packed *sorted = quads + count;
+	
+	// 40 textures interleaved on 3 layers, which would need a flush for every 32 textures.
+	// Nothing overlaps, so the quads are free to move.
+	for (u64 i = 0; i < count; i++) {
+		quads[i] = ZERO(Draw_Quad_Packed);
+		set_test_quad_rect(&quads[i], (float32)(i % 60)/30.0f - 1.0f, (float32)(i / 60)/25.0f - 1.0f, 1.0f/60.0f);
+		quads[i].z = (s32)(i % 3) - 1;
+		quads[i].texture = (u16)(i % 40) + 1;
+		quads[i].type = (u8)(i % 2);
+		quads[i].color = (u32)i; // Submission order, to check stability
+	}
+	
+	sort_draw_quads_for_batching(quads, sorted, count);
+	
+	u64 texture_switches = 0;
+	for (u64 i = 1; i < count; i++) {
+		Draw_Quad_Packed *a = &sorted[i-1];
+		Draw_Quad_Packed *b = &sorted[i];
+		assert(a->z <= b->z, "Batch sorting must keep z order (%d before %d)", a->z, b->z);
+		
+		if (a->z == b->z) {
+			u32 key_a = get_draw_quad_batch_key(a);
+			u32 key_b = get_draw_quad_batch_key(b);
+			assert(key_a <= key_b, "Quads that don't overlap should be sorted by batch key");
+			if (key_a == key_b) assert(a->color < b->color, "Quads with the same key must keep submission order");
+		}
+		
+		if (a->texture != b->texture) texture_switches += 1;
+	}
+	// One run per texture per layer
+	assert(texture_switches == 3*40-1, "Expected %d texture switches, got %llu", 3*40-1, texture_switches);
+	
+	// Quads that overlap must be drawn in submission order whatever their texture, or
+	// blending would look different
+	const u64 overlap_count = 600;
+	u64 submitted_texture_switches = 0;
+	for (u64 i = 0; i < overlap_count; i++) {
+		quads[i] = ZERO(Draw_Quad_Packed);
+		float32 size = i % 50 == 0 ? 0.5f : 0.05f;
+		set_test_quad_rect(&quads[i], (float32)((i*7919) % 97)/50.0f - 1.0f, (float32)((i*104729) % 89)/46.0f - 1.0f, size);
+		quads[i].z = (s32)(i % 2);
+		quads[i].texture = (u16)(i % 5) + 1;
+		quads[i].color = (u32)i;
+		if (i >= 2 && quads[i].texture != quads[i-2].texture) submitted_texture_switches += 1;
+	}
+	
+	sort_draw_quads_for_batching(quads, sorted, overlap_count);
+	
+	texture_switches = 0;
+	for (u64 i = 0; i < overlap_count; i++) {
+		Draw_Quad_Packed *a = &sorted[i];
+		if (i > 0 && a->z == sorted[i-1].z && a->texture != sorted[i-1].texture) texture_switches += 1;
+		float32 a_min_x = a->bottom_left.x, a_max_x = a->top_right.x, a_min_y = a->bottom_left.y, a_max_y = a->top_right.y;
+		for (u64 j = i+1; j < overlap_count; j++) {
+			Draw_Quad_Packed *b = &sorted[j];
+			if (a->z != b->z) continue;
+			bool overlap = a_min_x < b->top_right.x && b->bottom_left.x < a_max_x && a_min_y < b->top_right.y && b->bottom_left.y < a_max_y;
+			if (overlap) assert(a->color < b->color, "Overlapping quads %u and %u were drawn out of order", a->color, b->color);
+		}
+	}
+	assert(texture_switches < submitted_texture_switches, "Quads that don't overlap should still be batched (%llu texture switches, %llu in submission order)", texture_switches, submitted_texture_switches);
+	
+	dealloc(get_heap_allocator(), quads);
+}
+
+void test_static_batch() {
+	Draw_Test_State state = draw_test_begin();
+	u64 quad_count_before = state.quad_count;
+	
+	Gfx_Image image = {0};
+	Vector4 uv = v4(0, 0, 0.5, 0.5);
+	
+	// Half of it is off screen while recording, which must not be culled
+	const u64 count = 64;
+	Static_Batch batch = {0};
+	assert(static_batch_needs_recording(&batch), "A new batch needs to be recorded");
+	static_batch_begin(&batch);
+	push_z_layer(3);
+	for (u64 i = 0; i < count; i++) {
+		Vector2 pos = v2((float32)i*20.0 - 100.0, 0);
+		if (i % 2 == 0) draw_rect(pos, v2(10, 10), v4(1, (float32)i/(float32)count, 0, 1));
+		else draw_image(&image, pos, v2(10, 10), COLOR_WHITE)->uv = uv;
+	}
+	pop_z_layer();
+	static_batch_end(&batch);
+	
+	assert(growing_array_get_valid_count(draw_frame.quad_buffer) == quad_count_before, "Recording a static batch must not draw to the frame");
+	assert(growing_array_get_valid_count(batch.quads) == count, "Expected %llu quads in the batch, got %llu", count, growing_array_get_valid_count(batch.quads));
+	assert(!static_batch_needs_recording(&batch), "Batch should not need recording after static_batch_end()");
+	
+	// Submit from two camera positions and compare against drawing the same thing directly
+	for (int pass = 0; pass < 2; pass++) {
+		draw_frame.camera_xform = m4_make_translation(v3(pass == 0 ? 0 : 600, 0, 0));
+		
+		u64 start = growing_array_get_valid_count(draw_frame.quad_buffer);
+		push_z_layer(3);
+		for (u64 i = 0; i < count; i++) {
+			Vector2 pos = v2((float32)i*20.0 - 100.0, 0);
+			if (i % 2 == 0) draw_rect(pos, v2(10, 10), v4(1, (float32)i/(float32)count, 0, 1));
+			else draw_image(&image, pos, v2(10, 10), COLOR_WHITE)->uv = uv;
+		}
+		pop_z_layer();
+		draw_frame_flush_pending_quad();
+		u64 expected_count = growing_array_get_valid_count(draw_frame.quad_buffer) - start;
+		
+		u64 batch_count = draw_static_batch(&batch, m4_scalar(1.0));
+		assert(batch_count == expected_count, "Static batch drew %llu quads, expected %llu", batch_count, expected_count);
+		
+		for (u64 i = 0; i < batch_count; i++) {
+			Draw_Quad a = unpack_draw_quad(&draw_frame.quad_buffer[start+i]);
+			Draw_Quad b = unpack_draw_quad(&draw_frame.quad_buffer[start+expected_count+i]);
+			assert(a.image == b.image && a.z == b.z && memcmp(&a.uv, &b.uv, sizeof(Vector4)) == 0, "Static batch quad %llu differs from the direct draw", i);
+			assert(memcmp(&a.color, &b.color, sizeof(Vector4)) == 0, "Static batch color %v4, expected %v4", b.color, a.color);
+			assert(v2_dist(a.top_right, b.top_right) < 0.0001 && v2_dist(a.bottom_left, b.bottom_left) < 0.0001, "Static batch corners %v2 %v2, expected %v2 %v2", b.bottom_left, b.top_right, a.bottom_left, a.top_right);
+		}
+	}
+	
+	static_batch_mark_dirty(&batch);
+	assert(static_batch_needs_recording(&batch), "Batch should need recording after static_batch_mark_dirty()");
+	static_batch_destroy(&batch);
+	
+	draw_test_end(state);
+}
+
+void test_quad_vertex_generation() {
+	Draw_Test_State state = draw_test_begin();
+	u64 quad_count_before = state.quad_count;
+	
+	// 40 textures is more than fits in one draw call. The handles are never used by a
+	// renderer here so they just need to be different.
+	Gfx_Image images[40] = {0};
+	for (u64 i = 0; i < 40; i++) {
+		images[i].width = 64;
+		images[i].height = 64;
+		images[i].gfx_handle = (Gfx_Handle)(u64)(i+1);
+	}
+	
+	// Enough quads for several parallel_for batches
+	const u64 count = DRAW_VERTEX_GENERATION_BATCH_SIZE*2 + 123;
+	push_window_scissor(v2(10, 20), v2(300, 200));
+	for (u64 i = 0; i < count; i++) {
+		Vector2 pos = v2((float32)(i % 700) - 350.3, (float32)(i % 500) - 250.7);
+		if (i % 3 == 0) draw_rect(pos, v2(5, 5), v4(1, 0, 0, 1));
+		else draw_image(&images[(i/3) % 40], pos, v2(5, 5), COLOR_WHITE)->uv = v4(0, 0, 0.5, 0.5);
+		if (i == 1000) pop_window_scissor();
+	}
+	draw_frame_flush_pending_quad();
+	
+	Draw_Quad_Packed *quads = &draw_frame.quad_buffer[quad_count_before];
+	Vertex_2D *vertices = alloc(get_heap_allocator(), count*6*sizeof(Vertex_2D));
+	Vertex_2D_Batch *batches = 0;
+	
+	u64 batch_count = generate_quad_vertices(quads, count, vertices, &batches);
+	assert(batch_count > 1, "40 textures should not fit in one batch");
+	
+	u64 next_quad = 0;
+	for (u64 b = 0; b < batch_count; b++) {
+		Vertex_2D_Batch *batch = &batches[b];
+		assert(batch->first_quad == next_quad, "Batches must cover all quads in order");
+		assert(batch->texture_count <= VERTEX_2D_MAX_TEXTURES, "Too many textures in batch %llu", b);
+		next_quad += batch->quad_count;
+		
+		for (u64 i = batch->first_quad; i < batch->first_quad+batch->quad_count; i++) {
+			Draw_Quad q = unpack_draw_quad(&quads[i]);
+			Vertex_2D *v = &vertices[i*6];
+			
+			if (q.image) {
+				assert(v->texture_index >= 0 && (u64)v->texture_index < batch->texture_count, "Bad texture index %d", v->texture_index);
+				assert(batch->textures[v->texture_index] == q.image->gfx_handle, "Quad %llu samples the wrong texture", i);
+			} else {
+				assert(v->texture_index == -1, "Untextured quad %llu got texture index %d", i, v->texture_index);
+			}
+			
+			float32 pixel_width = 2.0/(float)window.width;
+			float32 expected_x = round(q.bottom_left.x/pixel_width)*pixel_width;
+			assert(v[0].position.x == expected_x, "Vertex x %f was not snapped to %f", v[0].position.x, expected_x);
+			assert(v[2].self_uv.x == 1 && v[2].self_uv.y == 1 && v[5].self_uv.x == 1 && v[5].self_uv.y == 0, "Wrong self uvs");
+			assert(memcmp(&v[3], &v[0], sizeof(Vertex_2D)) == 0 && memcmp(&v[4], &v[2], sizeof(Vertex_2D)) == 0, "Shared triangle corners differ");
+			assert(v->has_scissor == (i <= 1000), "Quad %llu has_scissor is %d", i, v->has_scissor);
+			assert(v->color.r == q.color.r && v->type == q.type, "Quad %llu attributes were not copied", i);
+		}
+	}
+	assert(next_quad == count, "Batches cover %llu quads, expected %llu", next_quad, count);
+	
+	growing_array_deinit((void**)&batches);
+	dealloc(get_heap_allocator(), vertices);
+	
+	draw_test_end(state);
+}
+
 int compare_draw_quads(const void *a, const void *b) {
     return ((Draw_Quad*)a)->z-((Draw_Quad*)b)->z;
 }
@@ -1354,6 +2529,34 @@ void test_sort() {
     }
     
     print("Merge sort took on average %llu cycles and %.2f ms\n", cycles / num_samples, (seconds * 1000.0) / (float64)num_samples);
+    
+	for (int variant = 0; variant < 2; variant++) {
+		seconds = 0;
+		cycles = 0;
+		for (int a = 0; a < num_samples; a++) {
+			
+			for (u64 i = 0; i < item_count; i++) {
+				if (i % 2 == 0) items[i].z = get_random_int_in_range(0, pow(2, id_bits) / 2);
+				else items[i].z = i;
+			}
+		
+			float64 start_seconds = os_get_elapsed_seconds();
+			u64 start_cycles = rdtsc();
+			if (variant == 0) sort(items, item_count, sizeof(Draw_Quad), compare_draw_quads);
+			else              sort_by_key_offset(items, item_count, sizeof(Draw_Quad), offsetof(Draw_Quad, z));
+			u64 end_cycles = rdtsc();
+			float64 end_seconds = os_get_elapsed_seconds();
+		
+			for (u64 i = 1; i < item_count; i++) {
+				assert(items[i].z >= items[i-1].z, "Failed: not correctly sorted");
+			}
+			
+			seconds += end_seconds - start_seconds;
+			cycles += end_cycles - start_cycles;
+		}
+		
+		print("%s took on average %llu cycles and %.2f ms\n", variant == 0 ? "sort" : "sort_by_key_offset", cycles / num_samples, (seconds * 1000.0) / (float64)num_samples);
+	}
 }
 #endif /* OOGABOOGA_HEADLESS */
 
@@ -1423,6 +2626,124 @@ void test_growing_array() {
     assert(growing_array_get_valid_count(things) == 99, "Failed: growing_array_get_valid_count");
 }
 
+///
+// Performance regression tests (RUN_PERF_TESTS)
+//
+// A fixed set of the benchmarks in benchmarks.c, with a tolerance each.
+// Times are divided by the time of a fixed calibration loop, so the baseline is in
+// "calibration units" and roughly holds across machines. It's still best to keep one
+// baseline per machine/configuration you run these on.
+// Like bench_report, a test only fails if it's slower by more than its tolerance and by
+// more than BENCH_NOISE_MADS MADs.
+// The first run (or any run with PERF_TESTS_UPDATE_BASELINE 1) writes the baseline to
+// PERF_TESTS_BASELINE_PATH, which is meant to be checked in.
+
+#if RUN_PERF_TESTS
+
+#ifndef PERF_TESTS_BASELINE_PATH
+	#define PERF_TESTS_BASELINE_PATH "oogabooga/perf_baseline.json"
+#endif
+#ifndef PERF_TESTS_UPDATE_BASELINE
+	#define PERF_TESTS_UPDATE_BASELINE 0
+#endif
+
+typedef struct Perf_Test {
+	string name;
+	Bench_Proc proc;
+	float64 tolerance; // How much slower than the baseline is ok, 0.2 is 20%
+} Perf_Test;
+
+// Dependent integer & float math, no memory, so it scales with the core and not the caches
+void perf_test_calibration(Bench *b) {
+	u64 x = 88172645463325252ULL;
+	float64 f = 1.0;
+	for (u64 i = 0; i < b->iterations; i++) {
+		for (u64 j = 0; j < 64; j++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			f = f*1.0000001 + (float64)(x & 0xff)*0.000001;
+		}
+	}
+	bench_keep(x);
+	bench_keep(f);
+}
+
+void oogabooga_run_perf_tests() {
+	Perf_Test tests[] = {
+		{ STR("heap_alloc_dealloc_mixed_sizes"), bench_heap_alloc_dealloc_mixed_sizes, 0.20 },
+		{ STR("temp_alloc_64"),                  bench_temp_alloc_64,                  0.25 },
+		{ STR("radix_sort_10000"),               bench_radix_sort_10000,               0.15 },
+		{ STR("sort_by_key_offset_10000"),       bench_sort_by_key_offset_10000,       0.15 },
+		{ STR("hash_table_find_u64"),            bench_hash_table_find_u64,            0.20 },
+		{ STR("tprint_ints_and_strings"),        bench_tprint_ints_and_strings,        0.25 },
+	};
+	const u64 test_count = sizeof(tests)/sizeof(tests[0]);
+
+	Bench_Result calibration = bench_run(STR("calibration"), perf_test_calibration);
+	print("Perf calibration loop: %.2f ns\n", calibration.median_ns);
+
+	Bench_Result *baseline = 0;
+	u64 baseline_count = 0;
+	bool has_baseline = !PERF_TESTS_UPDATE_BASELINE && bench_read_json(STR(PERF_TESTS_BASELINE_PATH), &baseline, get_heap_allocator());
+	if (has_baseline) baseline_count = growing_array_get_valid_count(baseline);
+
+	Bench_Result results[sizeof(tests)/sizeof(tests[0])];
+	u64 failed_count = 0;
+	for (u64 i = 0; i < test_count; i++) {
+		// A benchmark that wraps around temporary storage measures talloc's slow path, so
+		// its numbers mean nothing to compare against. reset_temporary_storage() records
+		// the whole storage as used in the high water when that happens.
+		reset_temporary_storage();
+		u64 high_water_before = temporary_storage_high_water;
+		temporary_storage_high_water = 0;
+		Bench_Result r = bench_run(tests[i].name, tests[i].proc);
+		reset_temporary_storage();
+		bool overflowed = temporary_storage_high_water >= temporary_storage_size;
+		temporary_storage_high_water = max(high_water_before, temporary_storage_high_water);
+		if (overflowed) {
+			print("  %s: overflowed temporary storage, FAILED\n", r.name);
+			failed_count += 1;
+			results[i] = ZERO(Bench_Result);
+			results[i].name = r.name;
+			continue;
+		}
+
+		// Everything in the baseline is in calibration units
+		r.median_ns /= calibration.median_ns;
+		r.mad_ns    /= calibration.median_ns;
+		r.p99_ns    /= calibration.median_ns;
+		r.min_ns    /= calibration.median_ns;
+		results[i] = r;
+
+		Bench_Result *base = has_baseline ? bench_find_result(baseline, baseline_count, r.name) : 0;
+		if (!base || base->median_ns <= 0) {
+			print("  %s: %.4f (no baseline)\n", r.name, r.median_ns);
+			continue;
+		}
+
+		float64 delta = (r.median_ns - base->median_ns)/base->median_ns;
+		bool failed = bench_is_regression(r, base, tests[i].tolerance);
+		if (failed) failed_count += 1;
+
+		print("  %s: %.4f +-%.4f, baseline %.4f +-%.4f, %+.1f%% (tolerance %.0f%%) %cs\n",
+			r.name, r.median_ns, r.mad_ns, base->median_ns, base->mad_ns, delta*100.0, tests[i].tolerance*100.0, failed ? "FAILED" : "ok");
+	}
+
+	if (!has_baseline) {
+		if (bench_write_json(results, test_count, STR(PERF_TESTS_BASELINE_PATH))) {
+			print("Wrote new perf baseline to %cs, check it in to compare against it.\n", PERF_TESTS_BASELINE_PATH);
+		} else {
+			log_error("Could not write perf baseline to %cs", PERF_TESTS_BASELINE_PATH);
+		}
+	}
+	if (baseline) growing_array_deinit((void**)&baseline);
+
+	assert(failed_count == 0, "%llu perf test(s) failed, see above", failed_count);
+}
+
+#endif // RUN_PERF_TESTS
+
 void oogabooga_run_tests() {
 	
 	print("Testing growing array... ");
@@ -1441,6 +2762,10 @@ void oogabooga_run_tests() {
 	test_strings();
 	print("OK!\n");
 	
+	print("Testing utf8... ");
+	test_utf8();
+	print("OK!\n");
+	
 	print("Testing file IO... ");
 	test_file_io();
 	print("OK!\n");
@@ -1465,12 +2790,78 @@ void oogabooga_run_tests() {
 	test_random_distribution();
 	print("OK!\n");
 	
+	print("Testing spinlocks... ");
+	test_spinlocks();
+	print("OK!\n");
+	
 	print("Testing mutex... ");
 	test_mutex();
 	print("OK!\n");
+	
+	print("Testing semaphore... ");
+	test_semaphore();
+	print("OK!\n");
+	
+	print("Testing reader-writer locks... ");
+	test_rw_locks();
+	print("OK!\n");
+	
+	print("Testing lock-free queues... ");
+	test_queues();
+	print("OK!\n");
+	
+	print("Testing logger... ");
+	test_logger();
+	print("OK!\n");
+	
+	print("Testing jobs... ");
+	test_jobs();
+	print("OK!\n");
+	
+#if ENABLE_PROFILING
+	print("Testing profiler capture... ");
+	test_profiler_capture();
+	print("OK!\n");
+	
+	print("Testing profiler events... ");
+	test_profiler_events();
+	print("OK!\n");
+#endif
+	
+	print("Testing parallel radix sort... ");
+	test_radix_sort();
+	print("OK!\n");
+	
+	print("Testing in-place sort... ");
+	test_in_place_sort();
+	print("OK!\n");
 
 #ifndef OOGABOOGA_HEADLESS
-	print("Testing radix sort... ");
+	print("Testing draw transforms... ");
+	test_draw_transforms();
+	print("OK!\n");
+	
+	print("Testing draw batches... ");
+	test_draw_batches();
+	print("OK!\n");
+	
+	print("Testing draw quad packing... ");
+	test_draw_quad_packing();
+	print("OK!\n");
+	
+	print("Testing draw batch sorting... ");
+	test_draw_batch_sorting();
+	print("OK!\n");
+	
+	print("Testing static batches... ");
+	test_static_batch();
+	print("OK!\n");
+	
+	print("Testing quad vertex generation... ");
+	test_quad_vertex_generation();
+	print("OK!\n");
+	
+	print("Testing sort performance... ");
 	test_sort();
 	print("OK!\n");
 #endif
@@ -65,6 +65,12 @@ const u8 trailing_bytes_for_utf8[] = {
 const u8 utf8_inital_byte_mask[] = { 0x7F, 0x1F, 0x0F, 0x07, 0x03, 0x01 };
 
 Utf8_To_Utf32_Result utf8_to_utf32(u8 *s, s64 source_length, bool strict) {
+    // A stray continuation byte or a lead byte no valid sequence starts with.
+    // The table would give these 0 trailing bytes and we'd decode them as ascii.
+    if ((s[0] & 0xC0) == 0x80 || s[0] >= 0xF8) {
+        return (Utf8_To_Utf32_Result){UNI_REPLACEMENT_CHAR, 1, true, true};
+    }
+
     s64 continuation_bytes = trailing_bytes_for_utf8[s[0]];
 
     if (continuation_bytes + 1 > source_length) {
@@ -82,9 +88,9 @@ Utf8_To_Utf32_Result utf8_to_utf32(u8 *s, s64 source_length, bool strict) {
     if (strict) {
         if (ch > UNI_MAX_UTF16 ||
           (SURROGATES_START <= ch && ch <= SURROGATES_END) ||
-          (ch <= 0x0000007F && continuation_bytes != 0) ||
-          (ch <= 0x000007FF && continuation_bytes != 1) ||
-          (ch <= 0x0000FFFF && continuation_bytes != 2) ||
+          (continuation_bytes == 1 && ch <= 0x0000007F) ||
+          (continuation_bytes == 2 && ch <= 0x000007FF) ||
+          (continuation_bytes == 3 && ch <= 0x0000FFFF) ||
           continuation_bytes > 3) {
             return (Utf8_To_Utf32_Result){UNI_REPLACEMENT_CHAR, continuation_bytes+1, true, true};
         }
@@ -97,8 +103,47 @@ Utf8_To_Utf32_Result utf8_to_utf32(u8 *s, s64 source_length, bool strict) {
 	return (Utf8_To_Utf32_Result){ ch, continuation_bytes+1, false, false };
 }
 
+// Returns how many bytes from the start of p are ascii, i.e. exactly one codepoint each.
+// If stop_at_zero, a zero byte also ends the run (we treat codepoint 0 as end of text when walking).
+// Does 32 (AVX2) or 16 (SSE2) bytes per step.
+inline u64 utf8_ascii_run_length(u8 *p, u64 count, bool stop_at_zero) {
+	u64 n = 0;
+	
+#if ENABLE_SIMD && SIMD_ENABLE_AVX2
+	while (n + 32 <= count) {
+		__m256i v = _mm256_loadu_si256((__m256i*)(p+n));
+		u32 mask = (u32)_mm256_movemask_epi8(v);
+		if (stop_at_zero) mask |= (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+		if (mask) return n + count_trailing_zeros_32(mask);
+		n += 32;
+	}
+#endif
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	while (n + 16 <= count) {
+		__m128i v = _mm_loadu_si128((__m128i*)(p+n));
+		u32 mask = (u32)_mm_movemask_epi8(v);
+		if (stop_at_zero) mask |= (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+		if (mask) return n + count_trailing_zeros_32(mask);
+		n += 16;
+	}
+#endif
+	
+	while (n < count && p[n] < 0x80 && !(stop_at_zero && p[n] == 0)) n += 1;
+	
+	return n;
+}
+
 // Returns 0 on fail
 u32 next_utf8(string *s) {
+	
+	// Ascii fast path, which is the vast majority of text we walk every frame
+	if (s->count > 0 && s->data[0] < 0x80) {
+		u32 c = s->data[0];
+		s->data  += 1;
+		s->count -= 1;
+		return c;
+	}
+	
 	Utf8_To_Utf32_Result result = utf8_to_utf32(s->data, s->count, false);
 
     s->data  += result.continuation_bytes;
@@ -110,10 +155,93 @@ u32 next_utf8(string *s) {
     return result.utf32;
 }
 
+// Strict validation. Ascii runs are skipped with simd, everything else is checked per codepoint.
+bool utf8_validate(string s) {
+	u64 i = 0;
+	while (i < s.count) {
+		i += utf8_ascii_run_length(s.data+i, s.count-i, false);
+		if (i >= s.count) break;
+		
+		Utf8_To_Utf32_Result result = utf8_to_utf32(s.data+i, s.count-i, true);
+		if (result.error) return false;
+		i += result.continuation_bytes;
+	}
+	return true;
+}
+
+// Decodes up to utf32_capacity codepoints in one go.
+// Ascii runs are widened to utf32 16 (SSE2) or 32 (AVX2) bytes per step.
+// Invalid sequences are decoded as UNI_REPLACEMENT_CHAR.
+// Returns number of codepoints written. bytes_consumed is optional.
+u64 utf8_to_utf32_bulk(string utf8, u32 *utf32, u64 utf32_capacity, u64 *bytes_consumed) {
+	u8 *p = utf8.data;
+	u8 *end = utf8.data + utf8.count;
+	u64 written = 0;
+	
+	while (p < end && written < utf32_capacity) {
+		
+#if ENABLE_SIMD && SIMD_ENABLE_AVX2
+		while (end-p >= 32 && utf32_capacity-written >= 32) {
+			__m256i v = _mm256_loadu_si256((__m256i*)p);
+			if (_mm256_movemask_epi8(v) != 0) break;
+			
+			_mm256_storeu_si256((__m256i*)(utf32+written+0),  _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(p+0))));
+			_mm256_storeu_si256((__m256i*)(utf32+written+8),  _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(p+8))));
+			_mm256_storeu_si256((__m256i*)(utf32+written+16), _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(p+16))));
+			_mm256_storeu_si256((__m256i*)(utf32+written+24), _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)(p+24))));
+			p += 32;
+			written += 32;
+		}
+#endif
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+		while (end-p >= 16 && utf32_capacity-written >= 16) {
+			__m128i v = _mm_loadu_si128((__m128i*)p);
+			if (_mm_movemask_epi8(v) != 0) break;
+			
+			__m128i zero = _mm_setzero_si128();
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			_mm_storeu_si128((__m128i*)(utf32+written+0),  _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128((__m128i*)(utf32+written+4),  _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128((__m128i*)(utf32+written+8),  _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128((__m128i*)(utf32+written+12), _mm_unpackhi_epi16(hi, zero));
+			p += 16;
+			written += 16;
+		}
+#endif
+		if (p >= end || written >= utf32_capacity) break;
+		
+		if (*p < 0x80) {
+			utf32[written++] = *p;
+			p += 1;
+			continue;
+		}
+		
+		Utf8_To_Utf32_Result result = utf8_to_utf32(p, end-p, true);
+		utf32[written++] = result.error ? UNI_REPLACEMENT_CHAR : result.utf32;
+		p += max(result.continuation_bytes, 1);
+	}
+	
+	if (bytes_consumed) *bytes_consumed = (u64)(p-utf8.data);
+	
+	return written;
+}
+
 u64 utf8_index_to_byte_index(string str, u64 index) {
 	u64 byte_index = 0;
 	u64 utf8_index = 0;
 	while (utf8_index < index && str.count != 0) {
+	
+		// Every ascii byte is exactly one codepoint so we can skip those in bulk
+		u64 ascii_count = utf8_ascii_run_length(str.data, min(str.count, index-utf8_index), true);
+		if (ascii_count > 0) {
+			str.data   += ascii_count;
+			str.count  -= ascii_count;
+			byte_index += ascii_count;
+			utf8_index += ascii_count;
+			continue;
+		}
+	
 		string last_str = str;
 		u32 codepoint = next_utf8(&str);
 		if (!codepoint) break;
@@ -132,3 +260,96 @@ string utf8_slice(string str, u64 index, u64 count) {
 
 	return string_view(str, byte_index, byte_count);
 }
+
+///
+// Sparse codepoint -> byte index lookup.
+// utf8_index_to_byte_index walks from the start every call which gets O(n^2) when slicing
+// a long string in a loop. This stores the byte offset of every stride'th codepoint so
+// a lookup only walks at most stride codepoints.
+// The string is not copied, so it needs to outlive the index.
+#define UTF8_INDEX_DEFAULT_STRIDE 64
+typedef struct Utf8_Index {
+	string str;
+	u64 stride;
+	u64 *byte_offsets; // byte_offsets[i] is the byte index of codepoint i*stride
+	u64 offset_count;
+	u64 codepoint_count;
+	u64 end_byte_index; // Where walking stopped, either end of string or a 0 codepoint
+	Allocator allocator;
+} Utf8_Index;
+
+void 
+utf8_index_init(Utf8_Index *index, string str, u64 stride, Allocator allocator) {
+	assert(stride > 0, "Utf8_Index stride must be more than 0");
+	
+	*index = ZERO(Utf8_Index);
+	index->str = str;
+	index->stride = stride;
+	index->allocator = allocator;
+	
+	// Every codepoint is at least one byte
+	u64 max_offsets = str.count/stride + 1;
+	index->byte_offsets = (u64*)alloc(allocator, max_offsets*sizeof(u64));
+	
+	u64 byte_index = 0;
+	u64 utf8_index = 0;
+	string rest = str;
+	while (rest.count != 0) {
+	
+		u64 ascii_count = utf8_ascii_run_length(rest.data, rest.count, true);
+		if (ascii_count > 0) {
+			u64 first = ((utf8_index + stride - 1) / stride) * stride;
+			for (u64 i = first; i < utf8_index + ascii_count; i += stride) {
+				index->byte_offsets[index->offset_count] = byte_index + (i - utf8_index);
+				index->offset_count += 1;
+			}
+			rest.data  += ascii_count;
+			rest.count -= ascii_count;
+			byte_index += ascii_count;
+			utf8_index += ascii_count;
+			continue;
+		}
+		
+		if (utf8_index % stride == 0) {
+			index->byte_offsets[index->offset_count] = byte_index;
+			index->offset_count += 1;
+		}
+		
+		string last = rest;
+		if (!next_utf8(&rest)) break;
+		
+		byte_index += rest.data - last.data;
+		utf8_index += 1;
+	}
+	
+	index->codepoint_count = utf8_index;
+	index->end_byte_index = byte_index;
+}
+void
+utf8_index_deinit(Utf8_Index *index) {
+	dealloc(index->allocator, index->byte_offsets);
+	*index = ZERO(Utf8_Index);
+}
+
+// Same result as utf8_index_to_byte_index(index->str, utf8_index)
+u64 
+utf8_index_lookup(Utf8_Index *index, u64 utf8_index) {
+	if (utf8_index >= index->codepoint_count) return index->end_byte_index;
+	
+	u64 block = utf8_index / index->stride;
+	u64 byte_index = index->byte_offsets[block];
+	
+	string rest = index->str;
+	rest.data  += byte_index;
+	rest.count -= byte_index;
+	
+	return byte_index + utf8_index_to_byte_index(rest, utf8_index - block*index->stride);
+}
+
+string 
+utf8_index_slice(Utf8_Index *index, u64 utf8_index, u64 count) {
+	u64 byte_index = utf8_index_lookup(index, utf8_index);
+	u64 byte_end_index = utf8_index_lookup(index, utf8_index+count);
+	
+	return string_view(index->str, byte_index, byte_end_index-byte_index);
+}
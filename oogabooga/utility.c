@@ -1,3 +1,5 @@
+#define swap(a, b, type) { type t = a; a = b; b = t;  }
+
 
 
 
@@ -10,51 +12,95 @@
 // gain is very promising.
 // At 21 bits I'm able to sort a completely randomized collection of 100k integers at around
 // 8m cycles (or 2.5-2.6ms on my shitty laptop i5-11300H)
-void radix_sort(void *collection, void *help_buffer, u64 item_count, u64 item_size, u64 sort_value_offset_in_item, u64 number_of_bits) {
-    local_persist const int RADIX = 256;
-    local_persist const int BITS_PER_PASS = 8;
-    
-    const int PASS_COUNT = ((number_of_bits + BITS_PER_PASS - 1) / BITS_PER_PASS);
-    const u64 HALF_RANGE_OF_VALUE_BITS = 1ULL << (number_of_bits - 1);
-
-    u64 count[RADIX];
-    u64 prefix_sum[RADIX];
-
-    for (u32 pass = 0; pass < PASS_COUNT; ++pass) {
-        u32 shift = pass * BITS_PER_PASS;
-
-        memset(count, 0, sizeof(count));
-
-        for (u64 i = 0; i < item_count; ++i) {
-        	u8 *item = (u8*)collection + i * item_size;
-        	
-            u64 sort_value = *(u64*)(item + sort_value_offset_in_item);
-            sort_value += HALF_RANGE_OF_VALUE_BITS; // We treat the value as a signed integer
-            
-            u32 digit = (sort_value >> shift) & (RADIX-1);
-            ++count[digit];
-        }
+//
+// Histograms for all passes are counted in one read of the collection, and passes where every
+// item has the same digit are skipped (f.ex. when all quads are on a few z layers).
+// For big item sizes it's a lot cheaper to sort Radix_Sort_Pair's with radix_sort_pairs and
+// then read the items through the sorted indices.
+// See radix_sort_parallel in jobs.c for a multi-threaded version.
+#define RADIX_SORT_RADIX 256
+#define RADIX_SORT_BITS_PER_PASS 8
+#define RADIX_SORT_MAX_PASSES 8
 
-        prefix_sum[0] = 0;
-        for (u32 i = 1; i < RADIX; ++i) {
-            prefix_sum[i] = prefix_sum[i - 1] + count[i - 1];
-        }
+typedef struct Radix_Sort_Pair {
+	u64 key;
+	u64 index;
+} Radix_Sort_Pair;
 
-        for (u64 i = 0; i < item_count; ++i) {
-        	u8 *item = (u8*)collection + i * item_size;
-        	
-            u64 sort_value = *(u64*)(item + sort_value_offset_in_item);
-            sort_value += HALF_RANGE_OF_VALUE_BITS; // We treat the value as a signed integer
-            
-            u32 digit = (sort_value >> shift) & (RADIX-1);
-            memcpy((u8*)help_buffer + prefix_sum[digit] * item_size, item, item_size);
-            ++prefix_sum[digit];
-        }
+// Sort values are treated as signed number_of_bits integers, so we bias them to unsigned
+inline u64 _radix_sort_key(void *item, u64 sort_value_offset_in_item, u64 bias) {
+	return *(u64*)((u8*)item + sort_value_offset_in_item) + bias;
+}
+inline void _radix_sort_copy_item(void *dst, void *src, u64 item_size) {
+	if (item_size == sizeof(Radix_Sort_Pair)) *(Radix_Sort_Pair*)dst = *(Radix_Sort_Pair*)src;
+	else memcpy(dst, src, item_size);
+}
+// Counts digits of all passes in one go. counts must be [pass_count][RADIX_SORT_RADIX] and zeroed.
+void _radix_sort_count(u8 *items, u64 first, u64 end, u64 item_size, u64 sort_value_offset_in_item, u64 bias, u32 pass_count, u64 *counts) {
+	for (u64 i = first; i < end; ++i) {
+		u64 sort_value = _radix_sort_key(items + i*item_size, sort_value_offset_in_item, bias);
+		for (u32 pass = 0; pass < pass_count; ++pass) {
+			u32 digit = (sort_value >> (pass*RADIX_SORT_BITS_PER_PASS)) & (RADIX_SORT_RADIX-1);
+			++counts[pass*RADIX_SORT_RADIX + digit];
+		}
+	}
+}
+// If one digit has all the items, the pass wouldn't move anything
+inline bool _radix_sort_pass_is_trivial(u64 *count, u64 item_count) {
+	for (u32 i = 0; i < RADIX_SORT_RADIX; ++i) {
+		if (count[i] != 0) return count[i] == item_count;
+	}
+	return true;
+}
 
-        memcpy(collection, help_buffer, item_count * item_size);
-    }
+void _radix_sort_generic(void *collection, void *help_buffer, u64 item_count, u64 item_size, u64 sort_value_offset_in_item, u64 number_of_bits, u64 bias) {
+	assert(number_of_bits > 0 && number_of_bits <= 64, "radix_sort number_of_bits must be 1-64");
+	
+	const u32 PASS_COUNT = (u32)((number_of_bits + RADIX_SORT_BITS_PER_PASS - 1) / RADIX_SORT_BITS_PER_PASS);
+
+	u64 counts[RADIX_SORT_MAX_PASSES][RADIX_SORT_RADIX];
+	u64 prefix_sum[RADIX_SORT_RADIX];
+	
+	memset(counts, 0, sizeof(u64)*RADIX_SORT_RADIX*PASS_COUNT);
+	_radix_sort_count((u8*)collection, 0, item_count, item_size, sort_value_offset_in_item, bias, PASS_COUNT, (u64*)counts);
+	
+	// Ping-pong between the buffers instead of copying back after every pass
+	u8 *src = (u8*)collection;
+	u8 *dst = (u8*)help_buffer;
+
+	for (u32 pass = 0; pass < PASS_COUNT; ++pass) {
+		if (_radix_sort_pass_is_trivial(counts[pass], item_count)) continue;
+		
+		u32 shift = pass * RADIX_SORT_BITS_PER_PASS;
+
+		prefix_sum[0] = 0;
+		for (u32 i = 1; i < RADIX_SORT_RADIX; ++i) {
+			prefix_sum[i] = prefix_sum[i - 1] + counts[pass][i - 1];
+		}
+
+		for (u64 i = 0; i < item_count; ++i) {
+			u8 *item = src + i * item_size;
+			u64 sort_value = _radix_sort_key(item, sort_value_offset_in_item, bias);
+			u32 digit = (sort_value >> shift) & (RADIX_SORT_RADIX-1);
+			_radix_sort_copy_item(dst + prefix_sum[digit] * item_size, item, item_size);
+			++prefix_sum[digit];
+		}
+
+		swap(src, dst, u8*);
+	}
+	
+	if (src != collection) memcpy(collection, src, item_count * item_size);
 }
 
+void radix_sort(void *collection, void *help_buffer, u64 item_count, u64 item_size, u64 sort_value_offset_in_item, u64 number_of_bits) {
+	_radix_sort_generic(collection, help_buffer, item_count, item_size, sort_value_offset_in_item, number_of_bits, 1ULL << (number_of_bits - 1));
+}
+// Keys are unsigned here. help_buffer should be item_count pairs.
+void radix_sort_pairs(Radix_Sort_Pair *pairs, Radix_Sort_Pair *help_buffer, u64 item_count, u64 number_of_bits) {
+	_radix_sort_generic(pairs, help_buffer, item_count, sizeof(Radix_Sort_Pair), offsetof(Radix_Sort_Pair, key), number_of_bits, 0);
+}
+
+// Stable, but needs a help_buffer the same size as collection. Use sort() if you don't need stable.
 void merge_sort(void *collection, void *help_buffer, u64 item_count, u64 item_size, int (*compare)(const void *, const void *)) {
     u8 *items = (u8 *)collection;
     u8 *buffer = (u8 *)help_buffer;
@@ -99,9 +145,204 @@ void merge_sort(void *collection, void *help_buffer, u64 item_count, u64 item_si
     }
 }
 
+///
+// In-place sorting
+// Pattern-defeating quicksort (pdqsort): quicksort with median-of-3 (ninther for big ranges)
+// pivots and insertion sort for small ranges. Already sorted/reversed runs are detected and
+// finished with insertion sort, many equal items are partitioned out in one go, and ranges
+// that keep partitioning badly are shuffled and finally heap sorted, so worst case is n*log(n).
+// Not stable. No extra memory, unlike merge_sort.
+//
+//	sort(things, count, sizeof(Thing), compare_things); // Calls compare per comparison
+//	sort_u32(numbers, count);
+//	sort_f32(floats, count); // NaN's end up wherever
+//	sort_by_key_offset(quads, count, sizeof(Draw_Quad), offsetof(Draw_Quad, z)); // s32 key
+//
+// The typed versions are instantiated with _SORT_DEFINE, so the comparison is inlined.
+#define SORT_INSERTION_SORT_THRESHOLD 24
+#define SORT_NINTHER_THRESHOLD 128
+#define SORT_PARTIAL_INSERTION_SORT_LIMIT 8
+
+typedef struct Sort_Context {
+	u64 item_size;
+	u64 key_offset;
+	int (*compare)(const void *, const void *);
+} Sort_Context;
+
+inline void _sort_swap_bytes(u8 *a, u8 *b, u64 size) {
+	u8 t[32];
+	while (size >= sizeof(t)) {
+		memcpy(t, a, sizeof(t));
+		memcpy(a, b, sizeof(t));
+		memcpy(b, t, sizeof(t));
+		a += sizeof(t); b += sizeof(t); size -= sizeof(t);
+	}
+	if (size > 0) {
+		memcpy(t, a, size);
+		memcpy(a, b, size);
+		memcpy(b, t, size);
+	}
+}
+// How many badly balanced partitions we allow before we give up and heap sort
+s32 _sort_bad_partitions_allowed(u64 item_count) {
+	s32 log2 = 0;
+	while (item_count >>= 1) log2 += 1;
+	return log2;
+}
+
+// LESS(i, j) and SWAP(i, j) take item indices and may use items and c.
+#define _SORT_DEFINE(name, LESS, SWAP) \
+	void _##name##_insertion_sort(u8 *items, s64 begin, s64 end, Sort_Context *c) { \
+		for (s64 i = begin+1; i < end; i++) { \
+			for (s64 j = i; j > begin && LESS(j, j-1); j--) SWAP(j, j-1); \
+		} \
+	} \
+	bool _##name##_partial_insertion_sort(u8 *items, s64 begin, s64 end, Sort_Context *c) { \
+		u64 moves = 0; \
+		for (s64 i = begin+1; i < end; i++) { \
+			for (s64 j = i; j > begin && LESS(j, j-1); j--) { SWAP(j, j-1); moves += 1; } \
+			if (moves > SORT_PARTIAL_INSERTION_SORT_LIMIT) return false; \
+		} \
+		return true; \
+	} \
+	void _##name##_sift_down(u8 *items, s64 begin, s64 root, s64 count, Sort_Context *c) { \
+		while (true) { \
+			s64 child = root*2+1; \
+			if (child >= count) break; \
+			if (child+1 < count && LESS(begin+child, begin+child+1)) child += 1; \
+			if (!LESS(begin+root, begin+child)) break; \
+			SWAP(begin+root, begin+child); \
+			root = child; \
+		} \
+	} \
+	void _##name##_heap_sort(u8 *items, s64 begin, s64 end, Sort_Context *c) { \
+		s64 count = end-begin; \
+		for (s64 i = count/2-1; i >= 0; i--) _##name##_sift_down(items, begin, i, count, c); \
+		for (s64 n = count-1; n > 0; n--) { \
+			SWAP(begin, begin+n); \
+			_##name##_sift_down(items, begin, 0, n, c); \
+		} \
+	} \
+	void _##name##_sort3(u8 *items, s64 a, s64 b, s64 d, Sort_Context *c) { \
+		if (LESS(b, a)) SWAP(a, b); \
+		if (LESS(d, b)) SWAP(b, d); \
+		if (LESS(b, a)) SWAP(a, b); \
+	} \
+	s64 _##name##_partition_right(u8 *items, s64 begin, s64 end, bool *already_partitioned, Sort_Context *c) { \
+		s64 first = begin; \
+		s64 last = end; \
+		while (LESS(++first, begin)); \
+		if (first-1 == begin) while (first < last && !LESS(--last, begin)); \
+		else                  while (                !LESS(--last, begin)); \
+		*already_partitioned = first >= last; \
+		while (first < last) { \
+			SWAP(first, last); \
+			while (LESS(++first, begin)); \
+			while (!LESS(--last, begin)); \
+		} \
+		s64 pivot_pos = first-1; \
+		SWAP(begin, pivot_pos); \
+		return pivot_pos; \
+	} \
+	s64 _##name##_partition_left(u8 *items, s64 begin, s64 end, Sort_Context *c) { \
+		s64 first = begin; \
+		s64 last = end; \
+		while (LESS(begin, --last)); \
+		if (last+1 == end) while (first < last && !LESS(begin, ++first)); \
+		else               while (                !LESS(begin, ++first)); \
+		while (first < last) { \
+			SWAP(first, last); \
+			while (LESS(begin, --last)); \
+			while (!LESS(begin, ++first)); \
+		} \
+		SWAP(begin, last); \
+		return last; \
+	} \
+	void _##name##_loop(u8 *items, s64 begin, s64 end, s32 bad_allowed, bool leftmost, Sort_Context *c) { \
+		while (true) { \
+			s64 size = end-begin; \
+			if (size < SORT_INSERTION_SORT_THRESHOLD) { \
+				_##name##_insertion_sort(items, begin, end, c); \
+				return; \
+			} \
+			s64 s2 = size/2; \
+			if (size > SORT_NINTHER_THRESHOLD) { \
+				_##name##_sort3(items, begin, begin+s2, end-1, c); \
+				_##name##_sort3(items, begin+1, begin+s2-1, end-2, c); \
+				_##name##_sort3(items, begin+2, begin+s2+1, end-3, c); \
+				_##name##_sort3(items, begin+s2-1, begin+s2, begin+s2+1, c); \
+				SWAP(begin, begin+s2); \
+			} else { \
+				_##name##_sort3(items, begin+s2, begin, end-1, c); \
+			} \
+			if (!leftmost && !LESS(begin-1, begin)) { \
+				begin = _##name##_partition_left(items, begin, end, c)+1; \
+				continue; \
+			} \
+			bool already_partitioned; \
+			s64 pivot_pos = _##name##_partition_right(items, begin, end, &already_partitioned, c); \
+			s64 l_size = pivot_pos-begin; \
+			s64 r_size = end-(pivot_pos+1); \
+			if (l_size < size/8 || r_size < size/8) { \
+				bad_allowed -= 1; \
+				if (bad_allowed <= 0) { \
+					_##name##_heap_sort(items, begin, end, c); \
+					return; \
+				} \
+				if (l_size >= SORT_INSERTION_SORT_THRESHOLD) { \
+					SWAP(begin, begin+l_size/4); \
+					SWAP(pivot_pos-1, pivot_pos-l_size/4); \
+				} \
+				if (r_size >= SORT_INSERTION_SORT_THRESHOLD) { \
+					SWAP(pivot_pos+1, pivot_pos+1+r_size/4); \
+					SWAP(end-1, end-r_size/4); \
+				} \
+			} else if (already_partitioned) { \
+				if (_##name##_partial_insertion_sort(items, begin, pivot_pos, c) \
+				 && _##name##_partial_insertion_sort(items, pivot_pos+1, end, c)) return; \
+			} \
+			_##name##_loop(items, begin, pivot_pos, bad_allowed, leftmost, c); \
+			begin = pivot_pos+1; \
+			leftmost = false; \
+		} \
+	}
+
+#define _SORT_ITEM(i) (items + (i)*c->item_size)
+#define _SORT_SWAP_ITEMS(i, j) _sort_swap_bytes(_SORT_ITEM(i), _SORT_ITEM(j), c->item_size)
+
+#define _SORT_COMPARE_LESS(i, j) (c->compare(_SORT_ITEM(i), _SORT_ITEM(j)) < 0)
+_SORT_DEFINE(sort_compare, _SORT_COMPARE_LESS, _SORT_SWAP_ITEMS)
+
+#define _SORT_KEY_S32(i) (*(s32*)(_SORT_ITEM(i) + c->key_offset))
+#define _SORT_KEY_LESS(i, j) (_SORT_KEY_S32(i) < _SORT_KEY_S32(j))
+_SORT_DEFINE(sort_key_s32, _SORT_KEY_LESS, _SORT_SWAP_ITEMS)
+
+#define _SORT_U32_LESS(i, j) (((u32*)items)[i] < ((u32*)items)[j])
+#define _SORT_U32_SWAP(i, j) swap(((u32*)items)[i], ((u32*)items)[j], u32)
+_SORT_DEFINE(sort_u32, _SORT_U32_LESS, _SORT_U32_SWAP)
+
+#define _SORT_F32_LESS(i, j) (((f32*)items)[i] < ((f32*)items)[j])
+#define _SORT_F32_SWAP(i, j) swap(((f32*)items)[i], ((f32*)items)[j], f32)
+_SORT_DEFINE(sort_f32, _SORT_F32_LESS, _SORT_F32_SWAP)
+
+void sort(void *collection, u64 item_count, u64 item_size, int (*compare)(const void *, const void *)) {
+	Sort_Context c = {item_size, 0, compare};
+	_sort_compare_loop((u8*)collection, 0, (s64)item_count, _sort_bad_partitions_allowed(item_count), true, &c);
+}
+// Sorts by an s32 at key_offset in each item
+void sort_by_key_offset(void *collection, u64 item_count, u64 item_size, u64 key_offset) {
+	Sort_Context c = {item_size, key_offset, 0};
+	_sort_key_s32_loop((u8*)collection, 0, (s64)item_count, _sort_bad_partitions_allowed(item_count), true, &c);
+}
+void sort_u32(u32 *items, u64 item_count) {
+	_sort_u32_loop((u8*)items, 0, (s64)item_count, _sort_bad_partitions_allowed(item_count), true, 0);
+}
+void sort_f32(f32 *items, u64 item_count) {
+	_sort_f32_loop((u8*)items, 0, (s64)item_count, _sort_bad_partitions_allowed(item_count), true, 0);
+}
+
 inline bool bytes_match(void *a, void *b, u64 count) { return memcmp(a, b, count) == 0; }
 
-#define swap(a, b, type) { type t = a; a = b; b = t;  }
 
 
 // This isn't really linmath but just putting it here for now